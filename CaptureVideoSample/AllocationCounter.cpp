@@ -0,0 +1,46 @@
+#include "pch.h"
+#include "AllocationCounter.h"
+
+#ifdef ALLOCATION_COUNTER_ENABLED
+thread_local uint64_t t_allocationCount = 0;
+
+// The array and nothrow forms all end up here. Over-aligned allocations
+// aren't counted, nothing on the per-frame path uses them.
+void* operator new(size_t size)
+{
+    t_allocationCount++;
+    while (true)
+    {
+        if (auto pointer = malloc(size == 0 ? 1 : size))
+        {
+            return pointer;
+        }
+        auto handler = std::get_new_handler();
+        if (!handler)
+        {
+            throw std::bad_alloc();
+        }
+        handler();
+    }
+}
+
+void operator delete(void* pointer) noexcept
+{
+    free(pointer);
+}
+
+void operator delete(void* pointer, size_t) noexcept
+{
+    free(pointer);
+}
+
+uint64_t GetThreadAllocationCount()
+{
+    return t_allocationCount;
+}
+#else
+uint64_t GetThreadAllocationCount()
+{
+    return 0;
+}
+#endif
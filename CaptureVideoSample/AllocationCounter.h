@@ -0,0 +1,9 @@
+#pragma once
+#ifdef _DEBUG
+#define ALLOCATION_COUNTER_ENABLED
+#endif
+
+// How many times operator new has been called on the current thread. Only
+// counted in debug builds, always 0 otherwise. Take the difference of two
+// calls to see whether the code between them allocated.
+uint64_t GetThreadAllocationCount();
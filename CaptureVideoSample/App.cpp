@@ -7,6 +7,7 @@ namespace winrt
     using namespace Windows::Foundation;
     using namespace Windows::Graphics;
     using namespace Windows::Graphics::Capture;
+    using namespace Windows::Graphics::DirectX;
     using namespace Windows::Storage;
     using namespace Windows::UI::Composition;
 }
@@ -16,6 +17,14 @@ namespace util
     using namespace robmikh::common::uwp;
 }
 
+const std::wstring SharedFrameRingName = L"Local\\CaptureVideoSample.Frames";
+const std::wstring RtpStreamHost = L"127.0.0.1";
+const uint16_t RtpStreamPort = 5004;
+// Keeps seeking in long recordings fast
+const winrt::TimeSpan KeyFrameInterval = std::chrono::seconds(2);
+const winrt::TimeSpan TimelapseInterval = std::chrono::seconds(5);
+const winrt::TimeSpan ThumbnailInterval = std::chrono::seconds(10);
+
 App::App(winrt::ContainerVisual const& root)
 {
     m_compositor = root.Compositor();
@@ -46,13 +55,22 @@ App::App(winrt::ContainerVisual const& root)
 
 App::~App()
 {
+    if (m_recordingSession != nullptr)
+    {
+        m_recordingSession->Stop(StopMode::Abort);
+    }
 }
 
 winrt::IAsyncOperation<winrt::StorageFile> App::StartRecordingAsync(
-    winrt::GraphicsCaptureItem const& item,
+    std::vector<winrt::GraphicsCaptureItem> items,
     winrt::SizeInt32 const& resolution,
     uint32_t bitRate,
-    uint32_t frameRate)
+    uint32_t frameRate,
+    winrt::DirectXPixelFormat pixelFormat,
+    HMONITOR monitor,
+    bool exportFrames,
+    bool streamOverRtp,
+    bool timelapse)
 {
     auto tempFolderPath = std::filesystem::temp_directory_path().wstring();
     OutputDebugStringW(tempFolderPath.c_str());
@@ -60,22 +78,152 @@ winrt::IAsyncOperation<winrt::StorageFile> App::StartRecordingAsync(
     auto appFolder = co_await tempFolder.CreateFolderAsync(L"CaptureVideoSample", winrt::CreationCollisionOption::OpenIfExists);
     auto file = co_await appFolder.CreateFileAsync(L"tempRecording.mp4", winrt::CreationCollisionOption::GenerateUniqueName);
 
+    RecordingStopMetrics stopMetrics;
     {
         auto stream = co_await file.OpenAsync(winrt::FileAccessMode::ReadWrite);
-        m_recordingSession = VideoRecordingSession::Create(
+        // StopRecording releases m_recordingSession whenever we're waiting,
+        // from here on only use our own reference
+        auto session = VideoRecordingSession::Create(
             m_device,
-            item,
+            items.front(),
             resolution,
             bitRate,
             frameRate, 
+            pixelFormat,
             stream);
+        m_recordingSession = session;
+        if (pixelFormat == winrt::DirectXPixelFormat::R16G16B16A16Float)
+        {
+            session->SetToneMapSettings(GetMonitorToneMapSettings(monitor));
+        }
+        session->SetKeyFrameInterval(KeyFrameInterval);
+        session->EnableRecordingIndex(std::wstring(file.Path()), ThumbnailInterval);
+        if (!m_tracePath.empty())
+        {
+            session->EnableCaptureTrace(m_tracePath, m_traceIncludesPixels);
+        }
+        if (items.size() > 1)
+        {
+            auto layout = items.size() == 2 ? CreatePictureInPictureLayout() : CreateGridLayout(items.size());
+            session->SetLayoutRegion(layout.front());
+            for (size_t i = 1; i < items.size(); i++)
+            {
+                session->AddSource(items[i], layout[i]);
+            }
+        }
+        if (timelapse)
+        {
+            session->EnableTimelapse(TimelapseInterval);
+        }
+        if (exportFrames)
+        {
+            // e.g. a reader still has a ring of another size open, which
+            // shouldn't stop the recording
+            try
+            {
+                session->EnableSharedFrameExport(SharedFrameRingName, 4);
+            }
+            catch (winrt::hresult_error const& error)
+            {
+                OutputDebugStringW(error.message().c_str());
+            }
+        }
+        std::shared_ptr<RtpStreamSink> streamSink;
+        if (streamOverRtp)
+        {
+            streamSink = session->EnableRtpStreaming(RtpStreamHost, RtpStreamPort);
+
+            // Players need a session description to know how to receive the stream
+            auto sdpFile = co_await appFolder.CreateFileAsync(L"stream.sdp", winrt::CreationCollisionOption::ReplaceExisting);
+            co_await winrt::FileIO::WriteTextAsync(sdpFile, winrt::to_hstring(streamSink->CreateSessionDescription()));
+            OutputDebugStringW(sdpFile.Path().c_str());
+        }
+
+        // The recording may have been stopped while the description was being
+        // written, in which case StartAsync returns right away
+        if (m_recordingSession == session)
+        {
+            auto surface = session->CreatePreviewSurface(m_compositor);
+            m_brush.Surface(surface);
+        }
+        co_await session->StartAsync();
 
-        auto surface = m_recordingSession->CreatePreviewSurface(m_compositor);
-        m_brush.Surface(surface);
+        stopMetrics = session->StopMetrics();
+        {
+            std::wstringstream message;
+            message << L"Stopped (" << (stopMetrics.Mode == StopMode::Drain ? L"drain" : L"abort") << L") in "
+                << stopMetrics.Latency.count() << L"us, " << stopMetrics.FramesEncoded << L" frames encoded, "
+                << stopMetrics.FramesDiscarded << L" discarded" << std::endl;
+            OutputDebugStringW(message.str().c_str());
+        }
 
-        co_await m_recordingSession->StartAsync();
+        {
+            auto copyMetrics = session->CopyMetrics();
+            std::wstringstream message;
+            message << L"Copied " << copyMetrics.TotalBytesCopied << L" bytes over " << copyMetrics.Frames << L" frames ("
+                << copyMetrics.IncrementalFrames << L" incremental), average dirty ratio " << copyMetrics.AverageDirtyRatio
+                << L", " << session->SamplePoolSize() << L" pooled samples" << std::endl;
+            if (copyMetrics.FramesWithAllocations > 0)
+            {
+                message << L"  " << copyMetrics.Allocations << L" allocations over " << copyMetrics.FramesWithAllocations
+                    << L" frames, the last was frame " << copyMetrics.LastAllocatingFrame << std::endl;
+            }
+            OutputDebugStringW(message.str().c_str());
+        }
+
+        {
+            auto keyFrames = session->KeyFrames();
+            std::wstringstream message;
+            message << L"Keyframes: " << keyFrames.size() << std::endl;
+            for (auto&& keyFrame : keyFrames)
+            {
+                message << L"  " << std::chrono::duration_cast<std::chrono::milliseconds>(keyFrame.Timestamp).count() << L"ms"
+                    << (keyFrame.WasRequested ? L" (requested)" : L"") << std::endl;
+            }
+            OutputDebugStringW(message.str().c_str());
+        }
+
+        if (exportFrames)
+        {
+            auto metrics = session->ExportMetrics();
+            std::wstringstream message;
+            message << L"Export: " << metrics.FramesDelivered << L" of " << metrics.FramesSubmitted << L" frames read back, "
+                << metrics.Stalls << L" map stalls, total " << metrics.TotalStall.count() << L"us max "
+                << metrics.MaxStall.count() << L"us, handler total " << metrics.TotalHandlerTime.count() << L"us max "
+                << metrics.MaxHandlerTime.count() << L"us, " << metrics.StaleDeliveries << L" handed over by age" << std::endl;
+            OutputDebugStringW(message.str().c_str());
+        }
+
+        {
+            std::wstringstream message;
+            for (size_t i = 0; i < session->SinkCount(); i++)
+            {
+                auto metrics = session->SinkMetrics(i);
+                message << L"Sink " << i << L": " << metrics.FramesDelivered << L" frames delivered, " << metrics.FramesDropped
+                    << L" dropped, max queued " << metrics.MaxQueued << L", " << metrics.Stalls << L" stalls, total "
+                    << metrics.TotalStall.count() << L"us" << (metrics.IsDisconnected ? L" (disconnected)" : L"") << std::endl;
+            }
+            OutputDebugStringW(message.str().c_str());
+        }
+
+        if (streamSink)
+        {
+            auto metrics = streamSink->Metrics();
+            auto averageSendLatency = metrics.FramesSent > 0 ? metrics.TotalSendLatency.count() / static_cast<int64_t>(metrics.FramesSent) : 0;
+            std::wstringstream message;
+            message << L"RTP: " << metrics.FramesSent << L" frames, " << metrics.PacketsSent << L" packets, "
+                << metrics.SendErrors << L" send errors, capture to send latency avg " << averageSendLatency << L"us max "
+                << metrics.MaxSendLatency.count() << L"us" << std::endl;
+            OutputDebugStringW(message.str().c_str());
+        }
     }
 
+    // Stopping before the first frame leaves us with nothing to save
+    if (stopMetrics.FramesEncoded == 0)
+    {
+        co_await file.DeleteAsync();
+        co_return nullptr;
+    }
     co_return file;
 }
 
@@ -83,8 +231,22 @@ void App::StopRecording()
 {
     if (m_recordingSession != nullptr)
     {
-        m_recordingSession->Close();
+        m_recordingSession->Stop(StopMode::Drain);
         m_brush.Surface(nullptr);
         m_recordingSession = nullptr;
     }
 }
+
+void App::RequestKeyFrame()
+{
+    if (m_recordingSession != nullptr)
+    {
+        m_recordingSession->RequestKeyFrame();
+    }
+}
+
+void App::EnableCaptureTrace(std::wstring const& path, bool includePixels)
+{
+    m_tracePath = path;
+    m_traceIncludesPixels = includePixels;
+}
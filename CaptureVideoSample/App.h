@@ -9,11 +9,21 @@ public:
     ~App();
 
     winrt::Windows::Foundation::IAsyncOperation<winrt::Windows::Storage::StorageFile> StartRecordingAsync(
-        winrt::Windows::Graphics::Capture::GraphicsCaptureItem const& item,
+        // Two items are shown picture-in-picture, more than that in a grid
+        std::vector<winrt::Windows::Graphics::Capture::GraphicsCaptureItem> items,
         winrt::Windows::Graphics::SizeInt32 const& resolution,
         uint32_t bitRate,
-        uint32_t frameRate);
+        uint32_t frameRate,
+        winrt::Windows::Graphics::DirectX::DirectXPixelFormat pixelFormat,
+        // HDR content is tone mapped for this monitor's settings
+        HMONITOR monitor,
+        bool exportFrames,
+        bool streamOverRtp,
+        bool timelapse);
     void StopRecording();
+    void RequestKeyFrame();
+    // Every recording after this also writes a capture trace to the given path.
+    void EnableCaptureTrace(std::wstring const& path, bool includePixels);
 
 private:
     winrt::Windows::UI::Composition::Compositor m_compositor{ nullptr };
@@ -23,4 +33,6 @@ private:
 
     winrt::Windows::Graphics::DirectX::Direct3D11::IDirect3DDevice m_device{ nullptr };
     std::shared_ptr<VideoRecordingSession> m_recordingSession;
+    std::wstring m_tracePath;
+    bool m_traceIncludesPixels = false;
 };
\ No newline at end of file
@@ -0,0 +1,82 @@
+#pragma once
+
+// A FIFO whose storage is allocated once, up front. Pushing and popping never
+// touch the heap, which std::deque can't promise, so this is what the
+// per-frame path uses to hand frames between threads. Not thread safe.
+template <typename T>
+class BoundedQueue
+{
+public:
+    explicit BoundedQueue(size_t capacity) : m_items(std::max<size_t>(capacity, 1)) {}
+
+    size_t Capacity() const { return m_items.size(); }
+    size_t Size() const { return m_size; }
+    bool IsEmpty() const { return m_size == 0; }
+    bool IsFull() const { return m_size == m_items.size(); }
+
+    // The queue must not be empty.
+    T& Front()
+    {
+        WINRT_ASSERT(!IsEmpty());
+        return m_items[m_front];
+    }
+
+    // Returns false, leaving the item alone, if the queue is full.
+    bool TryPushBack(T&& item)
+    {
+        if (IsFull())
+        {
+            return false;
+        }
+        m_items[(m_front + m_size) % m_items.size()] = std::move(item);
+        m_size++;
+        return true;
+    }
+
+    // The queue must not be empty.
+    T PopFront()
+    {
+        WINRT_ASSERT(!IsEmpty());
+        auto item = std::move(m_items[m_front]);
+        m_items[m_front] = T{};
+        m_front = (m_front + 1) % m_items.size();
+        m_size--;
+        return item;
+    }
+
+    // The queue must not be empty.
+    T PopBack()
+    {
+        WINRT_ASSERT(!IsEmpty());
+        auto& slot = m_items[(m_front + m_size - 1) % m_items.size()];
+        auto item = std::move(slot);
+        slot = T{};
+        m_size--;
+        return item;
+    }
+
+    // Calls the function on each item, oldest first.
+    template <typename Function>
+    void ForEach(Function&& function)
+    {
+        for (size_t i = 0; i < m_size; i++)
+        {
+            function(m_items[(m_front + i) % m_items.size()]);
+        }
+    }
+
+    // Releases whatever the items were holding on to.
+    void Clear()
+    {
+        while (!IsEmpty())
+        {
+            PopFront();
+        }
+        m_front = 0;
+    }
+
+private:
+    std::vector<T> m_items;
+    size_t m_front = 0;
+    size_t m_size = 0;
+};
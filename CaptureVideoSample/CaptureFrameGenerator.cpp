@@ -1,9 +1,12 @@
 #include "pch.h"
 #include "CaptureFrameGenerator.h"
+#include "SystemRelativeTime.h"
+#include "DirtyRects.h"
 
 namespace winrt
 {
     using namespace Windows::Foundation;
+    using namespace Windows::Foundation::Metadata;
     using namespace Windows::Graphics;
     using namespace Windows::Graphics::Capture;
     using namespace Windows::Graphics::DirectX;
@@ -15,74 +18,120 @@ namespace winrt
 CaptureFrameGenerator::CaptureFrameGenerator(
     winrt::IDirect3DDevice const& device,
     winrt::GraphicsCaptureItem const& item,
-    winrt::SizeInt32 const& size)
+    winrt::SizeInt32 const& size,
+    winrt::DirectXPixelFormat pixelFormat)
 {
     m_device = device;
     m_item = item;
+    m_pixelFormat = pixelFormat;
+    m_lastContentSize = m_item.Size();
 
     m_nextFrameEvent = wil::shared_event(wil::EventOptions::ManualReset);
     m_endEvent = wil::shared_event(wil::EventOptions::ManualReset);
-    m_closedEvent = wil::shared_event(wil::EventOptions::ManualReset);
 
     m_framePool = winrt::Direct3D11CaptureFramePool::CreateFreeThreaded(
         m_device,
-        winrt::DirectXPixelFormat::B8G8R8A8UIntNormalized,
-        3,
+        m_pixelFormat,
+        FramePoolSize,
         size);
     m_session = m_framePool.CreateCaptureSession(m_item);
+    m_pendingDirtyRects.reserve(MaxPendingDirtyRects);
 
-    m_framePool.FrameArrived({ this, &CaptureFrameGenerator::OnFrameArrived });
-    m_session.StartCapture();
+    // Newer versions of Windows tell us which parts of each frame changed
+    if (winrt::ApiInformation::IsPropertyPresent(L"Windows.Graphics.Capture.GraphicsCaptureSession", L"DirtyRegionMode"))
+    {
+        m_session.DirtyRegionMode(winrt::GraphicsCaptureDirtyRegionMode::ReportOnly);
+        m_reportsDirtyRegions = true;
+    }
+}
+
+std::shared_ptr<CaptureFrameGenerator> CaptureFrameGenerator::Create(
+    winrt::IDirect3DDevice const& device,
+    winrt::GraphicsCaptureItem const& item,
+    winrt::SizeInt32 const& size,
+    winrt::DirectXPixelFormat pixelFormat)
+{
+    auto generator = std::shared_ptr<CaptureFrameGenerator>(new CaptureFrameGenerator(device, item, size, pixelFormat));
+    generator->StartCapture();
+    return generator;
 }
 
 CaptureFrameGenerator::~CaptureFrameGenerator()
 {
     StopCapture();
-    // We might end the capture before we ever get another frame.
-    m_closedEvent.wait(200);
 }
 
-std::optional<winrt::Direct3D11CaptureFrame> CaptureFrameGenerator::TryGetNextFrame()
+void CaptureFrameGenerator::StartCapture()
 {
+    // A frame may still be on its way to us after we stop. The handler keeps
+    // us alive until it's done, so there is nothing to wait for on shutdown.
+    auto weakPointer{ weak_from_this() };
+    m_framePool.FrameArrived([weakPointer](auto const& sender, auto const& args)
     {
-        auto lock = m_lock.lock_exclusive();
-        if (m_frames.empty() && m_endEvent.is_signaled())
+        auto sharedPointer{ weakPointer.lock() };
+
+        if (sharedPointer)
         {
-            return std::nullopt;
+            sharedPointer->OnFrameArrived(sender, args);
         }
-        else if (!m_frames.empty())
+    });
+    m_session.StartCapture();
+}
+
+std::optional<CapturedFrame> CaptureFrameGenerator::TryGetNextFrame()
+{
+    while (true)
+    {
         {
-            std::optional result(m_frames.front());
-            m_frames.pop_front();
-            return result;
+            auto lock = m_lock.lock_exclusive();
+            if (!m_frames.IsEmpty())
+            {
+                return m_frames.PopFront();
+            }
+            else if (m_endEvent.is_signaled())
+            {
+                return std::nullopt;
+            }
+            // Reset while holding the lock so we can't miss a frame that
+            // arrives before we start waiting.
+            m_nextFrameEvent.ResetEvent();
         }
+
+        std::array<HANDLE, 2> events = { m_endEvent.get(), m_nextFrameEvent.get() };
+        auto waitResult = WaitForMultipleObjectsEx(static_cast<DWORD>(events.size()), events.data(), false, INFINITE, false);
+        WINRT_VERIFY(waitResult == WAIT_OBJECT_0 || waitResult == WAIT_OBJECT_0 + 1);
     }
+}
 
-    m_nextFrameEvent.ResetEvent();
-    std::vector<HANDLE> events = { m_endEvent.get(), m_nextFrameEvent.get() };
-    auto waitResult = WaitForMultipleObjectsEx(static_cast<DWORD>(events.size()), events.data(), false, INFINITE, false);
-    auto eventIndex = -1;
-    switch (waitResult)
+bool CaptureFrameGenerator::WaitForNextFrame(std::chrono::milliseconds const& timeout)
+{
     {
-    case WAIT_OBJECT_0:
-    case WAIT_OBJECT_0 + 1:
-        eventIndex = waitResult - WAIT_OBJECT_0;
-        break;
+        auto lock = m_lock.lock_exclusive();
+        if (!m_frames.IsEmpty() || m_endEvent.is_signaled())
+        {
+            return true;
+        }
+        m_nextFrameEvent.ResetEvent();
     }
-    WINRT_VERIFY(eventIndex >= 0);
 
-    auto signaledEvent = events[eventIndex];
-    if (signaledEvent == m_endEvent.get())
+    std::array<HANDLE, 2> events = { m_endEvent.get(), m_nextFrameEvent.get() };
+    auto waitResult = WaitForMultipleObjectsEx(static_cast<DWORD>(events.size()), events.data(), false, static_cast<DWORD>(timeout.count()), false);
+    WINRT_VERIFY(waitResult == WAIT_OBJECT_0 || waitResult == WAIT_OBJECT_0 + 1 || waitResult == WAIT_TIMEOUT);
+    return waitResult != WAIT_TIMEOUT;
+}
+
+std::optional<CapturedFrame> CaptureFrameGenerator::TryGetLatestFrame()
+{
+    auto lock = m_lock.lock_exclusive();
+    if (m_frames.IsEmpty())
     {
         return std::nullopt;
     }
-    else
-    {
-        auto lock = m_lock.lock_exclusive();
-        std::optional result(m_frames.front());
-        m_frames.pop_front();
-        return result;
-    }
+
+    std::optional result(m_frames.PopBack());
+    m_frames.ForEach([](auto& frame) { frame.Frame.Close(); });
+    m_frames.Clear();
+    return result;
 }
 
 void CaptureFrameGenerator::StopCapture()
@@ -91,24 +140,135 @@ void CaptureFrameGenerator::StopCapture()
     m_endEvent.SetEvent();
     m_framePool.Close();
     m_session.Close();
+    // Flushes the trace
+    m_traceWriter = nullptr;
+}
+
+size_t CaptureFrameGenerator::AbortCapture()
+{
+    auto lock = m_lock.lock_exclusive();
+    m_endEvent.SetEvent();
+    m_framePool.Close();
+    m_session.Close();
+    m_traceWriter = nullptr;
+
+    auto count = m_frames.Size();
+    m_frames.ForEach([](auto& frame) { frame.Frame.Close(); });
+    m_frames.Clear();
+    return count;
+}
+
+void CaptureFrameGenerator::EnableTimelapse(winrt::TimeSpan const& interval, uint32_t frameRate)
+{
+    auto lock = m_lock.lock_exclusive();
+    auto frameDuration = std::chrono::duration_cast<winrt::TimeSpan>(std::chrono::seconds(1)) / frameRate;
+    m_decimator = FrameDecimator(interval, frameDuration);
+    m_frames.ForEach([](auto& frame) { frame.Frame.Close(); });
+    m_frames.Clear();
+    m_pendingFullFrame = true;
+
+    // Newer versions of Windows can skip producing the frames we would drop
+    // altogether. On older versions they're dropped as soon as they arrive.
+    if (winrt::ApiInformation::IsPropertyPresent(L"Windows.Graphics.Capture.GraphicsCaptureSession", L"MinUpdateInterval"))
+    {
+        m_session.MinUpdateInterval(interval);
+    }
 }
 
 void CaptureFrameGenerator::OnFrameArrived(
     winrt::Direct3D11CaptureFramePool const& sender,
     winrt::IInspectable const&)
 {
+    auto arrivalTime = GetSystemRelativeTime();
     auto lock = m_lock.lock_exclusive();
     if (m_endEvent.is_signaled())
     {
-        m_closedEvent.SetEvent();
         return;
     }
     auto frame = sender.TryGetNextFrame();
-    auto timeStamp = frame.SystemRelativeTime();
-    if (m_lastSeenTimestmap.count() == 0 || (timeStamp - m_lastSeenTimestmap) >= std::chrono::milliseconds(16))
+    auto frameTexture = GetDXGIInterfaceFromObject<ID3D11Texture2D>(frame.Surface());
+
+    if (m_traceWriter)
     {
-        m_lastSeenTimestmap = timeStamp;
-        m_frames.push_back(std::move(frame));
+        try
+        {
+            m_traceWriter->WriteFrame(arrivalTime, frame.SystemRelativeTime(), frame.ContentSize(), frameTexture.get());
+        }
+        catch (winrt::hresult_error const& error)
+        {
+            OutputDebugStringW(error.message().c_str());
+            m_traceWriter = nullptr;
+        }
+    }
+
+    // This frame came from the pool as it was before any resize below
+    auto textureGeneration = m_textureGeneration;
+
+    // Resize the frame pool to match the content so that the next frame isn't
+    // clipped. This frame is still valid and gets used as-is; the session is
+    // responsible for fitting whatever it gets into the output.
+    auto contentSize = frame.ContentSize();
+    if (contentSize.Width != m_lastContentSize.Width || contentSize.Height != m_lastContentSize.Height)
+    {
+        m_lastContentSize = contentSize;
+        RecreateFramePool(contentSize);
+        m_pendingFullFrame = true;
+    }
+
+    // Dirty regions are relative to the previous frame the pool produced, not
+    // the previous one we kept, so those of dropped frames are carried over.
+    // Timelapses drop a lot of frames between the ones they keep.
+    if (m_reportsDirtyRegions && !m_pendingFullFrame)
+    {
+        auto regions = frame.DirtyRegions();
+        auto regionCount = regions.Size();
+        if (m_pendingDirtyRects.size() + regionCount > MaxPendingDirtyRects)
+        {
+            m_pendingDirtyRects.clear();
+            m_pendingFullFrame = true;
+        }
+        else
+        {
+            regionCount = regions.GetMany(0, m_dirtyRegions);
+            for (uint32_t i = 0; i < regionCount; i++)
+            {
+                auto&& region = m_dirtyRegions[i];
+                m_pendingDirtyRects.push_back({ region.X, region.Y, region.X + region.Width, region.Y + region.Height });
+            }
+        }
+    }
+
+    // Frames we don't want are released right away, nothing has been
+    // copied from them yet.
+    if (auto timeStamp = m_decimator.TryKeepFrame(frame.SystemRelativeTime()))
+    {
+        CapturedFrame captured;
+        captured.Texture = frameTexture;
+        captured.ContentSize = contentSize;
+        captured.Timestamp = timeStamp.value();
+        captured.CaptureTime = frame.SystemRelativeTime();
+        captured.TextureGeneration = textureGeneration;
+        captured.Frame = std::move(frame);
+        if (m_reportsDirtyRegions && !m_pendingFullFrame)
+        {
+            CoalesceRects(m_pendingDirtyRects, MaxFrameDirtyRects);
+            captured.HasDirtyRects = true;
+            captured.DirtyRectCount = static_cast<uint32_t>(m_pendingDirtyRects.size());
+            std::copy(m_pendingDirtyRects.begin(), m_pendingDirtyRects.end(), captured.DirtyRects.begin());
+        }
+        m_pendingDirtyRects.clear();
+        m_pendingFullFrame = false;
+
+        // The session has fallen far behind, make room by dropping the oldest
+        // frame. The frame after it changed relative to pixels the session
+        // will never see, so it has to be treated as entirely dirty.
+        if (m_frames.IsFull())
+        {
+            m_frames.PopFront().Frame.Close();
+            auto& next = m_frames.IsEmpty() ? captured : m_frames.Front();
+            next.HasDirtyRects = false;
+        }
+        m_frames.TryPushBack(std::move(captured));
         m_nextFrameEvent.SetEvent();
     }
     else
@@ -116,3 +276,31 @@ void CaptureFrameGenerator::OnFrameArrived(
         frame.Close();
     }
 }
+
+void CaptureFrameGenerator::RecreateFramePool(winrt::SizeInt32 const& size)
+{
+    auto start = std::chrono::steady_clock::now();
+    m_framePool.Recreate(m_device, m_pixelFormat, FramePoolSize, size);
+    m_textureGeneration++;
+    auto duration = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start);
+
+    m_resizeMetrics.Count++;
+    m_resizeMetrics.LastDuration = duration;
+    m_resizeMetrics.TotalDuration += duration;
+
+    std::wstringstream stream;
+    stream << L"Recreated frame pool at " << size.Width << L"x" << size.Height << L" in " << duration.count() << L"us" << std::endl;
+    OutputDebugStringW(stream.str().c_str());
+}
+
+FramePoolResizeMetrics CaptureFrameGenerator::ResizeMetrics()
+{
+    auto lock = m_lock.lock_exclusive();
+    return m_resizeMetrics;
+}
+
+void CaptureFrameGenerator::EnableTrace(std::shared_ptr<CaptureTraceWriter> const& writer)
+{
+    auto lock = m_lock.lock_exclusive();
+    m_traceWriter = writer;
+}
@@ -1,31 +1,79 @@
 #pragma once
+#include "FrameDecimator.h"
+#include "FrameSource.h"
+#include "CaptureTrace.h"
+#include "BoundedQueue.h"
 
-class CaptureFrameGenerator
+struct FramePoolResizeMetrics
+{
+    uint32_t Count = 0;
+    std::chrono::microseconds LastDuration = {};
+    std::chrono::microseconds TotalDuration = {};
+};
+
+class CaptureFrameGenerator : public FrameSource, public std::enable_shared_from_this<CaptureFrameGenerator>
 {
 public:
-    CaptureFrameGenerator(
+    [[nodiscard]] static std::shared_ptr<CaptureFrameGenerator> Create(
         winrt::Windows::Graphics::DirectX::Direct3D11::IDirect3DDevice const& device,
         winrt::Windows::Graphics::Capture::GraphicsCaptureItem const& item,
-        winrt::Windows::Graphics::SizeInt32 const& size);
+        winrt::Windows::Graphics::SizeInt32 const& size,
+        winrt::Windows::Graphics::DirectX::DirectXPixelFormat pixelFormat);
     ~CaptureFrameGenerator();
 
-    std::optional<winrt::Windows::Graphics::Capture::Direct3D11CaptureFrame> TryGetNextFrame();
-    void StopCapture();
+    std::optional<CapturedFrame> TryGetNextFrame() override;
+    std::optional<CapturedFrame> TryGetLatestFrame() override;
+    bool WaitForNextFrame(std::chrono::milliseconds const& timeout) override;
+    void StopCapture() override;
+    size_t AbortCapture() override;
+    // Only keep one frame per interval, played back at the given frame rate.
+    // Frames that were captured before this is called are discarded.
+    void EnableTimelapse(winrt::Windows::Foundation::TimeSpan const& interval, uint32_t frameRate);
+    FramePoolResizeMetrics ResizeMetrics();
+    // Records every frame that arrives, including the ones that are dropped.
+    void EnableTrace(std::shared_ptr<CaptureTraceWriter> const& writer);
 
 private:
+    CaptureFrameGenerator(
+        winrt::Windows::Graphics::DirectX::Direct3D11::IDirect3DDevice const& device,
+        winrt::Windows::Graphics::Capture::GraphicsCaptureItem const& item,
+        winrt::Windows::Graphics::SizeInt32 const& size,
+        winrt::Windows::Graphics::DirectX::DirectXPixelFormat pixelFormat);
+    void StartCapture();
     void OnFrameArrived(
         winrt::Windows::Graphics::Capture::Direct3D11CaptureFramePool const& sender,
         winrt::Windows::Foundation::IInspectable const& args);
+    void RecreateFramePool(winrt::Windows::Graphics::SizeInt32 const& size);
 
 private:
+    static const int32_t FramePoolSize = 3;
+    // Frames from before a resize can still be queued alongside the new
+    // pool's, past this the oldest are dropped.
+    static const size_t MaxQueuedFrames = FramePoolSize * 2;
+    // Merging dirty rects gets expensive quickly and this runs on the capture
+    // callback. Past this many, the next frame is treated as entirely dirty.
+    static const size_t MaxPendingDirtyRects = 64;
+
     winrt::Windows::Graphics::DirectX::Direct3D11::IDirect3DDevice m_device{ nullptr };
     winrt::Windows::Graphics::Capture::GraphicsCaptureItem m_item{ nullptr };
     winrt::Windows::Graphics::Capture::Direct3D11CaptureFramePool m_framePool{ nullptr };
     winrt::Windows::Graphics::Capture::GraphicsCaptureSession m_session{ nullptr };
+    winrt::Windows::Graphics::DirectX::DirectXPixelFormat m_pixelFormat = winrt::Windows::Graphics::DirectX::DirectXPixelFormat::B8G8R8A8UIntNormalized;
+    winrt::Windows::Graphics::SizeInt32 m_lastContentSize = {};
+    FramePoolResizeMetrics m_resizeMetrics;
     wil::shared_event m_nextFrameEvent;
     wil::shared_event m_endEvent;
-    wil::shared_event m_closedEvent;
     wil::srwlock m_lock;
-    std::deque<winrt::Windows::Graphics::Capture::Direct3D11CaptureFrame> m_frames;
-    winrt::Windows::Foundation::TimeSpan m_lastSeenTimestmap = {};
+    BoundedQueue<CapturedFrame> m_frames{ MaxQueuedFrames };
+    FrameDecimator m_decimator{ std::chrono::milliseconds(16) };
+    std::shared_ptr<CaptureTraceWriter> m_traceWriter;
+    bool m_reportsDirtyRegions = false;
+    // Dirty regions of the frames dropped since the last one we kept. Its
+    // capacity is kept from frame to frame.
+    std::vector<D3D11_RECT> m_pendingDirtyRects;
+    // Each frame's regions are copied out in one call rather than iterated,
+    // which would create an iterator per frame.
+    std::array<winrt::Windows::Graphics::RectInt32, MaxPendingDirtyRects> m_dirtyRegions = {};
+    bool m_pendingFullFrame = true;
+    uint32_t m_textureGeneration = 0;
 };
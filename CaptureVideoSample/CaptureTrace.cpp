@@ -0,0 +1,180 @@
+#include "pch.h"
+#include "CaptureTrace.h"
+
+namespace winrt
+{
+    using namespace Windows::Foundation;
+    using namespace Windows::Graphics;
+}
+
+// Records are small, so they're batched up instead of written one at a time.
+const size_t MaxBufferedBytes = 64 * 1024;
+
+uint32_t GetBytesPerPixel(DXGI_FORMAT format)
+{
+    switch (format)
+    {
+    case DXGI_FORMAT_B8G8R8A8_UNORM:
+        return 4;
+    case DXGI_FORMAT_R16G16B16A16_FLOAT:
+        return 8;
+    default:
+        throw winrt::hresult_not_implemented(L"Unsupported trace format.");
+    }
+}
+
+CaptureTraceWriter::CaptureTraceWriter(std::wstring const& path, DXGI_FORMAT format, bool includePixels)
+{
+    m_format = format;
+    m_includePixels = includePixels;
+    m_file.reset(CreateFileW(path.c_str(), GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr));
+    winrt::check_bool(static_cast<bool>(m_file));
+
+    CaptureTraceHeader header = {};
+    header.Magic = CaptureTraceMagic;
+    header.Version = CaptureTraceVersion;
+    header.Format = static_cast<uint32_t>(format);
+    header.Flags = includePixels ? CaptureTraceFlagPixels : 0;
+    Write(&header, sizeof(header));
+}
+
+CaptureTraceWriter::~CaptureTraceWriter()
+{
+    try
+    {
+        Flush();
+    }
+    catch (winrt::hresult_error const& error)
+    {
+        OutputDebugStringW(error.message().c_str());
+    }
+}
+
+void CaptureTraceWriter::WriteFrame(
+    winrt::TimeSpan const& arrivalTime,
+    winrt::TimeSpan const& frameTime,
+    winrt::SizeInt32 const& contentSize,
+    ID3D11Texture2D* texture)
+{
+    D3D11_TEXTURE2D_DESC desc = {};
+    texture->GetDesc(&desc);
+
+    CaptureTraceRecord record = {};
+    record.ArrivalTime = arrivalTime.count();
+    record.FrameTime = frameTime.count();
+    record.ContentWidth = contentSize.Width;
+    record.ContentHeight = contentSize.Height;
+    record.SurfaceWidth = desc.Width;
+    record.SurfaceHeight = desc.Height;
+    if (!m_includePixels)
+    {
+        Write(&record, sizeof(record));
+        return;
+    }
+
+    winrt::com_ptr<ID3D11Device> d3dDevice;
+    texture->GetDevice(d3dDevice.put());
+    winrt::com_ptr<ID3D11DeviceContext> d3dContext;
+    d3dDevice->GetImmediateContext(d3dContext.put());
+
+    // Frame pools get recreated when the content resizes
+    D3D11_TEXTURE2D_DESC stagingDesc = {};
+    if (m_stagingTexture)
+    {
+        m_stagingTexture->GetDesc(&stagingDesc);
+    }
+    if (!m_stagingTexture || stagingDesc.Width != desc.Width || stagingDesc.Height != desc.Height)
+    {
+        stagingDesc = desc;
+        stagingDesc.MipLevels = 1;
+        stagingDesc.ArraySize = 1;
+        stagingDesc.SampleDesc.Count = 1;
+        stagingDesc.SampleDesc.Quality = 0;
+        stagingDesc.Usage = D3D11_USAGE_STAGING;
+        stagingDesc.BindFlags = 0;
+        stagingDesc.CPUAccessFlags = D3D11_CPU_ACCESS_READ;
+        stagingDesc.MiscFlags = 0;
+        m_stagingTexture = nullptr;
+        winrt::check_hresult(d3dDevice->CreateTexture2D(&stagingDesc, nullptr, m_stagingTexture.put()));
+    }
+    d3dContext->CopyResource(m_stagingTexture.get(), texture);
+
+    auto rowSize = desc.Width * GetBytesPerPixel(m_format);
+    record.PayloadSize = rowSize * desc.Height;
+    Write(&record, sizeof(record));
+
+    D3D11_MAPPED_SUBRESOURCE mapped = {};
+    winrt::check_hresult(d3dContext->Map(m_stagingTexture.get(), 0, D3D11_MAP_READ, 0, &mapped));
+    auto unmap = wil::scope_exit([&]() { d3dContext->Unmap(m_stagingTexture.get(), 0); });
+    auto source = static_cast<uint8_t const*>(mapped.pData);
+    for (uint32_t y = 0; y < desc.Height; y++)
+    {
+        Write(source + static_cast<size_t>(y) * mapped.RowPitch, rowSize);
+    }
+}
+
+void CaptureTraceWriter::Write(void const* data, size_t size)
+{
+    auto bytes = static_cast<uint8_t const*>(data);
+    m_buffer.insert(m_buffer.end(), bytes, bytes + size);
+    if (m_buffer.size() >= MaxBufferedBytes)
+    {
+        Flush();
+    }
+}
+
+void CaptureTraceWriter::Flush()
+{
+    if (m_buffer.empty())
+    {
+        return;
+    }
+    DWORD written = 0;
+    winrt::check_bool(WriteFile(m_file.get(), m_buffer.data(), static_cast<DWORD>(m_buffer.size()), &written, nullptr));
+    m_buffer.clear();
+}
+
+CaptureTraceReader::CaptureTraceReader(std::wstring const& path)
+{
+    m_file.reset(CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr));
+    winrt::check_bool(static_cast<bool>(m_file));
+
+    Read(&m_header, sizeof(m_header));
+    if (m_header.Magic != CaptureTraceMagic || m_header.Version != CaptureTraceVersion)
+    {
+        throw winrt::hresult_error(HRESULT_FROM_WIN32(ERROR_INVALID_DATA), L"Not a capture trace.");
+    }
+    // Fails for formats we don't know how to replay
+    GetBytesPerPixel(Format());
+}
+
+bool CaptureTraceReader::TryReadNextRecord(CaptureTraceRecord& record, std::vector<uint8_t>& payload)
+{
+    DWORD read = 0;
+    winrt::check_bool(ReadFile(m_file.get(), &record, sizeof(record), &read, nullptr));
+    if (read == 0)
+    {
+        return false;
+    }
+    else if (read != sizeof(record))
+    {
+        throw winrt::hresult_error(HRESULT_FROM_WIN32(ERROR_HANDLE_EOF), L"The capture trace is truncated.");
+    }
+
+    payload.resize(record.PayloadSize);
+    if (record.PayloadSize > 0)
+    {
+        Read(payload.data(), payload.size());
+    }
+    return true;
+}
+
+void CaptureTraceReader::Read(void* data, size_t size)
+{
+    DWORD read = 0;
+    winrt::check_bool(ReadFile(m_file.get(), data, static_cast<DWORD>(size), &read, nullptr));
+    if (read != size)
+    {
+        throw winrt::hresult_error(HRESULT_FROM_WIN32(ERROR_HANDLE_EOF), L"The capture trace is truncated.");
+    }
+}
@@ -0,0 +1,84 @@
+#pragma once
+
+// A capture trace records when frames arrived from the frame pool, so that
+// the timing of a capture can be replayed later. The file is laid out as:
+//   CaptureTraceHeader
+//   CaptureTraceRecord, followed by PayloadSize bytes of pixels
+//   CaptureTraceRecord, ...
+//
+// Pixels are only recorded when asked for, as tightly packed rows of the
+// whole surface in the header's format.
+
+const uint32_t CaptureTraceMagic = 0x52545643; // 'CVTR'
+const uint32_t CaptureTraceVersion = 1;
+const uint32_t CaptureTraceFlagPixels = 0x1;
+
+struct CaptureTraceHeader
+{
+    uint32_t Magic;
+    uint32_t Version;
+    // DXGI_FORMAT of the frame pool
+    uint32_t Format;
+    uint32_t Flags;
+};
+
+struct CaptureTraceRecord
+{
+    // 100ns units, QPC based (same as SystemRelativeTime)
+    int64_t ArrivalTime;
+    int64_t FrameTime;
+    int32_t ContentWidth;
+    int32_t ContentHeight;
+    uint32_t SurfaceWidth;
+    uint32_t SurfaceHeight;
+    uint32_t PayloadSize;
+    uint32_t Reserved;
+};
+static_assert(sizeof(CaptureTraceRecord) == 40);
+
+class CaptureTraceWriter
+{
+public:
+    CaptureTraceWriter(std::wstring const& path, DXGI_FORMAT format, bool includePixels);
+    ~CaptureTraceWriter();
+
+    // Copying the pixels out waits on the GPU, so traces with pixels change
+    // the timing they're recording. Traces without them are cheap.
+    void WriteFrame(
+        winrt::Windows::Foundation::TimeSpan const& arrivalTime,
+        winrt::Windows::Foundation::TimeSpan const& frameTime,
+        winrt::Windows::Graphics::SizeInt32 const& contentSize,
+        ID3D11Texture2D* texture);
+    void Flush();
+
+private:
+    void Write(void const* data, size_t size);
+
+private:
+    wil::unique_hfile m_file;
+    DXGI_FORMAT m_format = DXGI_FORMAT_UNKNOWN;
+    bool m_includePixels = false;
+    std::vector<uint8_t> m_buffer;
+    winrt::com_ptr<ID3D11Texture2D> m_stagingTexture;
+};
+
+class CaptureTraceReader
+{
+public:
+    CaptureTraceReader(std::wstring const& path);
+
+    DXGI_FORMAT Format() const { return static_cast<DXGI_FORMAT>(m_header.Format); }
+    bool HasPixels() const { return (m_header.Flags & CaptureTraceFlagPixels) != 0; }
+
+    // Returns false at the end of the trace. The payload is empty if the trace has no pixels.
+    bool TryReadNextRecord(CaptureTraceRecord& record, std::vector<uint8_t>& payload);
+
+private:
+    void Read(void* data, size_t size);
+
+private:
+    wil::unique_hfile m_file;
+    CaptureTraceHeader m_header = {};
+};
+
+uint32_t GetBytesPerPixel(DXGI_FORMAT format);
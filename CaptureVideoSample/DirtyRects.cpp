@@ -0,0 +1,110 @@
+#include "pch.h"
+#include "DirtyRects.h"
+
+int64_t ComputeArea(D3D11_RECT const& rect)
+{
+    return static_cast<int64_t>(rect.right - rect.left) * static_cast<int64_t>(rect.bottom - rect.top);
+}
+
+D3D11_RECT ComputeUnion(D3D11_RECT const& first, D3D11_RECT const& second)
+{
+    return
+    {
+        std::min(first.left, second.left),
+        std::min(first.top, second.top),
+        std::max(first.right, second.right),
+        std::max(first.bottom, second.bottom),
+    };
+}
+
+bool Overlaps(D3D11_RECT const& first, D3D11_RECT const& second)
+{
+    return first.left < second.right && second.left < first.right &&
+        first.top < second.bottom && second.top < first.bottom;
+}
+
+// Rects that only touch are merged only when their union is exactly the two
+// of them, i.e. they line up along a whole side. Any other union would copy
+// area that didn't change.
+bool SharesWholeEdge(D3D11_RECT const& first, D3D11_RECT const& second)
+{
+    auto sideBySide = first.top == second.top && first.bottom == second.bottom &&
+        (first.right == second.left || second.right == first.left);
+    auto stacked = first.left == second.left && first.right == second.right &&
+        (first.bottom == second.top || second.bottom == first.top);
+    return sideBySide || stacked;
+}
+
+// Merging one pair can make the result overlap something else, so keep going
+// until nothing changes.
+void MergeOverlappingRects(std::vector<D3D11_RECT>& rects)
+{
+    auto merged = true;
+    while (merged)
+    {
+        merged = false;
+        for (size_t i = 0; i < rects.size() && !merged; i++)
+        {
+            for (size_t j = i + 1; j < rects.size(); j++)
+            {
+                if (Overlaps(rects[i], rects[j]) || SharesWholeEdge(rects[i], rects[j]))
+                {
+                    rects[i] = ComputeUnion(rects[i], rects[j]);
+                    rects.erase(rects.begin() + j);
+                    merged = true;
+                    break;
+                }
+            }
+        }
+    }
+}
+
+void ClipRects(std::vector<D3D11_RECT>& rects, D3D11_RECT const& bounds)
+{
+    for (auto&& rect : rects)
+    {
+        rect.left = std::clamp(rect.left, bounds.left, bounds.right);
+        rect.top = std::clamp(rect.top, bounds.top, bounds.bottom);
+        rect.right = std::clamp(rect.right, rect.left, bounds.right);
+        rect.bottom = std::clamp(rect.bottom, rect.top, bounds.bottom);
+    }
+    rects.erase(std::remove_if(rects.begin(), rects.end(), [](auto const& rect) { return ComputeArea(rect) == 0; }), rects.end());
+}
+
+void CoalesceRects(std::vector<D3D11_RECT>& rects, size_t maxRects)
+{
+    MergeOverlappingRects(rects);
+    while (rects.size() > std::max<size_t>(maxRects, 1))
+    {
+        size_t bestFirst = 0;
+        size_t bestSecond = 1;
+        auto bestWaste = std::numeric_limits<int64_t>::max();
+        for (size_t i = 0; i < rects.size(); i++)
+        {
+            for (size_t j = i + 1; j < rects.size(); j++)
+            {
+                auto waste = ComputeArea(ComputeUnion(rects[i], rects[j])) - ComputeArea(rects[i]) - ComputeArea(rects[j]);
+                if (waste < bestWaste)
+                {
+                    bestWaste = waste;
+                    bestFirst = i;
+                    bestSecond = j;
+                }
+            }
+        }
+
+        rects[bestFirst] = ComputeUnion(rects[bestFirst], rects[bestSecond]);
+        rects.erase(rects.begin() + bestSecond);
+        MergeOverlappingRects(rects);
+    }
+}
+
+int64_t ComputeTotalArea(std::vector<D3D11_RECT> const& rects)
+{
+    int64_t area = 0;
+    for (auto&& rect : rects)
+    {
+        area += ComputeArea(rect);
+    }
+    return area;
+}
@@ -0,0 +1,17 @@
+#pragma once
+
+// Helpers for the rectangles a capture reports as having changed since the
+// previous frame. Copying a handful of larger rectangles is cheaper than
+// copying many small ones, so they're merged before they're used.
+
+// Clips every rect to the bounds and drops the ones that end up empty.
+void ClipRects(std::vector<D3D11_RECT>& rects, D3D11_RECT const& bounds);
+
+// Merges rects that overlap, or that touch along a whole side, until none
+// do. If that leaves more than maxRects, the pairs whose union wastes the
+// least area are merged until it doesn't. The result covers at least
+// everything the input did, and no two rects in it overlap.
+void CoalesceRects(std::vector<D3D11_RECT>& rects, size_t maxRects);
+
+// Assumes the rects don't overlap.
+int64_t ComputeTotalArea(std::vector<D3D11_RECT> const& rects);
@@ -0,0 +1,26 @@
+#pragma once
+
+struct EncodedFrame
+{
+    // H.264 access unit in Annex B format
+    winrt::com_ptr<IMFSample> Sample;
+    // The encoder's current output type
+    winrt::com_ptr<IMFMediaType> MediaType;
+    // Presentation time relative to the start of the recording
+    winrt::Windows::Foundation::TimeSpan Timestamp = {};
+    // SystemRelativeTime of the captured frame this was encoded from
+    winrt::Windows::Foundation::TimeSpan CaptureTime = {};
+    bool IsKeyFrame = false;
+    // Keyframe inserted because of VideoEncoder::RequestKeyFrame
+    bool IsRequestedKeyFrame = false;
+};
+
+class EncodedFrameSink
+{
+public:
+    virtual ~EncodedFrameSink() {}
+
+    virtual void OnFrameEncoded(EncodedFrame const& frame) = 0;
+    // Called once after the last frame has been delivered.
+    virtual void Close() = 0;
+};
@@ -0,0 +1,181 @@
+#include "pch.h"
+#include "EncodedFrameTee.h"
+
+EncodedFrameTee::Branch::Branch(std::shared_ptr<EncodedFrameSink> const& sink, SinkQueueOptions const& options)
+    : Sink(sink), Options(options), Queue(options.Capacity)
+{
+    FrameQueued.create(wil::EventOptions::None);
+    SpaceAvailable.create(wil::EventOptions::None);
+}
+
+EncodedFrameTee::~EncodedFrameTee()
+{
+    // Without a Close, whatever is still queued is thrown away
+    for (auto&& branch : m_branches)
+    {
+        Disconnect(*branch);
+    }
+    for (auto&& branch : m_branches)
+    {
+        if (branch->Worker.joinable())
+        {
+            branch->Worker.join();
+        }
+    }
+}
+
+void EncodedFrameTee::AddSink(std::shared_ptr<EncodedFrameSink> const& sink, SinkQueueOptions const& options)
+{
+    auto branch = std::make_unique<Branch>(sink, options);
+    auto branchPointer = branch.get();
+    m_branches.push_back(std::move(branch));
+    branchPointer->Worker = std::thread([branchPointer]() { RunWorker(*branchPointer); });
+}
+
+SinkQueueMetrics EncodedFrameTee::Metrics(size_t index)
+{
+    auto& branch = *m_branches[index];
+    auto lock = branch.Lock.lock_exclusive();
+    return branch.Metrics;
+}
+
+void EncodedFrameTee::OnFrameEncoded(EncodedFrame const& frame)
+{
+    for (auto&& branch : m_branches)
+    {
+        Enqueue(*branch, frame);
+    }
+}
+
+void EncodedFrameTee::Close()
+{
+    for (auto&& branch : m_branches)
+    {
+        auto lock = branch->Lock.lock_exclusive();
+        branch->IsClosing = true;
+        branch->FrameQueued.SetEvent();
+        branch->SpaceAvailable.SetEvent();
+    }
+    for (auto&& branch : m_branches)
+    {
+        if (branch->Worker.joinable())
+        {
+            branch->Worker.join();
+        }
+    }
+}
+
+void EncodedFrameTee::Enqueue(Branch& branch, EncodedFrame const& frame)
+{
+    auto lock = branch.Lock.lock_exclusive();
+    if (branch.Metrics.IsDisconnected || branch.IsClosing)
+    {
+        return;
+    }
+    // Anything before the next keyframe refers to frames the sink never got
+    if (branch.IsWaitingForKeyFrame && !frame.IsKeyFrame)
+    {
+        branch.Metrics.FramesDropped++;
+        return;
+    }
+
+    if (branch.Options.OverflowPolicy == SinkOverflowPolicy::Block && branch.Queue.IsFull())
+    {
+        auto start = std::chrono::steady_clock::now();
+        while (branch.Queue.IsFull() && !branch.Metrics.IsDisconnected && !branch.IsClosing)
+        {
+            lock.reset();
+            branch.SpaceAvailable.wait();
+            lock = branch.Lock.lock_exclusive();
+        }
+        branch.Metrics.Stalls++;
+        branch.Metrics.TotalStall += std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start);
+        if (branch.Metrics.IsDisconnected || branch.IsClosing)
+        {
+            return;
+        }
+    }
+
+    auto queued = frame;
+    if (!branch.Queue.TryPushBack(std::move(queued)))
+    {
+        branch.Metrics.FramesDropped++;
+        if (branch.Options.OverflowPolicy == SinkOverflowPolicy::Disconnect)
+        {
+            OutputDebugStringW(L"Disconnecting a sink that fell too far behind\n");
+            lock.reset();
+            Disconnect(branch);
+        }
+        else
+        {
+            branch.IsWaitingForKeyFrame = true;
+        }
+        return;
+    }
+    branch.IsWaitingForKeyFrame = false;
+    branch.Metrics.MaxQueued = std::max(branch.Metrics.MaxQueued, branch.Queue.Size());
+    branch.FrameQueued.SetEvent();
+}
+
+void EncodedFrameTee::Disconnect(Branch& branch)
+{
+    auto lock = branch.Lock.lock_exclusive();
+    if (!branch.Metrics.IsDisconnected)
+    {
+        branch.Metrics.IsDisconnected = true;
+        branch.Metrics.FramesDropped += branch.Queue.Size();
+        branch.Queue.Clear();
+    }
+    branch.FrameQueued.SetEvent();
+    branch.SpaceAvailable.SetEvent();
+}
+
+void EncodedFrameTee::RunWorker(Branch& branch)
+{
+    // Sinks use Media Foundation and WinRT streams from here
+    auto coInitialize = wil::CoInitializeEx(COINIT_MULTITHREADED);
+    while (true)
+    {
+        std::optional<EncodedFrame> frame;
+        {
+            auto lock = branch.Lock.lock_exclusive();
+            if (!branch.Queue.IsEmpty())
+            {
+                frame = branch.Queue.PopFront();
+                branch.SpaceAvailable.SetEvent();
+            }
+            else if (branch.IsClosing || branch.Metrics.IsDisconnected)
+            {
+                break;
+            }
+        }
+
+        if (!frame.has_value())
+        {
+            branch.FrameQueued.wait();
+            continue;
+        }
+
+        try
+        {
+            branch.Sink->OnFrameEncoded(frame.value());
+            auto lock = branch.Lock.lock_exclusive();
+            branch.Metrics.FramesDelivered++;
+        }
+        catch (winrt::hresult_error const& error)
+        {
+            // A sink that fails is cut off, the others carry on
+            OutputDebugStringW(error.message().c_str());
+            Disconnect(branch);
+        }
+    }
+
+    try
+    {
+        branch.Sink->Close();
+    }
+    catch (winrt::hresult_error const& error)
+    {
+        OutputDebugStringW(error.message().c_str());
+    }
+}
@@ -0,0 +1,79 @@
+#pragma once
+#include "EncodedFrameSink.h"
+#include "BoundedQueue.h"
+
+enum class SinkOverflowPolicy
+{
+    // Drop frames while the sink's queue is full, then resume at the next
+    // keyframe so that what the sink does get can still be decoded.
+    DropUntilKeyFrame,
+    // Stop delivering to the sink for the rest of the recording. Frames
+    // still in its queue are thrown away and counted as dropped, then it's
+    // closed once it has finished with the one it's working on.
+    Disconnect,
+    // Wait for room in the sink's queue, holding up the encoder. For sinks
+    // that can't lose a frame, like the recording's own file.
+    Block,
+};
+
+struct SinkQueueOptions
+{
+    size_t Capacity = 60;
+    SinkOverflowPolicy OverflowPolicy = SinkOverflowPolicy::DropUntilKeyFrame;
+};
+
+struct SinkQueueMetrics
+{
+    uint64_t FramesDelivered = 0;
+    uint64_t FramesDropped = 0;
+    size_t MaxQueued = 0;
+    // How often and for how long the encoder waited on a blocking sink
+    uint64_t Stalls = 0;
+    std::chrono::microseconds TotalStall = {};
+    // The sink fell behind or failed, and gets nothing more
+    bool IsDisconnected = false;
+};
+
+// Delivers each encoded frame to several sinks, each from its own thread
+// and through its own bounded queue. A sink that falls behind or fails
+// only affects itself, the encoder only ever waits on sinks that use
+// SinkOverflowPolicy::Block. Frames are shared between the sinks, which
+// must treat them as read only.
+class EncodedFrameTee : public EncodedFrameSink
+{
+public:
+    ~EncodedFrameTee();
+
+    // Sinks can only be added before the first frame.
+    void AddSink(std::shared_ptr<EncodedFrameSink> const& sink, SinkQueueOptions const& options);
+    size_t SinkCount() const { return m_branches.size(); }
+    SinkQueueMetrics Metrics(size_t index);
+
+    void OnFrameEncoded(EncodedFrame const& frame) override;
+    // Waits for every sink to finish with what it has queued, then closes it.
+    void Close() override;
+
+private:
+    struct Branch
+    {
+        Branch(std::shared_ptr<EncodedFrameSink> const& sink, SinkQueueOptions const& options);
+
+        std::shared_ptr<EncodedFrameSink> Sink;
+        SinkQueueOptions Options;
+        wil::srwlock Lock;
+        BoundedQueue<EncodedFrame> Queue;
+        wil::unique_event FrameQueued;
+        wil::unique_event SpaceAvailable;
+        bool IsClosing = false;
+        bool IsWaitingForKeyFrame = false;
+        SinkQueueMetrics Metrics;
+        std::thread Worker;
+    };
+
+    static void Enqueue(Branch& branch, EncodedFrame const& frame);
+    static void Disconnect(Branch& branch);
+    static void RunWorker(Branch& branch);
+
+private:
+    std::vector<std::unique_ptr<Branch>> m_branches;
+};
@@ -0,0 +1,85 @@
+#include "pch.h"
+#include "FrameCompositor.h"
+
+namespace winrt
+{
+    using namespace Windows::Graphics;
+}
+
+FrameCompositor::FrameCompositor(winrt::SizeInt32 const& outputSize)
+{
+    m_outputSize = outputSize;
+}
+
+void FrameCompositor::AddSource(std::shared_ptr<FrameSource> const& source, LayoutRegion const& region)
+{
+    CompositionSource entry;
+    entry.Source = source;
+    entry.Bounds = ComputeRegionRect(region, m_outputSize);
+    m_sources.push_back(std::move(entry));
+}
+
+bool FrameCompositor::UpdateFrames(FrameRenderer* renderer)
+{
+    auto updated = false;
+    for (auto&& source : m_sources)
+    {
+        if (auto frame = source.Source->TryGetLatestFrame())
+        {
+            if (frame->TextureGeneration != source.TextureGeneration)
+            {
+                source.TextureGeneration = frame->TextureGeneration;
+                renderer->ReleaseCachedViews();
+            }
+            source.LatestFrame = std::move(frame);
+            updated = true;
+        }
+    }
+    return updated;
+}
+
+void FrameCompositor::Compose(
+    ID3D11DeviceContext* d3dContext,
+    FrameRenderer* renderer,
+    ID3D11RenderTargetView* renderTargetView,
+    ResizeMode mode,
+    bool toneMap)
+{
+    for (auto&& source : m_sources)
+    {
+        if (!source.LatestFrame.has_value())
+        {
+            continue;
+        }
+
+        auto frameTexture = source.LatestFrame->Texture;
+        D3D11_TEXTURE2D_DESC desc = {};
+        frameTexture->GetDesc(&desc);
+
+        auto sourceRect = ComputeSourceRect(source.LatestFrame->ContentSize, desc);
+        auto sourceWidth = sourceRect.right - sourceRect.left;
+        auto sourceHeight = sourceRect.bottom - sourceRect.top;
+        if (sourceWidth <= 0 || sourceHeight <= 0)
+        {
+            continue;
+        }
+        auto destinationRect = ComputeDestinationRect({ sourceWidth, sourceHeight }, source.Bounds, mode);
+
+        renderer->Render(
+            d3dContext,
+            frameTexture.get(),
+            sourceRect,
+            renderTargetView,
+            destinationRect,
+            toneMap);
+    }
+}
+
+void FrameCompositor::StopCapture()
+{
+    for (auto&& source : m_sources)
+    {
+        source.Source->StopCapture();
+        source.LatestFrame.reset();
+    }
+}
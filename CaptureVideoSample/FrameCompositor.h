@@ -0,0 +1,43 @@
+#pragma once
+#include "FrameSource.h"
+#include "FrameGeometry.h"
+#include "FrameRenderer.h"
+
+// Draws the newest frame from each of a set of capture sources into its own
+// region of the output. Sources are never waited on, so each one updates at
+// whatever rate it produces frames; a source that hasn't produced anything
+// new is drawn using its last frame.
+class FrameCompositor
+{
+public:
+    FrameCompositor(winrt::Windows::Graphics::SizeInt32 const& outputSize);
+
+    void AddSource(std::shared_ptr<FrameSource> const& source, LayoutRegion const& region);
+    size_t SourceCount() const { return m_sources.size(); }
+
+    // Takes the newest frame from each source. Returns true if any of them
+    // had something new.
+    bool UpdateFrames(FrameRenderer* renderer);
+    // Draws every source's latest frame over what's already in the render
+    // target, in the order they were added.
+    void Compose(
+        ID3D11DeviceContext* d3dContext,
+        FrameRenderer* renderer,
+        ID3D11RenderTargetView* renderTargetView,
+        ResizeMode mode,
+        bool toneMap);
+    void StopCapture();
+
+private:
+    struct CompositionSource
+    {
+        std::shared_ptr<FrameSource> Source;
+        D3D11_RECT Bounds = {};
+        std::optional<CapturedFrame> LatestFrame;
+        uint32_t TextureGeneration = 0;
+    };
+
+private:
+    winrt::Windows::Graphics::SizeInt32 m_outputSize = {};
+    std::vector<CompositionSource> m_sources;
+};
@@ -0,0 +1,40 @@
+#include "pch.h"
+#include "FrameDecimator.h"
+
+namespace winrt
+{
+    using namespace Windows::Foundation;
+}
+
+FrameDecimator::FrameDecimator(winrt::TimeSpan const& interval)
+{
+    m_interval = interval;
+}
+
+FrameDecimator::FrameDecimator(winrt::TimeSpan const& interval, winrt::TimeSpan const& outputFrameDuration)
+{
+    m_interval = interval;
+    m_outputFrameDuration = outputFrameDuration;
+}
+
+std::optional<winrt::TimeSpan> FrameDecimator::TryKeepFrame(winrt::TimeSpan const& timestamp)
+{
+    if (m_firstKept.has_value() && (timestamp - m_lastKept) < m_interval)
+    {
+        m_droppedFrames++;
+        return std::nullopt;
+    }
+
+    if (!m_firstKept.has_value())
+    {
+        m_firstKept = timestamp;
+    }
+    m_lastKept = timestamp;
+    auto keptIndex = m_keptFrames++;
+
+    if (m_outputFrameDuration.has_value())
+    {
+        return m_firstKept.value() + m_outputFrameDuration.value() * static_cast<int64_t>(keptIndex);
+    }
+    return timestamp;
+}
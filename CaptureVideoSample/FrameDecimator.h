@@ -0,0 +1,33 @@
+#pragma once
+
+// Decides which captured frames are kept, before anything is done with them.
+// Frames closer than the interval to the last kept frame are dropped. For
+// timelapses the kept frames can be given new timestamps spaced evenly at the
+// output frame rate, so that the recording plays back at normal speed.
+class FrameDecimator
+{
+public:
+    FrameDecimator(winrt::Windows::Foundation::TimeSpan const& interval);
+    FrameDecimator(
+        winrt::Windows::Foundation::TimeSpan const& interval,
+        winrt::Windows::Foundation::TimeSpan const& outputFrameDuration);
+
+    winrt::Windows::Foundation::TimeSpan Interval() const { return m_interval; }
+    bool IsRemapping() const { return m_outputFrameDuration.has_value(); }
+    uint64_t KeptFrames() const { return m_keptFrames; }
+    uint64_t DroppedFrames() const { return m_droppedFrames; }
+
+    // Returns the timestamp to use for the frame, or std::nullopt if the
+    // frame should be dropped. Timestamps are left alone unless remapping,
+    // in which case the first kept frame keeps its timestamp and every frame
+    // after it is one output frame later than the last.
+    std::optional<winrt::Windows::Foundation::TimeSpan> TryKeepFrame(winrt::Windows::Foundation::TimeSpan const& timestamp);
+
+private:
+    winrt::Windows::Foundation::TimeSpan m_interval = {};
+    std::optional<winrt::Windows::Foundation::TimeSpan> m_outputFrameDuration;
+    std::optional<winrt::Windows::Foundation::TimeSpan> m_firstKept;
+    winrt::Windows::Foundation::TimeSpan m_lastKept = {};
+    uint64_t m_keptFrames = 0;
+    uint64_t m_droppedFrames = 0;
+};
@@ -0,0 +1,99 @@
+#include "pch.h"
+#include "FrameGeometry.h"
+
+namespace winrt
+{
+    using namespace Windows::Graphics;
+}
+
+D3D11_RECT ComputeDestinationRect(
+    winrt::SizeInt32 const& contentSize,
+    winrt::SizeInt32 const& outputSize,
+    ResizeMode mode)
+{
+    return ComputeDestinationRect(contentSize, D3D11_RECT{ 0, 0, outputSize.Width, outputSize.Height }, mode);
+}
+
+D3D11_RECT ComputeDestinationRect(
+    winrt::SizeInt32 const& contentSize,
+    D3D11_RECT const& bounds,
+    ResizeMode mode)
+{
+    D3D11_RECT rect = bounds;
+    auto boundsWidth = bounds.right - bounds.left;
+    auto boundsHeight = bounds.bottom - bounds.top;
+    if (contentSize.Width <= 0 || contentSize.Height <= 0 || boundsWidth <= 0 || boundsHeight <= 0 || mode == ResizeMode::Stretch)
+    {
+        return rect;
+    }
+
+    auto contentWidth = static_cast<double>(contentSize.Width);
+    auto contentHeight = static_cast<double>(contentSize.Height);
+    auto scale = std::min(
+        static_cast<double>(boundsWidth) / contentWidth, 
+        static_cast<double>(boundsHeight) / contentHeight);
+    auto width = std::clamp(static_cast<int32_t>(std::lround(contentWidth * scale)), 1, boundsWidth);
+    auto height = std::clamp(static_cast<int32_t>(std::lround(contentHeight * scale)), 1, boundsHeight);
+
+    rect.left = bounds.left + (boundsWidth - width) / 2;
+    rect.top = bounds.top + (boundsHeight - height) / 2;
+    rect.right = rect.left + width;
+    rect.bottom = rect.top + height;
+    return rect;
+}
+
+D3D11_RECT ComputeRegionRect(
+    LayoutRegion const& region,
+    winrt::SizeInt32 const& outputSize)
+{
+    auto width = static_cast<float>(outputSize.Width);
+    auto height = static_cast<float>(outputSize.Height);
+    D3D11_RECT rect = {};
+    rect.left = std::clamp(static_cast<int32_t>(std::lround(region.Left * width)), 0, outputSize.Width);
+    rect.top = std::clamp(static_cast<int32_t>(std::lround(region.Top * height)), 0, outputSize.Height);
+    rect.right = std::clamp(static_cast<int32_t>(std::lround(region.Right * width)), rect.left, outputSize.Width);
+    rect.bottom = std::clamp(static_cast<int32_t>(std::lround(region.Bottom * height)), rect.top, outputSize.Height);
+    return rect;
+}
+
+std::vector<LayoutRegion> CreatePictureInPictureLayout()
+{
+    const float insetSize = 0.3f;
+    const float margin = 0.02f;
+    return
+    {
+        LayoutRegion{},
+        LayoutRegion{ 1.0f - margin - insetSize, 1.0f - margin - insetSize, 1.0f - margin, 1.0f - margin },
+    };
+}
+
+std::vector<LayoutRegion> CreateGridLayout(size_t count)
+{
+    std::vector<LayoutRegion> regions;
+    if (count == 0)
+    {
+        return regions;
+    }
+
+    auto columns = static_cast<size_t>(std::ceil(std::sqrt(static_cast<double>(count))));
+    auto rows = (count + columns - 1) / columns;
+    auto cellWidth = 1.0f / static_cast<float>(columns);
+    auto cellHeight = 1.0f / static_cast<float>(rows);
+    for (size_t i = 0; i < count; i++)
+    {
+        auto column = static_cast<float>(i % columns);
+        auto row = static_cast<float>(i / columns);
+        regions.push_back({ column * cellWidth, row * cellHeight, (column + 1.0f) * cellWidth, (row + 1.0f) * cellHeight });
+    }
+    return regions;
+}
+
+D3D11_RECT ComputeSourceRect(
+    winrt::SizeInt32 const& contentSize,
+    D3D11_TEXTURE2D_DESC const& textureDesc)
+{
+    D3D11_RECT rect = {};
+    rect.right = std::clamp(contentSize.Width, 0, static_cast<int32_t>(textureDesc.Width));
+    rect.bottom = std::clamp(contentSize.Height, 0, static_cast<int32_t>(textureDesc.Height));
+    return rect;
+}
@@ -0,0 +1,49 @@
+#pragma once
+
+enum class ResizeMode
+{
+    // Scale the content to fit while preserving its aspect ratio, filling
+    // the rest with the clear color.
+    Letterbox,
+    // Scale the content to fill the output, ignoring its aspect ratio.
+    Stretch,
+};
+
+// A part of the output, with each edge given as a fraction of the output's
+// width or height.
+struct LayoutRegion
+{
+    float Left = 0.0f;
+    float Top = 0.0f;
+    float Right = 1.0f;
+    float Bottom = 1.0f;
+};
+
+// Computes where content of the given size should be drawn within an output
+// of a fixed size.
+D3D11_RECT ComputeDestinationRect(
+    winrt::Windows::Graphics::SizeInt32 const& contentSize,
+    winrt::Windows::Graphics::SizeInt32 const& outputSize,
+    ResizeMode mode);
+// Same as above, but within the given bounds of the output.
+D3D11_RECT ComputeDestinationRect(
+    winrt::Windows::Graphics::SizeInt32 const& contentSize,
+    D3D11_RECT const& bounds,
+    ResizeMode mode);
+
+D3D11_RECT ComputeRegionRect(
+    LayoutRegion const& region,
+    winrt::Windows::Graphics::SizeInt32 const& outputSize);
+
+// The first region covers the whole output, the second is an inset in the
+// bottom right corner.
+std::vector<LayoutRegion> CreatePictureInPictureLayout();
+// Splits the output into equally sized cells, filled row by row.
+std::vector<LayoutRegion> CreateGridLayout(size_t count);
+
+// The content rect clamped to the bounds of the texture that holds it. The
+// content can briefly be larger than the texture while a frame pool is
+// being recreated.
+D3D11_RECT ComputeSourceRect(
+    winrt::Windows::Graphics::SizeInt32 const& contentSize,
+    D3D11_TEXTURE2D_DESC const& textureDesc);
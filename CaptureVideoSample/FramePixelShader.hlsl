@@ -0,0 +1,37 @@
+#include "FrameShaderCommon.hlsli"
+
+Texture2D<float4> Input : register(t0);
+SamplerState InputSampler : register(s0);
+
+static const float3 Bt709LuminanceWeights = float3(0.2126f, 0.7152f, 0.0722f);
+
+// Extended Reinhard applied to luminance so that hue is preserved.
+float3 ToneMapScRgb(float3 color)
+{
+    color = max(color * SdrWhiteScale, 0.0f);
+    float luminance = dot(color, Bt709LuminanceWeights);
+    if (luminance <= 0.0f)
+    {
+        return float3(0.0f, 0.0f, 0.0f);
+    }
+    float mapped = luminance * (1.0f + luminance / (WhitePoint * WhitePoint)) / (1.0f + luminance);
+    return saturate(color * (mapped / luminance));
+}
+
+float3 LinearToSrgb(float3 color)
+{
+    float3 low = color * 12.92f;
+    float3 high = 1.055f * pow(color, 1.0f / 2.4f) - 0.055f;
+    return lerp(low, high, step(0.0031308f, color));
+}
+
+float4 main(VSOutput input) : SV_Target
+{
+    float3 color = Input.Sample(InputSampler, input.TexCoord).rgb;
+    if (ToneMap != 0)
+    {
+        // FP16 capture surfaces are linear scRGB, our output is 8-bit sRGB.
+        color = LinearToSrgb(ToneMapScRgb(color));
+    }
+    return float4(color, 1.0f);
+}
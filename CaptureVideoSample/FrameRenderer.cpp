@@ -0,0 +1,182 @@
+#include "pch.h"
+#include "FrameRenderer.h"
+
+// Generated by FxCompile
+#include "FrameVertexShader.h"
+#include "FramePixelShader.h"
+
+ToneMapSettings GetMonitorToneMapSettings(HMONITOR monitor)
+{
+    ToneMapSettings settings;
+    MONITORINFOEXW monitorInfo = {};
+    monitorInfo.cbSize = sizeof(monitorInfo);
+    if (!GetMonitorInfoW(monitor, &monitorInfo))
+    {
+        return settings;
+    }
+
+    // The peak luminance comes from DXGI...
+    winrt::com_ptr<IDXGIFactory1> factory;
+    winrt::check_hresult(CreateDXGIFactory1(winrt::guid_of<IDXGIFactory1>(), factory.put_void()));
+    winrt::com_ptr<IDXGIAdapter1> adapter;
+    for (uint32_t adapterIndex = 0; factory->EnumAdapters1(adapterIndex, adapter.put()) == S_OK; adapterIndex++)
+    {
+        winrt::com_ptr<IDXGIOutput> output;
+        for (uint32_t outputIndex = 0; adapter->EnumOutputs(outputIndex, output.put()) == S_OK; outputIndex++)
+        {
+            DXGI_OUTPUT_DESC1 desc = {};
+            if (auto output6 = output.try_as<IDXGIOutput6>(); output6 && SUCCEEDED(output6->GetDesc1(&desc)) &&
+                desc.Monitor == monitor && desc.MaxLuminance > 0.0f)
+            {
+                settings.MaxLuminanceInNits = desc.MaxLuminance;
+            }
+            output = nullptr;
+        }
+        adapter = nullptr;
+    }
+
+    // ...and the SDR white level from the display configuration, as a
+    // multiple of 80 nits in thousandths
+    UINT32 pathCount = 0;
+    UINT32 modeCount = 0;
+    if (GetDisplayConfigBufferSizes(QDC_ONLY_ACTIVE_PATHS, &pathCount, &modeCount) != ERROR_SUCCESS)
+    {
+        return settings;
+    }
+    std::vector<DISPLAYCONFIG_PATH_INFO> paths(pathCount);
+    std::vector<DISPLAYCONFIG_MODE_INFO> modes(modeCount);
+    if (QueryDisplayConfig(QDC_ONLY_ACTIVE_PATHS, &pathCount, paths.data(), &modeCount, modes.data(), nullptr) != ERROR_SUCCESS)
+    {
+        return settings;
+    }
+    for (uint32_t i = 0; i < pathCount; i++)
+    {
+        auto const& path = paths[i];
+        DISPLAYCONFIG_SOURCE_DEVICE_NAME sourceName = {};
+        sourceName.header.type = DISPLAYCONFIG_DEVICE_INFO_GET_SOURCE_NAME;
+        sourceName.header.size = sizeof(sourceName);
+        sourceName.header.adapterId = path.sourceInfo.adapterId;
+        sourceName.header.id = path.sourceInfo.id;
+        if (DisplayConfigGetDeviceInfo(&sourceName.header) != ERROR_SUCCESS ||
+            wcscmp(sourceName.viewGdiDeviceName, monitorInfo.szDevice) != 0)
+        {
+            continue;
+        }
+
+        DISPLAYCONFIG_SDR_WHITE_LEVEL whiteLevel = {};
+        whiteLevel.header.type = DISPLAYCONFIG_DEVICE_INFO_GET_SDR_WHITE_LEVEL;
+        whiteLevel.header.size = sizeof(whiteLevel);
+        whiteLevel.header.adapterId = path.targetInfo.adapterId;
+        whiteLevel.header.id = path.targetInfo.id;
+        if (DisplayConfigGetDeviceInfo(&whiteLevel.header) == ERROR_SUCCESS && whiteLevel.SDRWhiteLevel > 0)
+        {
+            settings.SdrWhiteLevelInNits = static_cast<float>(whiteLevel.SDRWhiteLevel) / 1000.0f * 80.0f;
+        }
+        break;
+    }
+
+    // Anything brighter than the peak would be clipped anyway
+    settings.MaxLuminanceInNits = std::max(settings.MaxLuminanceInNits, settings.SdrWhiteLevelInNits);
+    return settings;
+}
+
+FrameRenderer::FrameRenderer(winrt::com_ptr<ID3D11Device> const& d3dDevice)
+{
+    m_d3dDevice = d3dDevice;
+
+    winrt::check_hresult(m_d3dDevice->CreateVertexShader(g_FrameVertexShader, sizeof(g_FrameVertexShader), nullptr, m_vertexShader.put()));
+    winrt::check_hresult(m_d3dDevice->CreatePixelShader(g_FramePixelShader, sizeof(g_FramePixelShader), nullptr, m_pixelShader.put()));
+
+    D3D11_SAMPLER_DESC samplerDesc = {};
+    samplerDesc.Filter = D3D11_FILTER_MIN_MAG_MIP_LINEAR;
+    samplerDesc.AddressU = D3D11_TEXTURE_ADDRESS_CLAMP;
+    samplerDesc.AddressV = D3D11_TEXTURE_ADDRESS_CLAMP;
+    samplerDesc.AddressW = D3D11_TEXTURE_ADDRESS_CLAMP;
+    samplerDesc.ComparisonFunc = D3D11_COMPARISON_NEVER;
+    samplerDesc.MaxLOD = D3D11_FLOAT32_MAX;
+    winrt::check_hresult(m_d3dDevice->CreateSamplerState(&samplerDesc, m_samplerState.put()));
+
+    D3D11_BUFFER_DESC bufferDesc = {};
+    bufferDesc.ByteWidth = sizeof(FrameConstants);
+    bufferDesc.Usage = D3D11_USAGE_DEFAULT;
+    bufferDesc.BindFlags = D3D11_BIND_CONSTANT_BUFFER;
+    winrt::check_hresult(m_d3dDevice->CreateBuffer(&bufferDesc, nullptr, m_constantBuffer.put()));
+}
+
+void FrameRenderer::Render(
+    ID3D11DeviceContext* d3dContext,
+    ID3D11Texture2D* texture,
+    D3D11_RECT const& sourceRect,
+    ID3D11RenderTargetView* renderTargetView,
+    D3D11_RECT const& destinationRect,
+    bool toneMap)
+{
+    D3D11_TEXTURE2D_DESC desc = {};
+    texture->GetDesc(&desc);
+    auto textureWidth = static_cast<float>(desc.Width);
+    auto textureHeight = static_cast<float>(desc.Height);
+
+    FrameConstants constants = {};
+    constants.SourceRect[0] = static_cast<float>(sourceRect.left) / textureWidth;
+    constants.SourceRect[1] = static_cast<float>(sourceRect.top) / textureHeight;
+    constants.SourceRect[2] = static_cast<float>(sourceRect.right) / textureWidth;
+    constants.SourceRect[3] = static_cast<float>(sourceRect.bottom) / textureHeight;
+    constants.SdrWhiteScale = 80.0f / m_toneMapSettings.SdrWhiteLevelInNits;
+    constants.WhitePoint = m_toneMapSettings.MaxLuminanceInNits / m_toneMapSettings.SdrWhiteLevelInNits;
+    constants.ToneMap = toneMap ? 1 : 0;
+    d3dContext->UpdateSubresource(m_constantBuffer.get(), 0, nullptr, &constants, 0, 0);
+
+    D3D11_VIEWPORT viewport = {};
+    viewport.TopLeftX = static_cast<float>(destinationRect.left);
+    viewport.TopLeftY = static_cast<float>(destinationRect.top);
+    viewport.Width = static_cast<float>(destinationRect.right - destinationRect.left);
+    viewport.Height = static_cast<float>(destinationRect.bottom - destinationRect.top);
+    viewport.MinDepth = 0.0f;
+    viewport.MaxDepth = 1.0f;
+
+    auto shaderResourceView = GetShaderResourceView(texture);
+    std::array<ID3D11ShaderResourceView*, 1> views = { shaderResourceView.get() };
+    std::array<ID3D11SamplerState*, 1> samplers = { m_samplerState.get() };
+    std::array<ID3D11Buffer*, 1> buffers = { m_constantBuffer.get() };
+
+    d3dContext->IASetInputLayout(nullptr);
+    d3dContext->IASetPrimitiveTopology(D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
+    d3dContext->VSSetShader(m_vertexShader.get(), nullptr, 0);
+    d3dContext->VSSetConstantBuffers(0, static_cast<uint32_t>(buffers.size()), buffers.data());
+    d3dContext->PSSetShader(m_pixelShader.get(), nullptr, 0);
+    d3dContext->PSSetConstantBuffers(0, static_cast<uint32_t>(buffers.size()), buffers.data());
+    d3dContext->PSSetShaderResources(0, static_cast<uint32_t>(views.size()), views.data());
+    d3dContext->PSSetSamplers(0, static_cast<uint32_t>(samplers.size()), samplers.data());
+    d3dContext->RSSetViewports(1, &viewport);
+    d3dContext->OMSetRenderTargets(1, &renderTargetView, nullptr);
+    d3dContext->OMSetBlendState(nullptr, nullptr, 0xffffffff);
+    d3dContext->Draw(3, 0);
+
+    // Unbind the input so the capture texture can be reused as a copy destination
+    std::array<ID3D11ShaderResourceView*, 1> nullViews = {};
+    d3dContext->PSSetShaderResources(0, static_cast<uint32_t>(nullViews.size()), nullViews.data());
+}
+
+winrt::com_ptr<ID3D11ShaderResourceView> FrameRenderer::GetShaderResourceView(ID3D11Texture2D* texture)
+{
+    // We hold a reference to each texture we cache, so pointer comparisons are safe.
+    auto it = std::find_if(m_views.begin(), m_views.end(), [texture](auto const& entry) { return entry.Texture.get() == texture; });
+    if (it != m_views.end())
+    {
+        return it->View;
+    }
+
+    winrt::com_ptr<ID3D11ShaderResourceView> view;
+    winrt::check_hresult(m_d3dDevice->CreateShaderResourceView(texture, nullptr, view.put()));
+    m_viewsCreated++;
+
+    CachedShaderResourceView entry;
+    entry.Texture.copy_from(texture);
+    entry.View = view;
+    m_views.push_front(std::move(entry));
+    if (m_views.size() > MaxCachedViews)
+    {
+        m_views.pop_back();
+    }
+    return view;
+}
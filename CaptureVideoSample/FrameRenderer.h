@@ -0,0 +1,71 @@
+#pragma once
+
+struct ToneMapSettings
+{
+    // scRGB defines 1.0 as 80 nits, which is also the default SDR white level.
+    float SdrWhiteLevelInNits = 80.0f;
+    float MaxLuminanceInNits = 1000.0f;
+};
+
+// What the monitor is configured with, from its display settings. The
+// defaults are kept for anything that can't be queried.
+ToneMapSettings GetMonitorToneMapSettings(HMONITOR monitor);
+
+class FrameRenderer
+{
+public:
+    FrameRenderer(winrt::com_ptr<ID3D11Device> const& d3dDevice);
+
+    // Draws sourceRect of the texture into destinationRect of the render target.
+    // When toneMap is set the source is treated as linear scRGB (FP16) and is
+    // converted to SDR sRGB.
+    void Render(
+        ID3D11DeviceContext* d3dContext,
+        ID3D11Texture2D* texture,
+        D3D11_RECT const& sourceRect,
+        ID3D11RenderTargetView* renderTargetView,
+        D3D11_RECT const& destinationRect,
+        bool toneMap);
+
+    ToneMapSettings const& ToneMap() const { return m_toneMapSettings; }
+    void ToneMap(ToneMapSettings const& settings) { m_toneMapSettings = settings; }
+    // The cached views keep their textures alive. Call this when a source
+    // stops using the textures it had, so they can be released.
+    void ReleaseCachedViews() { m_views.clear(); }
+    // Goes up whenever a texture wasn't in the cache, which allocates.
+    uint64_t ViewsCreated() const { return m_viewsCreated; }
+
+private:
+    struct FrameConstants
+    {
+        float SourceRect[4];
+        float SdrWhiteScale;
+        float WhitePoint;
+        uint32_t ToneMap;
+        uint32_t Padding;
+    };
+    static_assert(sizeof(FrameConstants) % 16 == 0);
+
+    struct CachedShaderResourceView
+    {
+        winrt::com_ptr<ID3D11Texture2D> Texture;
+        winrt::com_ptr<ID3D11ShaderResourceView> View;
+    };
+
+    winrt::com_ptr<ID3D11ShaderResourceView> GetShaderResourceView(ID3D11Texture2D* texture);
+
+private:
+    // Capture frame pools only ever hand out a handful of textures, so we
+    // keep views for the most recent ones around instead of recreating them.
+    // This is enough for a few sources being composited together.
+    static const size_t MaxCachedViews = 16;
+
+    winrt::com_ptr<ID3D11Device> m_d3dDevice;
+    winrt::com_ptr<ID3D11VertexShader> m_vertexShader;
+    winrt::com_ptr<ID3D11PixelShader> m_pixelShader;
+    winrt::com_ptr<ID3D11SamplerState> m_samplerState;
+    winrt::com_ptr<ID3D11Buffer> m_constantBuffer;
+    std::deque<CachedShaderResourceView> m_views;
+    uint64_t m_viewsCreated = 0;
+    ToneMapSettings m_toneMapSettings;
+};
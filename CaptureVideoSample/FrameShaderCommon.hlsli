@@ -0,0 +1,17 @@
+cbuffer FrameConstants : register(b0)
+{
+    // Left, top, right, bottom in normalized texture coordinates
+    float4 SourceRect;
+    // Multiplier that brings SDR white in the input to 1.0
+    float SdrWhiteScale;
+    // Brightest input value (after scaling) that maps to 1.0
+    float WhitePoint;
+    uint ToneMap;
+    uint Padding;
+};
+
+struct VSOutput
+{
+    float4 Position : SV_Position;
+    float2 TexCoord : TEXCOORD0;
+};
@@ -0,0 +1,49 @@
+#pragma once
+
+// Dirty regions beyond this are merged together
+const uint32_t MaxFrameDirtyRects = 16;
+
+struct CapturedFrame
+{
+    winrt::com_ptr<ID3D11Texture2D> Texture;
+    winrt::Windows::Graphics::SizeInt32 ContentSize = {};
+    // The frame's SystemRelativeTime, unless it was remapped for a timelapse
+    winrt::Windows::Foundation::TimeSpan Timestamp = {};
+    // Always the frame's SystemRelativeTime, latency is measured from here
+    winrt::Windows::Foundation::TimeSpan CaptureTime = {};
+    // Changes whenever the source starts handing out a new set of textures,
+    // e.g. when a frame pool is recreated. The old ones won't be seen again.
+    uint32_t TextureGeneration = 0;
+    // Only set for frames from a capture frame pool. Closing it hands the
+    // buffer back to the pool.
+    winrt::Windows::Graphics::Capture::Direct3D11CaptureFrame Frame{ nullptr };
+    // What changed since the previous frame returned by TryGetNextFrame, in
+    // texture coordinates. If HasDirtyRects is false anything could have changed.
+    // Stored inline so that handing frames around doesn't allocate.
+    bool HasDirtyRects = false;
+    uint32_t DirtyRectCount = 0;
+    std::array<D3D11_RECT, MaxFrameDirtyRects> DirtyRects = {};
+};
+
+// Something that produces frames for a session to record. Normally this is
+// a capture, but frames can also come from a recorded trace.
+class FrameSource
+{
+public:
+    virtual ~FrameSource() {}
+
+    // Blocks until a frame is available. Returns std::nullopt once the
+    // source has stopped and every queued frame has been returned.
+    virtual std::optional<CapturedFrame> TryGetNextFrame() = 0;
+    // Doesn't wait. Returns the newest queued frame, if any, and releases the
+    // ones before it.
+    virtual std::optional<CapturedFrame> TryGetLatestFrame() = 0;
+    // Returns true once TryGetNextFrame wouldn't block, or false if the
+    // timeout passed first. Sources that never keep the caller waiting for
+    // long don't need to override this.
+    virtual bool WaitForNextFrame(std::chrono::milliseconds const&) { return true; }
+    // Stops producing frames. Frames that are already queued are still returned.
+    virtual void StopCapture() = 0;
+    // Stops producing frames and releases any queued frames. Returns how many were released.
+    virtual size_t AbortCapture() = 0;
+};
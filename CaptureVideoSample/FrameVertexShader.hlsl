@@ -0,0 +1,14 @@
+#include "FrameShaderCommon.hlsli"
+
+// Draws a single triangle that covers the whole viewport. The texture
+// coordinates are mapped so that the visible part of the triangle covers
+// exactly SourceRect in the input texture.
+VSOutput main(uint vertexId : SV_VertexID)
+{
+    float2 uv = float2((vertexId << 1) & 2, vertexId & 2);
+
+    VSOutput output;
+    output.Position = float4(uv * float2(2.0f, -2.0f) + float2(-1.0f, 1.0f), 0.0f, 1.0f);
+    output.TexCoord = lerp(SourceRect.xy, SourceRect.zw, uv);
+    return output;
+}
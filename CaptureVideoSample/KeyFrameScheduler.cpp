@@ -0,0 +1,57 @@
+#include "pch.h"
+#include "KeyFrameScheduler.h"
+
+namespace winrt
+{
+    using namespace Windows::Foundation;
+}
+
+bool KeyFrameScheduler::ShouldForceKeyFrame(winrt::TimeSpan const& timestamp)
+{
+    if (m_requested.exchange(false))
+    {
+        // Unhonored requests are normally dropped below, this only guards the size
+        if (m_pendingRequests.IsFull())
+        {
+            m_pendingRequests.PopFront();
+        }
+        auto pending = timestamp;
+        m_pendingRequests.TryPushBack(std::move(pending));
+        m_lastKeyFrame = timestamp;
+        return true;
+    }
+
+    // The encoder always starts with a keyframe
+    if (!m_lastKeyFrame.has_value())
+    {
+        m_lastKeyFrame = timestamp;
+        return false;
+    }
+
+    if (m_interval.count() > 0 && timestamp - m_lastKeyFrame.value() >= m_interval)
+    {
+        m_lastKeyFrame = timestamp;
+        return true;
+    }
+    return false;
+}
+
+bool KeyFrameScheduler::OnKeyFrameEncoded(winrt::TimeSpan const& timestamp)
+{
+    if (!m_lastKeyFrame.has_value() || timestamp > m_lastKeyFrame.value())
+    {
+        m_lastKeyFrame = timestamp;
+    }
+
+    while (!m_pendingRequests.IsEmpty() && m_pendingRequests.Front() < timestamp)
+    {
+        // The encoder didn't honor this one
+        m_pendingRequests.PopFront();
+    }
+    if (!m_pendingRequests.IsEmpty() && m_pendingRequests.Front() == timestamp)
+    {
+        m_pendingRequests.PopFront();
+        return true;
+    }
+    return false;
+}
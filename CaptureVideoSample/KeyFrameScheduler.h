@@ -0,0 +1,35 @@
+#pragma once
+#include "BoundedQueue.h"
+
+// Decides which frames the encoder should be forced to make keyframes. A
+// keyframe is forced when one has been requested, or when the keyframe
+// interval has passed without the encoder producing one by itself. Capture
+// delivers frames at a variable rate, so the interval is measured in time
+// rather than in frames.
+class KeyFrameScheduler
+{
+public:
+    // A zero interval leaves it up to the encoder.
+    winrt::Windows::Foundation::TimeSpan Interval() const { return m_interval; }
+    void Interval(winrt::Windows::Foundation::TimeSpan const& interval) { m_interval = interval; }
+
+    // Safe to call from any thread. Multiple requests before the next frame
+    // result in a single keyframe.
+    void RequestKeyFrame() { m_requested = true; }
+
+    // Called on the encoding thread for every frame before it is encoded.
+    bool ShouldForceKeyFrame(winrt::Windows::Foundation::TimeSpan const& timestamp);
+    // Called on the encoding thread for every keyframe the encoder produces.
+    // Returns true if the keyframe was the result of a request.
+    bool OnKeyFrameEncoded(winrt::Windows::Foundation::TimeSpan const& timestamp);
+
+private:
+    std::atomic<bool> m_requested = false;
+    winrt::Windows::Foundation::TimeSpan m_interval = {};
+    // More than any encoder holds on to
+    static const size_t MaxPendingRequests = 32;
+
+    std::optional<winrt::Windows::Foundation::TimeSpan> m_lastKeyFrame;
+    // Frames we forced because of a request that haven't come out of the encoder yet
+    BoundedQueue<winrt::Windows::Foundation::TimeSpan> m_pendingRequests{ MaxPendingRequests };
+};
@@ -1,16 +1,20 @@
 #include "pch.h"
 #include "MainWindow.h"
 #include "App.h"
+#include "RecordingIndex.h"
 #include <robmikh.common/ControlsHelper.h>
 
 const std::wstring MainWindow::ClassName = L"CaptureVideoSample.MainWindow";
 std::once_flag MainWindowClassRegistration;
+// Ctrl+Alt+M marks the current moment with a keyframe
+const int KeyFrameHotKeyId = 1;
 
 namespace winrt
 {
     using namespace Windows::Foundation::Metadata;
     using namespace Windows::Graphics;
     using namespace Windows::Graphics::Capture;
+    using namespace Windows::Graphics::DirectX;
     using namespace Windows::Storage::Pickers;
     using namespace Windows::System;
 }
@@ -71,6 +75,12 @@ MainWindow::MainWindow(std::wstring const& titleString, int width, int height, s
         { L"30 fps", 30 },
         { L"60 fps", 60 },
     };
+    m_sourceCounts =
+    {
+        { L"1", 1 },
+        { L"2 (picture-in-picture)", 2 },
+        { L"4 (grid)", 4 },
+    };
 
     CreateControls(instance);
 }
@@ -98,6 +108,10 @@ LRESULT MainWindow::MessageHandler(UINT const message, WPARAM const wparam, LPAR
                     StopRecording();
                 }
             }
+            else if (hwnd == m_keyFrameButton)
+            {
+                RequestKeyFrame();
+            }
             else if (hwnd == m_topMostCheckBox)
             {
                 auto value = SendMessageW(m_topMostCheckBox, BM_GETCHECK, 0, 0) == BST_CHECKED;
@@ -114,6 +128,12 @@ LRESULT MainWindow::MessageHandler(UINT const message, WPARAM const wparam, LPAR
         }
     }
     break;
+    case WM_HOTKEY:
+        if (wparam == KeyFrameHotKeyId)
+        {
+            RequestKeyFrame();
+        }
+        break;
     case WM_CTLCOLORSTATIC:
         return util::StaticControlColorMessageHandler(wparam, lparam);
     default:
@@ -130,12 +150,20 @@ void MainWindow::CreateControls(HINSTANCE instance)
     auto controls = util::StackPanel(m_window, instance, 10, 10, 40, 200, 30);
 
     m_mainButton = controls.CreateControl(util::ControlType::Button, L"Select Window/Monitor");
+    m_keyFrameButton = controls.CreateControl(util::ControlType::Button, L"Insert keyframe (Ctrl+Alt+M)");
+    EnableWindow(m_keyFrameButton, false);
     controls.CreateControl(util::ControlType::Label, L"Output resolution:");
     m_resolutionComboBox = controls.CreateControl(util::ControlType::ComboBox, L"");
     controls.CreateControl(util::ControlType::Label, L"Output bit rate:");
     m_bitRateComboBox = controls.CreateControl(util::ControlType::ComboBox, L"");
     controls.CreateControl(util::ControlType::Label, L"Output fps:");
     m_fpsComboBox = controls.CreateControl(util::ControlType::ComboBox, L"");
+    controls.CreateControl(util::ControlType::Label, L"Sources:");
+    m_sourcesComboBox = controls.CreateControl(util::ControlType::ComboBox, L"");
+    m_timelapseCheckBox = controls.CreateControl(util::ControlType::CheckBox, L"Timelapse (one frame every 5s)");
+    m_hdrCheckBox = controls.CreateControl(util::ControlType::CheckBox, L"Capture HDR (tone mapped)");
+    m_exportCheckBox = controls.CreateControl(util::ControlType::CheckBox, L"Share frames with other apps");
+    m_streamCheckBox = controls.CreateControl(util::ControlType::CheckBox, L"Stream to 127.0.0.1:5004 (RTP)");
     m_topMostCheckBox = controls.CreateControl(util::ControlType::CheckBox, L"Make this window top-most");
     m_excludeCheckBox = controls.CreateControl(util::ControlType::CheckBox, L"Exclude this window");
     if (!isWin32CaptureExcludePresent)
@@ -163,6 +191,13 @@ void MainWindow::CreateControls(HINSTANCE instance)
         SendMessageW(m_fpsComboBox, CB_ADDSTRING, 0, (LPARAM)entry.Display.c_str());
     }
     SendMessageW(m_fpsComboBox, CB_SETCURSEL, 2, 0);
+
+    // Populate source count combo box
+    for (auto& entry : m_sourceCounts)
+    {
+        SendMessageW(m_sourcesComboBox, CB_ADDSTRING, 0, (LPARAM)entry.Display.c_str());
+    }
+    SendMessageW(m_sourcesComboBox, CB_SETCURSEL, 0, 0);
 }
 
 size_t MainWindow::GetIndexFromComboBox(HWND comboBox)
@@ -180,30 +215,69 @@ winrt::fire_and_forget MainWindow::StartRecording()
 
     if (item != nullptr)
     {
+        // The first item decides the output size, the rest are drawn into it.
+        // Cancelling the picker records what has been picked so far.
+        std::vector<winrt::GraphicsCaptureItem> items = { item };
+        auto sourceCount = GetSourceCount();
+        while (items.size() < sourceCount)
+        {
+            auto nextItem = co_await picker.PickSingleItemAsync();
+            if (nextItem == nullptr)
+            {
+                break;
+            }
+            items.push_back(nextItem);
+        }
+
         auto resolution = GetResolution(item);
         auto bitRate = GetBitRate();
         auto frameRate = GetFrameRate();
+        auto pixelFormat = GetPixelFormat();
+        // Picked items don't say which monitor they're on, so assume the
+        // one we're on
+        auto monitor = MonitorFromWindow(m_window, MONITOR_DEFAULTTOPRIMARY);
+        auto exportFrames = SendMessageW(m_exportCheckBox, BM_GETCHECK, 0, 0) == BST_CHECKED;
+        auto streamOverRtp = SendMessageW(m_streamCheckBox, BM_GETCHECK, 0, 0) == BST_CHECKED;
+        auto timelapse = SendMessageW(m_timelapseCheckBox, BM_GETCHECK, 0, 0) == BST_CHECKED;
 
         OnRecordingStarted();
 
-        auto file = co_await m_app->StartRecordingAsync(item, resolution, bitRate, frameRate);
-
-        auto filePicker = winrt::FileSavePicker();
-        InitializeObjectWithWindowHandle(filePicker);
-        filePicker.SuggestedStartLocation(winrt::PickerLocationId::VideosLibrary);
-        filePicker.SuggestedFileName(L"recording");
-        filePicker.DefaultFileExtension(L".mp4");
-        filePicker.FileTypeChoices().Clear();
-        filePicker.FileTypeChoices().Insert(L"MP4 Video", winrt::single_threaded_vector<winrt::hstring>({ L".mp4" }));
-        auto destFile = co_await filePicker.PickSaveFileAsync();
-        if (destFile == nullptr)
-        {
-            co_await file.DeleteAsync();
-        }
-        else
+        auto file = co_await m_app->StartRecordingAsync(items, resolution, bitRate, frameRate, pixelFormat, monitor, exportFrames, streamOverRtp, timelapse);
+
+        // Nothing was recorded if we stopped before the first frame
+        if (file != nullptr)
         {
-            co_await file.MoveAndReplaceAsync(destFile);
-            co_await winrt::Launcher::LaunchFileAsync(destFile);
+            auto filePicker = winrt::FileSavePicker();
+            InitializeObjectWithWindowHandle(filePicker);
+            filePicker.SuggestedStartLocation(winrt::PickerLocationId::VideosLibrary);
+            filePicker.SuggestedFileName(L"recording");
+            filePicker.DefaultFileExtension(L".mp4");
+            filePicker.FileTypeChoices().Clear();
+            filePicker.FileTypeChoices().Insert(L"MP4 Video", winrt::single_threaded_vector<winrt::hstring>({ L".mp4" }));
+            auto destFile = co_await filePicker.PickSaveFileAsync();
+            // The seek index travels with the recording it describes
+            auto indexPath = GetRecordingIndexPath(std::wstring(file.Path()));
+            if (destFile == nullptr)
+            {
+                co_await file.DeleteAsync();
+                std::error_code error;
+                std::filesystem::remove(indexPath, error);
+            }
+            else
+            {
+                co_await file.MoveAndReplaceAsync(destFile);
+                std::error_code error;
+                if (std::filesystem::exists(indexPath, error))
+                {
+                    std::filesystem::copy_file(indexPath, GetRecordingIndexPath(std::wstring(destFile.Path())), std::filesystem::copy_options::overwrite_existing, error);
+                    if (error)
+                    {
+                        OutputDebugStringW(L"Failed to copy the recording index\n");
+                    }
+                    std::filesystem::remove(indexPath, error);
+                }
+                co_await winrt::Launcher::LaunchFileAsync(destFile);
+            }
         }
         OnRecordingFinished();
     }
@@ -216,6 +290,17 @@ void MainWindow::OnRecordingStarted()
     EnableWindow(m_resolutionComboBox, false);
     EnableWindow(m_bitRateComboBox, false);
     EnableWindow(m_fpsComboBox, false);
+    EnableWindow(m_sourcesComboBox, false);
+    EnableWindow(m_hdrCheckBox, false);
+    EnableWindow(m_exportCheckBox, false);
+    EnableWindow(m_streamCheckBox, false);
+    EnableWindow(m_timelapseCheckBox, false);
+    EnableWindow(m_keyFrameButton, true);
+    // Another app may already own the hotkey, the button still works
+    if (!RegisterHotKey(m_window, KeyFrameHotKeyId, MOD_CONTROL | MOD_ALT | MOD_NOREPEAT, 'M'))
+    {
+        OutputDebugStringW(L"Couldn't register the keyframe hotkey.\n");
+    }
     m_state = ApplicationState::Recording;
 }
 
@@ -225,6 +310,13 @@ void MainWindow::OnRecordingFinished()
     EnableWindow(m_resolutionComboBox, true);
     EnableWindow(m_bitRateComboBox, true);
     EnableWindow(m_fpsComboBox, true);
+    EnableWindow(m_sourcesComboBox, true);
+    EnableWindow(m_hdrCheckBox, true);
+    EnableWindow(m_exportCheckBox, true);
+    EnableWindow(m_streamCheckBox, true);
+    EnableWindow(m_timelapseCheckBox, true);
+    EnableWindow(m_keyFrameButton, false);
+    UnregisterHotKey(m_window, KeyFrameHotKeyId);
     m_state = ApplicationState::Idle;
 }
 
@@ -256,7 +348,28 @@ uint32_t MainWindow::GetFrameRate()
     return entry.FrameRate;
 }
 
+size_t MainWindow::GetSourceCount()
+{
+    auto index = GetIndexFromComboBox(m_sourcesComboBox);
+    auto& entry = m_sourceCounts[index];
+    return entry.SourceCount;
+}
+
+winrt::DirectXPixelFormat MainWindow::GetPixelFormat()
+{
+    auto captureHdr = SendMessageW(m_hdrCheckBox, BM_GETCHECK, 0, 0) == BST_CHECKED;
+    return captureHdr ? winrt::DirectXPixelFormat::R16G16B16A16Float : winrt::DirectXPixelFormat::B8G8R8A8UIntNormalized;
+}
+
 void MainWindow::StopRecording()
 {
     m_app->StopRecording();
 }
+
+void MainWindow::RequestKeyFrame()
+{
+    if (m_state == ApplicationState::Recording)
+    {
+        m_app->RequestKeyFrame();
+    }
+}
@@ -28,6 +28,12 @@ private:
 		uint32_t BitRate;
 	};
 
+	struct SourceCountEntry
+	{
+		std::wstring Display;
+		size_t SourceCount;
+	};
+
 	struct FrameRateEntry
 	{
 		std::wstring Display;
@@ -43,18 +49,28 @@ private:
 	winrt::Windows::Graphics::SizeInt32 GetResolution(winrt::Windows::Graphics::Capture::GraphicsCaptureItem const& source);
 	uint32_t GetBitRate();
 	uint32_t GetFrameRate();
+	size_t GetSourceCount();
+	winrt::Windows::Graphics::DirectX::DirectXPixelFormat GetPixelFormat();
 	void StopRecording();
+	void RequestKeyFrame();
 
 private:
 	std::shared_ptr<App> m_app;
 	ApplicationState m_state = ApplicationState::Idle;
 	HWND m_mainButton = nullptr;
+	HWND m_keyFrameButton = nullptr;
 	HWND m_resolutionComboBox = nullptr;
 	HWND m_bitRateComboBox = nullptr;
 	HWND m_fpsComboBox = nullptr;
+	HWND m_sourcesComboBox = nullptr;
 	HWND m_topMostCheckBox = nullptr;
 	HWND m_excludeCheckBox = nullptr;
+	HWND m_hdrCheckBox = nullptr;
+	HWND m_exportCheckBox = nullptr;
+	HWND m_streamCheckBox = nullptr;
+	HWND m_timelapseCheckBox = nullptr;
 	std::vector<ResolutionEntry> m_resolutions;
 	std::vector<BitRateEntry> m_bitRates;
 	std::vector<FrameRateEntry> m_frameRates;
+	std::vector<SourceCountEntry> m_sourceCounts;
 };
\ No newline at end of file
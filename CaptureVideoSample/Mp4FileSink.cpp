@@ -0,0 +1,46 @@
+#include "pch.h"
+#include "Mp4FileSink.h"
+
+namespace winrt
+{
+    using namespace Windows::Storage::Streams;
+}
+
+Mp4FileSink::Mp4FileSink(winrt::IRandomAccessStream const& stream)
+{
+    winrt::check_hresult(MFCreateMFByteStreamOnStreamEx(winrt::get_unknown(stream), m_byteStream.put()));
+}
+
+void Mp4FileSink::OnFrameEncoded(EncodedFrame const& frame)
+{
+    // We don't know the final output type until the encoder has produced something.
+    if (!m_sinkWriter)
+    {
+        CreateSinkWriter(frame.MediaType.get());
+    }
+    winrt::check_hresult(m_sinkWriter->WriteSample(m_streamIndex, frame.Sample.get()));
+}
+
+void Mp4FileSink::Close()
+{
+    if (m_sinkWriter)
+    {
+        winrt::check_hresult(m_sinkWriter->Finalize());
+        m_sinkWriter = nullptr;
+    }
+    m_byteStream->Close();
+}
+
+void Mp4FileSink::CreateSinkWriter(IMFMediaType* mediaType)
+{
+    winrt::com_ptr<IMFAttributes> attributes;
+    winrt::check_hresult(MFCreateAttributes(attributes.put(), 2));
+    winrt::check_hresult(attributes->SetGUID(MF_TRANSCODE_CONTAINERTYPE, MFTranscodeContainerType_MPEG4));
+    winrt::check_hresult(attributes->SetUINT32(MF_SINK_WRITER_DISABLE_THROTTLING, TRUE));
+    winrt::check_hresult(MFCreateSinkWriterFromURL(nullptr, m_byteStream.get(), attributes.get(), m_sinkWriter.put()));
+
+    // Input and output types match, so the sink writer passes samples through.
+    winrt::check_hresult(m_sinkWriter->AddStream(mediaType, &m_streamIndex));
+    winrt::check_hresult(m_sinkWriter->SetInputMediaType(m_streamIndex, mediaType, nullptr));
+    winrt::check_hresult(m_sinkWriter->BeginWriting());
+}
@@ -0,0 +1,20 @@
+#pragma once
+#include "EncodedFrameSink.h"
+
+// Muxes already encoded frames into an MP4 container without re-encoding them.
+class Mp4FileSink : public EncodedFrameSink
+{
+public:
+    Mp4FileSink(winrt::Windows::Storage::Streams::IRandomAccessStream const& stream);
+
+    void OnFrameEncoded(EncodedFrame const& frame) override;
+    void Close() override;
+
+private:
+    void CreateSinkWriter(IMFMediaType* mediaType);
+
+private:
+    winrt::com_ptr<IMFByteStream> m_byteStream;
+    winrt::com_ptr<IMFSinkWriter> m_sinkWriter;
+    DWORD m_streamIndex = 0;
+};
@@ -0,0 +1,313 @@
+#include "pch.h"
+#include "Mp4SampleTable.h"
+
+struct Mp4Box
+{
+    uint32_t Type = 0;
+    // The whole box, header included
+    uint8_t const* Data = nullptr;
+    size_t Size = 0;
+    uint8_t const* Payload = nullptr;
+    size_t PayloadSize = 0;
+};
+
+void CheckMp4(bool condition)
+{
+    if (!condition)
+    {
+        throw winrt::hresult_error(HRESULT_FROM_WIN32(ERROR_INVALID_DATA), L"The MP4 file is malformed.");
+    }
+}
+
+uint32_t ReadBigEndian32(uint8_t const* data)
+{
+    return (static_cast<uint32_t>(data[0]) << 24) | (static_cast<uint32_t>(data[1]) << 16) |
+        (static_cast<uint32_t>(data[2]) << 8) | static_cast<uint32_t>(data[3]);
+}
+
+uint64_t ReadBigEndian64(uint8_t const* data)
+{
+    return (static_cast<uint64_t>(ReadBigEndian32(data)) << 32) | ReadBigEndian32(data + 4);
+}
+
+// Walks the boxes directly inside a box's payload
+template <typename Function>
+void ForEachBox(uint8_t const* data, size_t size, Function&& function)
+{
+    size_t position = 0;
+    while (position + 8 <= size)
+    {
+        Mp4Box box;
+        box.Data = data + position;
+        box.Type = ReadBigEndian32(box.Data + 4);
+        uint64_t boxSize = ReadBigEndian32(box.Data);
+        size_t headerSize = 8;
+        if (boxSize == 1)
+        {
+            CheckMp4(position + 16 <= size);
+            boxSize = ReadBigEndian64(box.Data + 8);
+            headerSize = 16;
+        }
+        else if (boxSize == 0)
+        {
+            boxSize = size - position;
+        }
+        CheckMp4(boxSize >= headerSize && boxSize <= size - position);
+
+        box.Size = static_cast<size_t>(boxSize);
+        box.Payload = box.Data + headerSize;
+        box.PayloadSize = box.Size - headerSize;
+        function(box);
+        position += box.Size;
+    }
+}
+
+std::optional<Mp4Box> FindBox(uint8_t const* data, size_t size, uint32_t type)
+{
+    std::optional<Mp4Box> result;
+    ForEachBox(data, size, [&](Mp4Box const& box)
+    {
+        if (!result.has_value() && box.Type == type)
+        {
+            result = box;
+        }
+    });
+    return result;
+}
+
+std::optional<Mp4Box> FindBox(Mp4Box const& parent, uint32_t type)
+{
+    return FindBox(parent.Payload, parent.PayloadSize, type);
+}
+
+// Returns the entries of a full box whose payload is a version/flags word,
+// an entry count and then the entries.
+uint8_t const* GetTableEntries(Mp4Box const& box, size_t entrySize, uint32_t& count)
+{
+    CheckMp4(box.PayloadSize >= 8);
+    count = ReadBigEndian32(box.Payload + 4);
+    CheckMp4(static_cast<uint64_t>(count) * entrySize <= box.PayloadSize - 8);
+    return box.Payload + 8;
+}
+
+std::vector<uint8_t> ReadMovieBox(std::wstring const& path)
+{
+    // The recording may still be open elsewhere
+    wil::unique_hfile file(CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr));
+    winrt::check_bool(static_cast<bool>(file));
+    LARGE_INTEGER fileSize = {};
+    winrt::check_bool(GetFileSizeEx(file.get(), &fileSize));
+
+    uint64_t position = 0;
+    while (position + 8 <= static_cast<uint64_t>(fileSize.QuadPart))
+    {
+        LARGE_INTEGER seek = {};
+        seek.QuadPart = static_cast<int64_t>(position);
+        winrt::check_bool(SetFilePointerEx(file.get(), seek, nullptr, FILE_BEGIN));
+
+        std::array<uint8_t, 16> header = {};
+        DWORD read = 0;
+        winrt::check_bool(ReadFile(file.get(), header.data(), static_cast<DWORD>(header.size()), &read, nullptr));
+        CheckMp4(read >= 8);
+        uint64_t boxSize = ReadBigEndian32(header.data());
+        auto type = ReadBigEndian32(header.data() + 4);
+        uint64_t headerSize = 8;
+        if (boxSize == 1)
+        {
+            CheckMp4(read >= 16);
+            boxSize = ReadBigEndian64(header.data() + 8);
+            headerSize = 16;
+        }
+        else if (boxSize == 0)
+        {
+            boxSize = static_cast<uint64_t>(fileSize.QuadPart) - position;
+        }
+        CheckMp4(boxSize >= headerSize);
+
+        if (type == MakeBoxType("moov"))
+        {
+            // Keep the header so the result can be parsed like any other box
+            CheckMp4(boxSize <= std::numeric_limits<uint32_t>::max());
+            std::vector<uint8_t> movie(static_cast<size_t>(boxSize));
+            winrt::check_bool(SetFilePointerEx(file.get(), seek, nullptr, FILE_BEGIN));
+            winrt::check_bool(ReadFile(file.get(), movie.data(), static_cast<DWORD>(movie.size()), &read, nullptr));
+            CheckMp4(read == movie.size());
+            return movie;
+        }
+        position += boxSize;
+    }
+    throw winrt::hresult_error(HRESULT_FROM_WIN32(ERROR_INVALID_DATA), L"The MP4 file has no moov box.");
+}
+
+void ReadSampleTable(Mp4Box const& sampleTable, Mp4VideoTrack& track)
+{
+    auto sampleDescription = FindBox(sampleTable, MakeBoxType("stsd"));
+    auto sizes = FindBox(sampleTable, MakeBoxType("stsz"));
+    auto times = FindBox(sampleTable, MakeBoxType("stts"));
+    auto chunks = FindBox(sampleTable, MakeBoxType("stsc"));
+    auto chunkOffsets = FindBox(sampleTable, MakeBoxType("stco"));
+    auto chunkOffsets64 = FindBox(sampleTable, MakeBoxType("co64"));
+    CheckMp4(sampleDescription && sizes && times && chunks && (chunkOffsets || chunkOffsets64));
+    track.SampleDescription.assign(sampleDescription->Data, sampleDescription->Data + sampleDescription->Size);
+
+    // Sizes
+    CheckMp4(sizes->PayloadSize >= 12);
+    auto fixedSize = ReadBigEndian32(sizes->Payload + 4);
+    auto sampleCount = ReadBigEndian32(sizes->Payload + 8);
+    CheckMp4(fixedSize != 0 || static_cast<uint64_t>(sampleCount) * 4 <= sizes->PayloadSize - 12);
+    track.Samples.resize(sampleCount);
+    for (uint32_t i = 0; i < sampleCount; i++)
+    {
+        track.Samples[i].Size = fixedSize != 0 ? fixedSize : ReadBigEndian32(sizes->Payload + 12 + i * 4);
+    }
+
+    // Decode times and durations
+    uint32_t entryCount = 0;
+    auto entries = GetTableEntries(times.value(), 8, entryCount);
+    uint64_t decodeTime = 0;
+    size_t sampleIndex = 0;
+    for (uint32_t i = 0; i < entryCount; i++)
+    {
+        auto count = ReadBigEndian32(entries + i * 8);
+        auto delta = ReadBigEndian32(entries + i * 8 + 4);
+        for (uint32_t j = 0; j < count && sampleIndex < track.Samples.size(); j++, sampleIndex++)
+        {
+            track.Samples[sampleIndex].DecodeTime = decodeTime;
+            track.Samples[sampleIndex].Duration = delta;
+            decodeTime += delta;
+        }
+    }
+
+    // Composition offsets, only there if frames are reordered
+    if (auto compositionOffsets = FindBox(sampleTable, MakeBoxType("ctts")))
+    {
+        entries = GetTableEntries(compositionOffsets.value(), 8, entryCount);
+        sampleIndex = 0;
+        for (uint32_t i = 0; i < entryCount; i++)
+        {
+            auto count = ReadBigEndian32(entries + i * 8);
+            // Version 0 offsets are unsigned, but never large enough for that to matter
+            auto offset = static_cast<int32_t>(ReadBigEndian32(entries + i * 8 + 4));
+            for (uint32_t j = 0; j < count && sampleIndex < track.Samples.size(); j++, sampleIndex++)
+            {
+                track.Samples[sampleIndex].CompositionOffset = offset;
+            }
+        }
+    }
+
+    // Without a sync sample table every sample is a keyframe
+    if (auto syncSamples = FindBox(sampleTable, MakeBoxType("stss")))
+    {
+        entries = GetTableEntries(syncSamples.value(), 4, entryCount);
+        for (uint32_t i = 0; i < entryCount; i++)
+        {
+            auto number = ReadBigEndian32(entries + i * 4);
+            CheckMp4(number >= 1 && number <= track.Samples.size());
+            track.Samples[number - 1].IsKeyFrame = true;
+        }
+    }
+    else
+    {
+        for (auto&& sample : track.Samples)
+        {
+            sample.IsKeyFrame = true;
+        }
+    }
+
+    // Offsets: samples are stored in chunks, and runs of chunks share a sample count
+    std::vector<uint64_t> offsets;
+    if (chunkOffsets64)
+    {
+        entries = GetTableEntries(chunkOffsets64.value(), 8, entryCount);
+        for (uint32_t i = 0; i < entryCount; i++)
+        {
+            offsets.push_back(ReadBigEndian64(entries + i * 8));
+        }
+    }
+    else
+    {
+        entries = GetTableEntries(chunkOffsets.value(), 4, entryCount);
+        for (uint32_t i = 0; i < entryCount; i++)
+        {
+            offsets.push_back(ReadBigEndian32(entries + i * 4));
+        }
+    }
+
+    uint32_t runCount = 0;
+    auto runs = GetTableEntries(chunks.value(), 12, runCount);
+    sampleIndex = 0;
+    for (uint32_t i = 0; i < runCount; i++)
+    {
+        auto firstChunk = ReadBigEndian32(runs + i * 12);
+        auto samplesPerChunk = ReadBigEndian32(runs + i * 12 + 4);
+        auto endChunk = i + 1 < runCount ? ReadBigEndian32(runs + (i + 1) * 12) : static_cast<uint32_t>(offsets.size() + 1);
+        CheckMp4(firstChunk >= 1 && endChunk >= firstChunk && endChunk <= offsets.size() + 1);
+        for (auto chunk = firstChunk; chunk < endChunk; chunk++)
+        {
+            auto offset = offsets[chunk - 1];
+            for (uint32_t j = 0; j < samplesPerChunk && sampleIndex < track.Samples.size(); j++, sampleIndex++)
+            {
+                track.Samples[sampleIndex].Offset = offset;
+                offset += track.Samples[sampleIndex].Size;
+            }
+        }
+    }
+    CheckMp4(sampleIndex == track.Samples.size());
+}
+
+Mp4VideoTrack ReadMp4VideoTrack(std::wstring const& path)
+{
+    auto movie = ReadMovieBox(path);
+    return ParseMp4VideoTrack(movie.data(), movie.size());
+}
+
+Mp4VideoTrack ParseMp4VideoTrack(uint8_t const* movieData, size_t size)
+{
+    std::optional<Mp4VideoTrack> result;
+    ForEachBox(movieData, size, [&](Mp4Box const& movie)
+    {
+        ForEachBox(movie.Payload, movie.PayloadSize, [&](Mp4Box const& trackBox)
+        {
+            if (result.has_value() || trackBox.Type != MakeBoxType("trak"))
+            {
+                return;
+            }
+            auto media = FindBox(trackBox, MakeBoxType("mdia"));
+            CheckMp4(media.has_value());
+            auto handler = FindBox(media.value(), MakeBoxType("hdlr"));
+            CheckMp4(handler.has_value() && handler->PayloadSize >= 12);
+            if (ReadBigEndian32(handler->Payload + 8) != MakeBoxType("vide"))
+            {
+                return;
+            }
+
+            Mp4VideoTrack track;
+            auto mediaHeader = FindBox(media.value(), MakeBoxType("mdhd"));
+            CheckMp4(mediaHeader.has_value() && mediaHeader->PayloadSize >= 24);
+            auto version = mediaHeader->Payload[0];
+            CheckMp4(version == 0 || mediaHeader->PayloadSize >= 32);
+            track.Timescale = ReadBigEndian32(mediaHeader->Payload + (version == 1 ? 20 : 12));
+            CheckMp4(track.Timescale != 0);
+
+            // The track header's size is 16.16 fixed point, at the end of the box
+            auto trackHeader = FindBox(trackBox, MakeBoxType("tkhd"));
+            CheckMp4(trackHeader.has_value() && trackHeader->PayloadSize >= 8);
+            auto sizeOffset = trackHeader->PayloadSize - 8;
+            track.Width = ReadBigEndian32(trackHeader->Payload + sizeOffset) >> 16;
+            track.Height = ReadBigEndian32(trackHeader->Payload + sizeOffset + 4) >> 16;
+
+            auto mediaInformation = FindBox(media.value(), MakeBoxType("minf"));
+            CheckMp4(mediaInformation.has_value());
+            auto sampleTable = FindBox(mediaInformation.value(), MakeBoxType("stbl"));
+            CheckMp4(sampleTable.has_value());
+            ReadSampleTable(sampleTable.value(), track);
+            result = std::move(track);
+        });
+    });
+
+    if (!result.has_value())
+    {
+        throw winrt::hresult_error(HRESULT_FROM_WIN32(ERROR_INVALID_DATA), L"The MP4 file has no video track.");
+    }
+    return std::move(result.value());
+}
@@ -0,0 +1,48 @@
+#pragma once
+
+constexpr uint32_t MakeBoxType(char const (&type)[5])
+{
+    return (static_cast<uint32_t>(type[0]) << 24) | (static_cast<uint32_t>(type[1]) << 16) |
+        (static_cast<uint32_t>(type[2]) << 8) | static_cast<uint32_t>(type[3]);
+}
+
+// Throws if the condition doesn't hold
+void CheckMp4(bool condition);
+
+struct Mp4Sample
+{
+    // From the start of the file
+    uint64_t Offset = 0;
+    uint32_t Size = 0;
+    // In the track's timescale
+    uint64_t DecodeTime = 0;
+    uint32_t Duration = 0;
+    // Presentation time minus decode time
+    int32_t CompositionOffset = 0;
+    bool IsKeyFrame = false;
+};
+
+struct Mp4VideoTrack
+{
+    uint32_t Timescale = 0;
+    uint32_t Width = 0;
+    uint32_t Height = 0;
+    // The whole stsd box, which carries the codec configuration (avcC for H.264)
+    std::vector<uint8_t> SampleDescription;
+    // In decode order
+    std::vector<Mp4Sample> Samples;
+};
+
+// Reads the sample table of the first video track in an MP4 file. Only the
+// moov box is read, never the media data, so this is cheap even for very
+// long recordings.
+Mp4VideoTrack ReadMp4VideoTrack(std::wstring const& path);
+// The same, for a moov box that's already in memory, header included.
+Mp4VideoTrack ParseMp4VideoTrack(uint8_t const* movie, size_t size);
+
+inline winrt::Windows::Foundation::TimeSpan Mp4TimeToTimeSpan(int64_t time, uint32_t timescale)
+{
+    // Split to avoid overflowing for long recordings with fine timescales
+    auto ticksPerSecond = std::chrono::duration_cast<winrt::Windows::Foundation::TimeSpan>(std::chrono::seconds(1)).count();
+    return winrt::Windows::Foundation::TimeSpan{ (time / timescale) * ticksPerSecond + (time % timescale) * ticksPerSecond / timescale };
+}
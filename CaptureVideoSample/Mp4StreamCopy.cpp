@@ -0,0 +1,789 @@
+#include "pch.h"
+#include "Mp4StreamCopy.h"
+#include "Mp4SampleTable.h"
+#include "TraceReplay.h"
+
+namespace winrt
+{
+    using namespace Windows::Foundation;
+}
+
+// Large enough that copying runs at the disk's sequential speed. Two of
+// these are in use at a time, one being read into while the other is
+// being written out.
+const size_t CopyBufferSize = 8 * 1024 * 1024;
+// ftyp (8 byte header, brand, version and four compatible brands)
+const size_t FileTypeBoxSize = 32;
+// mdat with a 64-bit size, it's usually larger than 4GB
+const size_t MediaDataHeaderSize = 16;
+
+// Builds boxes in memory. The size of each box is filled in once its
+// contents are known.
+class Mp4BoxWriter
+{
+public:
+    void Write8(uint8_t value) { m_data.push_back(value); }
+    void Write16(uint16_t value)
+    {
+        Write8(static_cast<uint8_t>(value >> 8));
+        Write8(static_cast<uint8_t>(value));
+    }
+    void Write32(uint32_t value)
+    {
+        Write16(static_cast<uint16_t>(value >> 16));
+        Write16(static_cast<uint16_t>(value));
+    }
+    void Write64(uint64_t value)
+    {
+        Write32(static_cast<uint32_t>(value >> 32));
+        Write32(static_cast<uint32_t>(value));
+    }
+    void WriteBytes(uint8_t const* data, size_t size) { m_data.insert(m_data.end(), data, data + size); }
+    void WriteZeros(size_t count) { m_data.insert(m_data.end(), count, 0); }
+    void WriteUnityMatrix()
+    {
+        for (auto&& value : { 0x00010000u, 0u, 0u, 0u, 0x00010000u, 0u, 0u, 0u, 0x40000000u })
+        {
+            Write32(value);
+        }
+    }
+
+    size_t BeginBox(uint32_t type)
+    {
+        auto start = m_data.size();
+        Write32(0);
+        Write32(type);
+        return start;
+    }
+    size_t BeginFullBox(uint32_t type, uint8_t version, uint32_t flags)
+    {
+        auto start = BeginBox(type);
+        Write32((static_cast<uint32_t>(version) << 24) | flags);
+        return start;
+    }
+    void EndBox(size_t start)
+    {
+        auto size = m_data.size() - start;
+        CheckMp4(size <= std::numeric_limits<uint32_t>::max());
+        Patch32(start, static_cast<uint32_t>(size));
+    }
+    // Fills in a value that wasn't known when it was written
+    void Patch32(size_t position, uint32_t value)
+    {
+        for (auto i = 0; i < 4; i++)
+        {
+            m_data[position + i] = static_cast<uint8_t>(value >> (24 - i * 8));
+        }
+    }
+
+    std::vector<uint8_t> const& Data() const { return m_data; }
+
+private:
+    std::vector<uint8_t> m_data;
+};
+
+// A range of samples that are stored back to back in one of the inputs,
+// copied with a single run of large reads and written out as one chunk.
+struct Mp4CopyRun
+{
+    size_t InputIndex = 0;
+    uint64_t SourceOffset = 0;
+    uint64_t Size = 0;
+    uint32_t SampleCount = 0;
+};
+
+struct Mp4CopyPlan
+{
+    uint32_t Timescale = 0;
+    uint32_t Width = 0;
+    uint32_t Height = 0;
+    std::vector<uint8_t> SampleDescription;
+    // In decode order. Offsets aren't used, each run says where its
+    // samples come from.
+    std::vector<Mp4Sample> Samples;
+    std::vector<Mp4CopyRun> Runs;
+    uint64_t MediaDataSize = 0;
+    uint64_t Duration = 0;
+};
+
+// Writes to a file opened for overlapped I/O, so a copy can read the next
+// buffer while the previous one is still being written.
+class Mp4OutputFile
+{
+public:
+    Mp4OutputFile(std::wstring const& path)
+    {
+        m_file.reset(CreateFileW(path.c_str(), GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_OVERLAPPED | FILE_FLAG_SEQUENTIAL_SCAN, nullptr));
+        winrt::check_bool(static_cast<bool>(m_file));
+        for (auto&& write : m_writes)
+        {
+            write.Buffer.resize(CopyBufferSize);
+            write.Event.create(wil::EventOptions::ManualReset);
+        }
+    }
+    ~Mp4OutputFile()
+    {
+        // The buffers can't go away while the system is still using them
+        for (auto&& write : m_writes)
+        {
+            if (write.IsPending)
+            {
+                CancelIoEx(m_file.get(), &write.Overlapped);
+                DWORD written = 0;
+                GetOverlappedResult(m_file.get(), &write.Overlapped, &written, true);
+            }
+        }
+    }
+
+    uint64_t Position() const { return m_position; }
+
+    // Lets the file system lay the file out in one piece up front, instead
+    // of growing it one buffer at a time
+    void Reserve(uint64_t size)
+    {
+        FILE_ALLOCATION_INFO allocation = {};
+        allocation.AllocationSize.QuadPart = static_cast<int64_t>(size);
+        winrt::check_bool(SetFileInformationByHandle(m_file.get(), FileAllocationInfo, &allocation, sizeof(allocation)));
+    }
+
+    void Write(uint8_t const* data, size_t size)
+    {
+        while (size > 0)
+        {
+            auto& write = NextWrite();
+            auto chunkSize = std::min(size, CopyBufferSize);
+            std::copy(data, data + chunkSize, write.Buffer.data());
+            StartWrite(write, chunkSize);
+            data += chunkSize;
+            size -= chunkSize;
+        }
+    }
+
+    void CopyFrom(HANDLE source, uint64_t offset, uint64_t size)
+    {
+        LARGE_INTEGER seek = {};
+        seek.QuadPart = static_cast<int64_t>(offset);
+        winrt::check_bool(SetFilePointerEx(source, seek, nullptr, FILE_BEGIN));
+        while (size > 0)
+        {
+            auto& write = NextWrite();
+            auto chunkSize = static_cast<size_t>(std::min<uint64_t>(size, CopyBufferSize));
+            DWORD read = 0;
+            winrt::check_bool(ReadFile(source, write.Buffer.data(), static_cast<DWORD>(chunkSize), &read, nullptr));
+            CheckMp4(read == chunkSize);
+            StartWrite(write, chunkSize);
+            size -= chunkSize;
+        }
+    }
+
+    void Flush()
+    {
+        for (auto&& write : m_writes)
+        {
+            WaitForWrite(write);
+        }
+    }
+
+private:
+    struct PendingWrite
+    {
+        std::vector<uint8_t> Buffer;
+        wil::unique_event Event;
+        OVERLAPPED Overlapped = {};
+        DWORD Size = 0;
+        bool IsPending = false;
+    };
+
+    PendingWrite& NextWrite()
+    {
+        auto& write = m_writes[m_nextWrite];
+        m_nextWrite = (m_nextWrite + 1) % m_writes.size();
+        WaitForWrite(write);
+        return write;
+    }
+
+    void StartWrite(PendingWrite& write, size_t size)
+    {
+        write.Overlapped = {};
+        write.Overlapped.Offset = static_cast<DWORD>(m_position);
+        write.Overlapped.OffsetHigh = static_cast<DWORD>(m_position >> 32);
+        write.Overlapped.hEvent = write.Event.get();
+        write.Size = static_cast<DWORD>(size);
+        if (!WriteFile(m_file.get(), write.Buffer.data(), write.Size, nullptr, &write.Overlapped))
+        {
+            auto error = GetLastError();
+            if (error != ERROR_IO_PENDING)
+            {
+                winrt::throw_hresult(HRESULT_FROM_WIN32(error));
+            }
+        }
+        write.IsPending = true;
+        m_position += size;
+    }
+
+    void WaitForWrite(PendingWrite& write)
+    {
+        if (write.IsPending)
+        {
+            write.IsPending = false;
+            DWORD written = 0;
+            winrt::check_bool(GetOverlappedResult(m_file.get(), &write.Overlapped, &written, true));
+            if (written != write.Size)
+            {
+                throw winrt::hresult_error(HRESULT_FROM_WIN32(ERROR_WRITE_FAULT), L"Failed to write the whole buffer.");
+            }
+        }
+    }
+
+private:
+    wil::unique_hfile m_file;
+    std::array<PendingWrite, 2> m_writes;
+    size_t m_nextWrite = 0;
+    uint64_t m_position = 0;
+};
+
+// The samples to keep, in decode order: from the keyframe at or before the
+// start up to, but not including, the keyframe at or after the end. Only
+// whole GOPs are kept so that every sample can still be decoded.
+std::pair<size_t, size_t> FindKeyFrameRange(
+    Mp4VideoTrack const& track,
+    std::optional<winrt::TimeSpan> const& start,
+    std::optional<winrt::TimeSpan> const& end)
+{
+    CheckMp4(!track.Samples.empty() && track.Samples.front().IsKeyFrame);
+    auto firstPresentationTime = static_cast<int64_t>(track.Samples.front().DecodeTime) + track.Samples.front().CompositionOffset;
+    auto presentationTime = [&](Mp4Sample const& sample)
+    {
+        return Mp4TimeToTimeSpan(static_cast<int64_t>(sample.DecodeTime) + sample.CompositionOffset - firstPresentationTime, track.Timescale);
+    };
+
+    size_t first = 0;
+    if (start.has_value())
+    {
+        for (size_t i = 0; i < track.Samples.size(); i++)
+        {
+            auto const& sample = track.Samples[i];
+            if (sample.IsKeyFrame && presentationTime(sample) <= start.value())
+            {
+                first = i;
+            }
+        }
+    }
+
+    size_t last = track.Samples.size();
+    if (end.has_value())
+    {
+        for (auto i = first + 1; i < track.Samples.size(); i++)
+        {
+            auto const& sample = track.Samples[i];
+            if (sample.IsKeyFrame && presentationTime(sample) >= end.value())
+            {
+                last = i;
+                break;
+            }
+        }
+    }
+    return { first, last };
+}
+
+// Appends the samples of one input to the plan
+void AddToCopyPlan(
+    Mp4CopyPlan& plan,
+    Mp4VideoTrack const& track,
+    size_t inputIndex,
+    std::optional<winrt::TimeSpan> const& start,
+    std::optional<winrt::TimeSpan> const& end)
+{
+    if (inputIndex == 0)
+    {
+        plan.Timescale = track.Timescale;
+        plan.Width = track.Width;
+        plan.Height = track.Height;
+        plan.SampleDescription = track.SampleDescription;
+    }
+    // The output can only have one codec configuration
+    else if (track.Timescale != plan.Timescale || track.SampleDescription != plan.SampleDescription)
+    {
+        throw winrt::hresult_error(MF_E_INVALIDMEDIATYPE, L"The recordings were encoded with different settings and can't be joined without re-encoding.");
+    }
+
+    auto [first, last] = FindKeyFrameRange(track, start, end);
+    for (auto i = first; i < last; i++)
+    {
+        auto const& sample = track.Samples[i];
+        auto continuesRun = i != first && plan.Runs.back().SourceOffset + plan.Runs.back().Size == sample.Offset;
+        if (!continuesRun)
+        {
+            auto& run = plan.Runs.emplace_back();
+            run.InputIndex = inputIndex;
+            run.SourceOffset = sample.Offset;
+        }
+        auto& run = plan.Runs.back();
+        run.Size += sample.Size;
+        run.SampleCount++;
+
+        plan.Samples.push_back(sample);
+        plan.MediaDataSize += sample.Size;
+        plan.Duration += sample.Duration;
+    }
+}
+
+Mp4CopyPlan CreateCopyPlan(Mp4StreamCopyOptions const& options)
+{
+    Mp4CopyPlan plan;
+    for (size_t inputIndex = 0; inputIndex < options.InputPaths.size(); inputIndex++)
+    {
+        auto isFirst = inputIndex == 0;
+        auto isLast = inputIndex + 1 == options.InputPaths.size();
+        AddToCopyPlan(
+            plan,
+            ReadMp4VideoTrack(options.InputPaths[inputIndex]),
+            inputIndex,
+            isFirst ? options.Start : std::nullopt,
+            isLast ? options.End : std::nullopt);
+    }
+    CheckMp4(!plan.Samples.empty());
+    return plan;
+}
+
+// Builds the moov box for the plan, with chunk offsets starting at the
+// given position. Offsets are always 64-bit so the size of the box doesn't
+// depend on where it ends up.
+std::vector<uint8_t> CreateMovieBox(Mp4CopyPlan const& plan, uint64_t mediaDataOffset)
+{
+    Mp4BoxWriter writer;
+    auto movie = writer.BeginBox(MakeBoxType("moov"));
+    {
+        auto movieHeader = writer.BeginFullBox(MakeBoxType("mvhd"), 1, 0);
+        writer.Write64(0); // creation time
+        writer.Write64(0); // modification time
+        writer.Write32(plan.Timescale);
+        writer.Write64(plan.Duration);
+        writer.Write32(0x00010000); // rate
+        writer.Write16(0x0100); // volume
+        writer.WriteZeros(10);
+        writer.WriteUnityMatrix();
+        writer.WriteZeros(24);
+        writer.Write32(2); // next track id
+        writer.EndBox(movieHeader);
+    }
+
+    auto track = writer.BeginBox(MakeBoxType("trak"));
+    {
+        // Enabled and in the movie
+        auto trackHeader = writer.BeginFullBox(MakeBoxType("tkhd"), 1, 0x3);
+        writer.Write64(0);
+        writer.Write64(0);
+        writer.Write32(1); // track id
+        writer.Write32(0);
+        writer.Write64(plan.Duration);
+        writer.WriteZeros(8);
+        writer.Write16(0); // layer
+        writer.Write16(0); // alternate group
+        writer.Write16(0); // volume
+        writer.Write16(0);
+        writer.WriteUnityMatrix();
+        writer.Write32(plan.Width << 16);
+        writer.Write32(plan.Height << 16);
+        writer.EndBox(trackHeader);
+    }
+    {
+        // Presentation starts with the first sample, even if it's been
+        // delayed to make room for reordered frames
+        auto edits = writer.BeginBox(MakeBoxType("edts"));
+        auto editList = writer.BeginFullBox(MakeBoxType("elst"), 1, 0);
+        writer.Write32(1);
+        writer.Write64(plan.Duration);
+        writer.Write64(static_cast<uint64_t>(std::max(plan.Samples.front().CompositionOffset, 0)));
+        writer.Write16(1); // rate
+        writer.Write16(0);
+        writer.EndBox(editList);
+        writer.EndBox(edits);
+    }
+
+    auto media = writer.BeginBox(MakeBoxType("mdia"));
+    {
+        auto mediaHeader = writer.BeginFullBox(MakeBoxType("mdhd"), 1, 0);
+        writer.Write64(0);
+        writer.Write64(0);
+        writer.Write32(plan.Timescale);
+        writer.Write64(plan.Duration);
+        writer.Write16(0x55c4); // 'und'
+        writer.Write16(0);
+        writer.EndBox(mediaHeader);
+    }
+    {
+        auto handler = writer.BeginFullBox(MakeBoxType("hdlr"), 0, 0);
+        writer.Write32(0);
+        writer.Write32(MakeBoxType("vide"));
+        writer.WriteZeros(12);
+        std::string_view name = "VideoHandler";
+        writer.WriteBytes(reinterpret_cast<uint8_t const*>(name.data()), name.size());
+        writer.Write8(0);
+        writer.EndBox(handler);
+    }
+
+    auto mediaInformation = writer.BeginBox(MakeBoxType("minf"));
+    {
+        auto videoHeader = writer.BeginFullBox(MakeBoxType("vmhd"), 0, 0x1);
+        writer.WriteZeros(8); // graphics mode and color
+        writer.EndBox(videoHeader);
+    }
+    {
+        // The media data is in this file
+        auto dataInformation = writer.BeginBox(MakeBoxType("dinf"));
+        auto dataReference = writer.BeginFullBox(MakeBoxType("dref"), 0, 0);
+        writer.Write32(1);
+        auto url = writer.BeginFullBox(MakeBoxType("url "), 0, 0x1);
+        writer.EndBox(url);
+        writer.EndBox(dataReference);
+        writer.EndBox(dataInformation);
+    }
+
+    auto sampleTable = writer.BeginBox(MakeBoxType("stbl"));
+    writer.WriteBytes(plan.SampleDescription.data(), plan.SampleDescription.size());
+
+    // Run length encoded tables hold (count, value) pairs
+    auto writeRuns = [&writer](uint32_t type, uint8_t version, size_t count, auto&& getValue)
+    {
+        auto box = writer.BeginFullBox(type, version, 0);
+        auto entryCountPosition = writer.Data().size();
+        writer.Write32(0);
+        uint32_t entryCount = 0;
+        for (size_t i = 0; i < count;)
+        {
+            auto value = getValue(i);
+            uint32_t runLength = 0;
+            for (; i < count && getValue(i) == value; i++)
+            {
+                runLength++;
+            }
+            writer.Write32(runLength);
+            writer.Write32(static_cast<uint32_t>(value));
+            entryCount++;
+        }
+        writer.Patch32(entryCountPosition, entryCount);
+        writer.EndBox(box);
+    };
+
+    writeRuns(MakeBoxType("stts"), 0, plan.Samples.size(), [&](size_t i) { return plan.Samples[i].Duration; });
+
+    auto hasCompositionOffsets = std::any_of(plan.Samples.begin(), plan.Samples.end(), [](auto const& sample) { return sample.CompositionOffset != 0; });
+    if (hasCompositionOffsets)
+    {
+        auto hasNegativeOffsets = std::any_of(plan.Samples.begin(), plan.Samples.end(), [](auto const& sample) { return sample.CompositionOffset < 0; });
+        writeRuns(MakeBoxType("ctts"), hasNegativeOffsets ? 1 : 0, plan.Samples.size(), [&](size_t i) { return plan.Samples[i].CompositionOffset; });
+    }
+
+    auto keyFrameCount = std::count_if(plan.Samples.begin(), plan.Samples.end(), [](auto const& sample) { return sample.IsKeyFrame; });
+    if (static_cast<size_t>(keyFrameCount) != plan.Samples.size())
+    {
+        auto syncSamples = writer.BeginFullBox(MakeBoxType("stss"), 0, 0);
+        writer.Write32(static_cast<uint32_t>(keyFrameCount));
+        for (size_t i = 0; i < plan.Samples.size(); i++)
+        {
+            if (plan.Samples[i].IsKeyFrame)
+            {
+                writer.Write32(static_cast<uint32_t>(i + 1));
+            }
+        }
+        writer.EndBox(syncSamples);
+    }
+
+    {
+        auto sizes = writer.BeginFullBox(MakeBoxType("stsz"), 0, 0);
+        writer.Write32(0);
+        writer.Write32(static_cast<uint32_t>(plan.Samples.size()));
+        for (auto&& sample : plan.Samples)
+        {
+            writer.Write32(sample.Size);
+        }
+        writer.EndBox(sizes);
+    }
+
+    {
+        // Each run is one chunk, consecutive chunks with the same number of
+        // samples share an entry
+        auto chunks = writer.BeginFullBox(MakeBoxType("stsc"), 0, 0);
+        std::vector<std::pair<uint32_t, uint32_t>> entries;
+        for (size_t i = 0; i < plan.Runs.size(); i++)
+        {
+            if (entries.empty() || entries.back().second != plan.Runs[i].SampleCount)
+            {
+                entries.emplace_back(static_cast<uint32_t>(i + 1), plan.Runs[i].SampleCount);
+            }
+        }
+        writer.Write32(static_cast<uint32_t>(entries.size()));
+        for (auto&& [firstChunk, samplesPerChunk] : entries)
+        {
+            writer.Write32(firstChunk);
+            writer.Write32(samplesPerChunk);
+            writer.Write32(1); // sample description index
+        }
+        writer.EndBox(chunks);
+    }
+
+    {
+        auto chunkOffsets = writer.BeginFullBox(MakeBoxType("co64"), 0, 0);
+        writer.Write32(static_cast<uint32_t>(plan.Runs.size()));
+        auto offset = mediaDataOffset;
+        for (auto&& run : plan.Runs)
+        {
+            writer.Write64(offset);
+            offset += run.Size;
+        }
+        writer.EndBox(chunkOffsets);
+    }
+
+    writer.EndBox(sampleTable);
+    writer.EndBox(mediaInformation);
+    writer.EndBox(media);
+    writer.EndBox(track);
+    writer.EndBox(movie);
+    return writer.Data();
+}
+
+std::vector<uint8_t> CreateFileTypeBox()
+{
+    Mp4BoxWriter writer;
+    auto fileType = writer.BeginBox(MakeBoxType("ftyp"));
+    writer.Write32(MakeBoxType("isom"));
+    writer.Write32(0x200);
+    for (auto&& brand : { MakeBoxType("isom"), MakeBoxType("iso2"), MakeBoxType("avc1"), MakeBoxType("mp41") })
+    {
+        writer.Write32(brand);
+    }
+    writer.EndBox(fileType);
+    WINRT_ASSERT(writer.Data().size() == FileTypeBoxSize);
+    return writer.Data();
+}
+
+Mp4StreamCopyMetrics CopyMp4Streams(Mp4StreamCopyOptions const& options)
+{
+    if (options.InputPaths.empty() || options.OutputPath.empty())
+    {
+        throw winrt::hresult_invalid_argument(L"An input and an output are required.");
+    }
+    if (options.Start.has_value() && options.End.has_value() && options.InputPaths.size() == 1 && options.End.value() <= options.Start.value())
+    {
+        throw winrt::hresult_invalid_argument(L"The end has to come after the start.");
+    }
+
+    auto plan = CreateCopyPlan(options);
+
+    // The movie box goes before the media data so players can start
+    // without seeking to the end of the file. Its size doesn't depend on the
+    // offsets, so it can be built once to find out where the data goes.
+    auto movieSize = CreateMovieBox(plan, 0).size();
+    auto mediaDataOffset = FileTypeBoxSize + movieSize + MediaDataHeaderSize;
+    auto movie = CreateMovieBox(plan, mediaDataOffset);
+    WINRT_ASSERT(movie.size() == movieSize);
+
+    std::vector<wil::unique_hfile> inputs;
+    for (auto&& path : options.InputPaths)
+    {
+        wil::unique_hfile input(CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr));
+        winrt::check_bool(static_cast<bool>(input));
+        inputs.push_back(std::move(input));
+    }
+
+    // Written under another name until it's complete, so a failed copy
+    // neither leaves a truncated file at the output path nor replaces
+    // what was there
+    auto partialPath = options.OutputPath + L".partial";
+    auto removePartial = wil::scope_exit([&]() { DeleteFileW(partialPath.c_str()); });
+    {
+        Mp4OutputFile output(partialPath);
+        output.Reserve(mediaDataOffset + plan.MediaDataSize);
+        auto fileType = CreateFileTypeBox();
+        output.Write(fileType.data(), fileType.size());
+        output.Write(movie.data(), movie.size());
+
+        Mp4BoxWriter mediaDataHeader;
+        mediaDataHeader.Write32(1);
+        mediaDataHeader.Write32(MakeBoxType("mdat"));
+        mediaDataHeader.Write64(MediaDataHeaderSize + plan.MediaDataSize);
+        output.Write(mediaDataHeader.Data().data(), mediaDataHeader.Data().size());
+        WINRT_ASSERT(output.Position() == mediaDataOffset);
+
+        for (auto&& run : plan.Runs)
+        {
+            output.CopyFrom(inputs[run.InputIndex].get(), run.SourceOffset, run.Size);
+        }
+        output.Flush();
+    }
+    // Also lets an input be replaced by its own trim
+    inputs.clear();
+    winrt::check_bool(MoveFileExW(partialPath.c_str(), options.OutputPath.c_str(), MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH));
+    removePartial.release();
+
+    Mp4StreamCopyMetrics metrics;
+    metrics.SamplesCopied = static_cast<uint32_t>(plan.Samples.size());
+    metrics.BytesCopied = plan.MediaDataSize;
+    metrics.Duration = Mp4TimeToTimeSpan(static_cast<int64_t>(plan.Duration), plan.Timescale);
+    return metrics;
+}
+
+winrt::TimeSpan ParseSeconds(std::wstring const& value)
+{
+    auto seconds = std::max(_wtof(value.c_str()), 0.0);
+    return std::chrono::duration_cast<winrt::TimeSpan>(std::chrono::duration<double>(seconds));
+}
+
+std::optional<Mp4StreamCopyOptions> TryParseMp4StreamCopyOptions(std::vector<std::wstring> const& args)
+{
+    std::optional<Mp4StreamCopyOptions> options;
+    for (size_t i = 0; i < args.size(); i++)
+    {
+        auto hasValue = i + 1 < args.size();
+        if ((args[i] == L"--trim" || args[i] == L"--concat") && hasValue)
+        {
+            options = Mp4StreamCopyOptions{};
+            // Everything up to the next option is an input
+            auto isConcat = args[i] == L"--concat";
+            for (i++; i < args.size() && args[i].rfind(L"--", 0) != 0; i++)
+            {
+                options->InputPaths.push_back(args[i]);
+                if (!isConcat)
+                {
+                    break;
+                }
+            }
+            break;
+        }
+    }
+    if (!options.has_value())
+    {
+        return std::nullopt;
+    }
+
+    for (size_t i = 0; i < args.size(); i++)
+    {
+        auto hasValue = i + 1 < args.size();
+        if (args[i] == L"--output" && hasValue)
+        {
+            options->OutputPath = args[++i];
+        }
+        else if (args[i] == L"--start" && hasValue)
+        {
+            options->Start = ParseSeconds(args[++i]);
+        }
+        else if (args[i] == L"--end" && hasValue)
+        {
+            options->End = ParseSeconds(args[++i]);
+        }
+    }
+    return options;
+}
+
+void CheckMp4StreamCopy(bool condition, std::wstring const& message)
+{
+    if (!condition)
+    {
+        throw winrt::hresult_error(E_UNEXPECTED, L"Stream copy check failed: " + message);
+    }
+}
+
+// Three GOPs of five frames, reordered like the encoder's B-frames, with a
+// gap in the media data halfway through so the samples span two runs.
+Mp4VideoTrack CreateTestTrack()
+{
+    Mp4VideoTrack track;
+    track.Timescale = 90000;
+    track.Width = 1280;
+    track.Height = 720;
+    Mp4BoxWriter sampleDescription;
+    auto box = sampleDescription.BeginFullBox(MakeBoxType("stsd"), 0, 0);
+    sampleDescription.Write32(0);
+    sampleDescription.EndBox(box);
+    track.SampleDescription = sampleDescription.Data();
+
+    uint64_t offset = 48;
+    for (uint32_t i = 0; i < 15; i++)
+    {
+        auto& sample = track.Samples.emplace_back();
+        sample.Offset = offset;
+        sample.Size = 1000 + i * 10;
+        sample.DecodeTime = i * 3000;
+        sample.Duration = 3000;
+        // Presented in the order 0, 2, 1, 4, 3 within each GOP
+        auto position = i % 5;
+        sample.CompositionOffset = position == 0 ? 3000 : (position % 2 == 1 ? 6000 : 0);
+        sample.IsKeyFrame = position == 0;
+        offset += sample.Size + (i == 7 ? 100 : 0);
+    }
+    return track;
+}
+
+void VerifyMp4StreamCopy()
+{
+    auto track = CreateTestTrack();
+    // Where each GOP starts, relative to the first frame presented
+    auto secondGop = Mp4TimeToTimeSpan(15000, track.Timescale);
+    auto thirdGop = Mp4TimeToTimeSpan(30000, track.Timescale);
+    auto tick = winrt::TimeSpan{ 1 };
+
+    using Range = std::pair<size_t, size_t>;
+    CheckMp4StreamCopy(FindKeyFrameRange(track, std::nullopt, std::nullopt) == Range{ 0, 15 }, L"keyframe range of the whole track");
+    CheckMp4StreamCopy(FindKeyFrameRange(track, secondGop, thirdGop) == Range{ 5, 10 }, L"keyframe range on keyframes");
+    CheckMp4StreamCopy(FindKeyFrameRange(track, secondGop + tick, thirdGop - tick) == Range{ 5, 10 }, L"keyframe range within a GOP");
+    CheckMp4StreamCopy(FindKeyFrameRange(track, secondGop - tick, thirdGop + tick) == Range{ 0, 15 }, L"keyframe range across GOPs");
+
+    // The first input loses its first GOP and the second its last
+    Mp4CopyPlan plan;
+    AddToCopyPlan(plan, track, 0, secondGop + tick, std::nullopt);
+    AddToCopyPlan(plan, track, 1, std::nullopt, thirdGop - tick);
+    CheckMp4StreamCopy(plan.Samples.size() == 20 && plan.Runs.size() == 4, L"copy plan");
+
+    const uint64_t mediaDataOffset = 1234;
+    auto movie = CreateMovieBox(plan, mediaDataOffset);
+    auto parsed = ParseMp4VideoTrack(movie.data(), movie.size());
+    CheckMp4StreamCopy(
+        parsed.Timescale == track.Timescale && parsed.Width == track.Width && parsed.Height == track.Height &&
+        parsed.SampleDescription == track.SampleDescription && parsed.Samples.size() == plan.Samples.size(),
+        L"movie box track");
+
+    // The output's samples are back to back and its decode times start at zero
+    auto offset = mediaDataOffset;
+    uint64_t decodeTime = 0;
+    for (size_t i = 0; i < plan.Samples.size(); i++)
+    {
+        auto const& expected = plan.Samples[i];
+        auto const& actual = parsed.Samples[i];
+        CheckMp4StreamCopy(
+            actual.Offset == offset && actual.Size == expected.Size && actual.DecodeTime == decodeTime &&
+            actual.Duration == expected.Duration && actual.CompositionOffset == expected.CompositionOffset &&
+            actual.IsKeyFrame == expected.IsKeyFrame,
+            L"movie box sample " + std::to_wstring(i));
+        offset += expected.Size;
+        decodeTime += expected.Duration;
+    }
+}
+
+int RunMp4StreamCopy(Mp4StreamCopyOptions const& options)
+{
+    try
+    {
+        VerifyMp4StreamCopy();
+
+        auto start = std::chrono::steady_clock::now();
+        auto metrics = CopyMp4Streams(options);
+        auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start);
+
+        auto seconds = std::max(std::chrono::duration<double>(elapsed).count(), 0.001);
+        std::wstringstream report;
+        report << options.OutputPath << L": " << metrics.SamplesCopied << L" samples, "
+            << std::chrono::duration_cast<std::chrono::milliseconds>(metrics.Duration).count() << L"ms, "
+            << metrics.BytesCopied << L" bytes copied in " << elapsed.count() << L"ms ("
+            << metrics.BytesCopied / seconds / (1024 * 1024) << L" MB/s)" << std::endl;
+        WriteReport(report.str());
+        return 0;
+    }
+    catch (winrt::hresult_error const& error)
+    {
+        std::wstringstream report;
+        report << L"Stream copy failed: " << error.message().c_str() << std::endl;
+        WriteReport(report.str());
+        return 1;
+    }
+}
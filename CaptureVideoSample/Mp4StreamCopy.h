@@ -0,0 +1,37 @@
+#pragma once
+
+struct Mp4StreamCopyOptions
+{
+    // Joined in order. They must all have been recorded with the same
+    // encoder settings.
+    std::vector<std::wstring> InputPaths;
+    std::wstring OutputPath;
+    // Relative to the start of the first input. The cut is moved back to
+    // the keyframe at or before it.
+    std::optional<winrt::Windows::Foundation::TimeSpan> Start;
+    // Relative to the start of the last input. The cut is moved forward to
+    // the keyframe at or after it.
+    std::optional<winrt::Windows::Foundation::TimeSpan> End;
+};
+
+// Looks for --trim <input> or --concat <input> <input>..., followed by
+// --output <path> [--start <seconds>] [--end <seconds>].
+std::optional<Mp4StreamCopyOptions> TryParseMp4StreamCopyOptions(std::vector<std::wstring> const& args);
+
+// Trims and joins recordings without re-encoding them. The media data is
+// copied as is and only the sample tables are rewritten, so this runs at
+// the speed of the disk. Returns the process exit code.
+int RunMp4StreamCopy(Mp4StreamCopyOptions const& options);
+
+struct Mp4StreamCopyMetrics
+{
+    uint32_t SamplesCopied = 0;
+    uint64_t BytesCopied = 0;
+    winrt::Windows::Foundation::TimeSpan Duration = {};
+};
+
+Mp4StreamCopyMetrics CopyMp4Streams(Mp4StreamCopyOptions const& options);
+
+// Checks that a trim keeps whole GOPs, and that the sample tables written
+// for a copy read back as the samples that were planned. Throws if not.
+void VerifyMp4StreamCopy();
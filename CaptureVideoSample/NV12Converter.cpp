@@ -0,0 +1,84 @@
+#include "pch.h"
+#include "NV12Converter.h"
+
+namespace winrt
+{
+    using namespace Windows::Graphics;
+}
+
+NV12Converter::NV12Converter(
+    winrt::com_ptr<ID3D11Device> const& d3dDevice,
+    winrt::com_ptr<ID3D11DeviceContext> const& d3dContext,
+    winrt::SizeInt32 const& size,
+    uint32_t frameRate)
+{
+    m_d3dDevice = d3dDevice;
+    m_videoDevice = d3dDevice.as<ID3D11VideoDevice>();
+    m_videoContext = d3dContext.as<ID3D11VideoContext>();
+    m_size = size;
+
+    D3D11_VIDEO_PROCESSOR_CONTENT_DESC contentDesc = {};
+    contentDesc.InputFrameFormat = D3D11_VIDEO_FRAME_FORMAT_PROGRESSIVE;
+    contentDesc.InputFrameRate = { frameRate, 1 };
+    contentDesc.InputWidth = static_cast<uint32_t>(size.Width);
+    contentDesc.InputHeight = static_cast<uint32_t>(size.Height);
+    contentDesc.OutputFrameRate = { frameRate, 1 };
+    contentDesc.OutputWidth = static_cast<uint32_t>(size.Width);
+    contentDesc.OutputHeight = static_cast<uint32_t>(size.Height);
+    contentDesc.Usage = D3D11_VIDEO_USAGE_PLAYBACK_NORMAL;
+    winrt::check_hresult(m_videoDevice->CreateVideoProcessorEnumerator(&contentDesc, m_videoEnumerator.put()));
+    winrt::check_hresult(m_videoDevice->CreateVideoProcessor(m_videoEnumerator.get(), 0, m_videoProcessor.put()));
+
+    // Full range sRGB in, limited range BT.709 out
+    D3D11_VIDEO_PROCESSOR_COLOR_SPACE inputColorSpace = {};
+    inputColorSpace.RGB_Range = 0;
+    m_videoContext->VideoProcessorSetStreamColorSpace(m_videoProcessor.get(), 0, &inputColorSpace);
+    D3D11_VIDEO_PROCESSOR_COLOR_SPACE outputColorSpace = {};
+    outputColorSpace.YCbCr_Matrix = 1;
+    outputColorSpace.Nominal_Range = D3D11_VIDEO_PROCESSOR_NOMINAL_RANGE_16_235;
+    m_videoContext->VideoProcessorSetOutputColorSpace(m_videoProcessor.get(), &outputColorSpace);
+    m_videoContext->VideoProcessorSetStreamAutoProcessingMode(m_videoProcessor.get(), 0, false);
+}
+
+winrt::com_ptr<ID3D11Texture2D> NV12Converter::CreateOutputTexture()
+{
+    D3D11_TEXTURE2D_DESC desc = {};
+    desc.Width = static_cast<uint32_t>(m_size.Width);
+    desc.Height = static_cast<uint32_t>(m_size.Height);
+    desc.MipLevels = 1;
+    desc.ArraySize = 1;
+    desc.Format = DXGI_FORMAT_NV12;
+    desc.SampleDesc.Count = 1;
+    desc.Usage = D3D11_USAGE_DEFAULT;
+    desc.BindFlags = D3D11_BIND_RENDER_TARGET;
+    winrt::com_ptr<ID3D11Texture2D> texture;
+    winrt::check_hresult(m_d3dDevice->CreateTexture2D(&desc, nullptr, texture.put()));
+    return texture;
+}
+
+winrt::com_ptr<ID3D11VideoProcessorOutputView> NV12Converter::CreateOutputView(ID3D11Texture2D* output)
+{
+    D3D11_VIDEO_PROCESSOR_OUTPUT_VIEW_DESC outputViewDesc = {};
+    outputViewDesc.ViewDimension = D3D11_VPOV_DIMENSION_TEXTURE2D;
+    winrt::com_ptr<ID3D11VideoProcessorOutputView> outputView;
+    winrt::check_hresult(m_videoDevice->CreateVideoProcessorOutputView(output, m_videoEnumerator.get(), &outputViewDesc, outputView.put()));
+    return outputView;
+}
+
+void NV12Converter::Convert(ID3D11Texture2D* input, ID3D11VideoProcessorOutputView* output)
+{
+    // We're almost always handed the same input texture
+    if (m_lastInputTexture.get() != input)
+    {
+        D3D11_VIDEO_PROCESSOR_INPUT_VIEW_DESC inputViewDesc = {};
+        inputViewDesc.ViewDimension = D3D11_VPIV_DIMENSION_TEXTURE2D;
+        m_lastInputView = nullptr;
+        winrt::check_hresult(m_videoDevice->CreateVideoProcessorInputView(input, m_videoEnumerator.get(), &inputViewDesc, m_lastInputView.put()));
+        m_lastInputTexture.copy_from(input);
+    }
+
+    D3D11_VIDEO_PROCESSOR_STREAM stream = {};
+    stream.Enable = true;
+    stream.pInputSurface = m_lastInputView.get();
+    winrt::check_hresult(m_videoContext->VideoProcessorBlt(m_videoProcessor.get(), output, 0, 1, &stream));
+}
@@ -0,0 +1,28 @@
+#pragma once
+
+// Converts BGRA8 textures to NV12 with the D3D11 video processor, which is
+// the input format hardware encoders expect.
+class NV12Converter
+{
+public:
+    NV12Converter(
+        winrt::com_ptr<ID3D11Device> const& d3dDevice,
+        winrt::com_ptr<ID3D11DeviceContext> const& d3dContext,
+        winrt::Windows::Graphics::SizeInt32 const& size,
+        uint32_t frameRate);
+
+    winrt::com_ptr<ID3D11Texture2D> CreateOutputTexture();
+    // Output views are meant to be created once per texture and kept around.
+    winrt::com_ptr<ID3D11VideoProcessorOutputView> CreateOutputView(ID3D11Texture2D* output);
+    void Convert(ID3D11Texture2D* input, ID3D11VideoProcessorOutputView* output);
+
+private:
+    winrt::com_ptr<ID3D11Device> m_d3dDevice;
+    winrt::com_ptr<ID3D11VideoDevice> m_videoDevice;
+    winrt::com_ptr<ID3D11VideoContext> m_videoContext;
+    winrt::com_ptr<ID3D11VideoProcessorEnumerator> m_videoEnumerator;
+    winrt::com_ptr<ID3D11VideoProcessor> m_videoProcessor;
+    winrt::com_ptr<ID3D11Texture2D> m_lastInputTexture;
+    winrt::com_ptr<ID3D11VideoProcessorInputView> m_lastInputView;
+    winrt::Windows::Graphics::SizeInt32 m_size = {};
+};
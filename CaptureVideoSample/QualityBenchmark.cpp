@@ -0,0 +1,411 @@
+#include "pch.h"
+#include "QualityBenchmark.h"
+#include "QualityMetrics.h"
+#include "SyntheticFrameSource.h"
+#include "TraceReplay.h"
+#include "VideoRecordingSession.h"
+
+namespace winrt
+{
+    using namespace Windows::Foundation;
+    using namespace Windows::Graphics;
+    using namespace Windows::Graphics::DirectX;
+    using namespace Windows::Graphics::DirectX::Direct3D11;
+    using namespace Windows::Storage;
+    using namespace Windows::Storage::Streams;
+}
+
+namespace util
+{
+    using namespace robmikh::common::uwp;
+}
+
+// Same as the presets in MainWindow
+const std::array<uint32_t, 4> BenchmarkBitRates = { 9000000, 18000000, 36000000, 72000000 };
+// Identical frames have an infinite PSNR, which would swamp the averages
+const double MaxPsnr = 100.0;
+
+struct BitRateResult
+{
+    uint32_t BitRate = 0;
+    double ActualBitRate = 0.0;
+    uint64_t FramesCompared = 0;
+    // Encoded frames we couldn't find in the decoded output, or the other way around
+    uint64_t FramesUnmatched = 0;
+    double AveragePsnr = 0.0;
+    double MinPsnr = MaxPsnr;
+    double AverageSsim = 0.0;
+    double MinSsim = 1.0;
+    // Debug builds only, see AllocationCounter.h
+    uint64_t FramesWithAllocations = 0;
+    uint64_t LastAllocatingFrame = 0;
+    // Time spent in the metric kernels alone, decoding isn't included
+    uint64_t PixelsCompared = 0;
+    std::chrono::steady_clock::duration PsnrTime = {};
+    std::chrono::steady_clock::duration SsimTime = {};
+};
+
+// The luma planes the encoder was given, kept in a temporary file since
+// a recording's worth of them doesn't fit in memory.
+class ReferenceFrameStore
+{
+public:
+    ReferenceFrameStore(std::wstring const& path, uint32_t width, uint32_t height)
+    {
+        m_width = width;
+        m_height = height;
+        m_buffer.resize(static_cast<size_t>(width) * height);
+        m_file.reset(CreateFileW(
+            path.c_str(),
+            GENERIC_READ | GENERIC_WRITE,
+            0,
+            nullptr,
+            CREATE_ALWAYS,
+            FILE_ATTRIBUTE_TEMPORARY | FILE_FLAG_DELETE_ON_CLOSE | FILE_FLAG_SEQUENTIAL_SCAN,
+            nullptr));
+        winrt::check_bool(static_cast<bool>(m_file));
+    }
+
+    void Write(ReadbackFrame const& frame)
+    {
+        auto timestamp = frame.Timestamp.count();
+        WriteBytes(&timestamp, sizeof(timestamp));
+        for (uint32_t y = 0; y < m_height; y++)
+        {
+            WriteBytes(frame.Data + static_cast<size_t>(y) * frame.RowPitch, m_width);
+        }
+    }
+
+    // Call once every frame has been written
+    void Rewind()
+    {
+        LARGE_INTEGER start = {};
+        winrt::check_bool(SetFilePointerEx(m_file.get(), start, nullptr, FILE_BEGIN));
+    }
+
+    // The plane stays valid until the next call
+    bool TryReadNext(winrt::TimeSpan& timestamp, QualityPlane& plane)
+    {
+        int64_t ticks = 0;
+        DWORD read = 0;
+        winrt::check_bool(ReadFile(m_file.get(), &ticks, sizeof(ticks), &read, nullptr));
+        if (read != sizeof(ticks))
+        {
+            return false;
+        }
+        winrt::check_bool(ReadFile(m_file.get(), m_buffer.data(), static_cast<DWORD>(m_buffer.size()), &read, nullptr));
+        if (read != m_buffer.size())
+        {
+            return false;
+        }
+
+        timestamp = winrt::TimeSpan{ ticks };
+        plane = { m_buffer.data(), m_width, m_width, m_height };
+        return true;
+    }
+
+private:
+    void WriteBytes(void const* data, size_t size)
+    {
+        DWORD written = 0;
+        winrt::check_bool(WriteFile(m_file.get(), data, static_cast<DWORD>(size), &written, nullptr));
+    }
+
+private:
+    wil::unique_hfile m_file;
+    uint32_t m_width = 0;
+    uint32_t m_height = 0;
+    std::vector<uint8_t> m_buffer;
+};
+
+std::optional<QualityBenchmarkOptions> TryParseQualityBenchmarkOptions(std::vector<std::wstring> const& args)
+{
+    std::optional<QualityBenchmarkOptions> options;
+    for (size_t i = 0; i < args.size(); i++)
+    {
+        if (args[i] == L"--quality-benchmark")
+        {
+            options = QualityBenchmarkOptions{};
+            break;
+        }
+    }
+    if (!options.has_value())
+    {
+        return std::nullopt;
+    }
+
+    for (size_t i = 0; i < args.size(); i++)
+    {
+        auto hasValue = i + 1 < args.size();
+        if (args[i] == L"--trace" && hasValue)
+        {
+            options->TracePath = args[++i];
+        }
+        else if (args[i] == L"--output" && hasValue)
+        {
+            options->OutputPath = args[++i];
+        }
+        else if (args[i] == L"--frames" && hasValue)
+        {
+            options->FrameCount = static_cast<uint32_t>(std::max(_wtoi(args[++i].c_str()), 1));
+        }
+        else if (args[i] == L"--fps" && hasValue)
+        {
+            options->FrameRate = static_cast<uint32_t>(std::max(_wtoi(args[++i].c_str()), 1));
+        }
+    }
+
+    if (options->OutputPath.empty())
+    {
+        // Only winrt errors are caught, so nothing here may throw. If the
+        // folder can't be created, opening the first recording will fail.
+        std::error_code error;
+        auto folder = std::filesystem::temp_directory_path(error) / L"CaptureVideoSample";
+        std::filesystem::create_directories(folder, error);
+        options->OutputPath = (folder / L"quality.csv").wstring();
+    }
+    return options;
+}
+
+// Decodes the recording to NV12 and compares each frame's luma with the
+// reference frame that has the same timestamp.
+void CompareRecording(
+    std::wstring const& path,
+    ReferenceFrameStore& references,
+    winrt::TimeSpan const& frameDuration,
+    BitRateResult& result,
+    std::ofstream& frameResults)
+{
+    winrt::com_ptr<IMFSourceReader> reader;
+    winrt::check_hresult(MFCreateSourceReaderFromURL(path.c_str(), nullptr, reader.put()));
+    winrt::check_hresult(reader->SetStreamSelection(static_cast<DWORD>(MF_SOURCE_READER_ALL_STREAMS), false));
+    winrt::check_hresult(reader->SetStreamSelection(static_cast<DWORD>(MF_SOURCE_READER_FIRST_VIDEO_STREAM), true));
+
+    // NV12 is what the decoder produces, so no conversion is involved
+    winrt::com_ptr<IMFMediaType> outputType;
+    winrt::check_hresult(MFCreateMediaType(outputType.put()));
+    winrt::check_hresult(outputType->SetGUID(MF_MT_MAJOR_TYPE, MFMediaType_Video));
+    winrt::check_hresult(outputType->SetGUID(MF_MT_SUBTYPE, MFVideoFormat_NV12));
+    winrt::check_hresult(reader->SetCurrentMediaType(static_cast<DWORD>(MF_SOURCE_READER_FIRST_VIDEO_STREAM), nullptr, outputType.get()));
+
+    // The container may round timestamps a little
+    auto tolerance = frameDuration / 2;
+    winrt::TimeSpan referenceTime = {};
+    QualityPlane reference = {};
+    auto hasReference = references.TryReadNext(referenceTime, reference);
+    double totalPsnr = 0.0;
+    double totalSsim = 0.0;
+
+    while (true)
+    {
+        DWORD flags = 0;
+        LONGLONG sampleTime = 0;
+        winrt::com_ptr<IMFSample> sample;
+        winrt::check_hresult(reader->ReadSample(static_cast<DWORD>(MF_SOURCE_READER_FIRST_VIDEO_STREAM), 0, nullptr, &flags, &sampleTime, sample.put()));
+        if (flags & MF_SOURCE_READERF_ENDOFSTREAM)
+        {
+            break;
+        }
+        if (!sample)
+        {
+            continue;
+        }
+
+        auto decodedTime = winrt::TimeSpan{ sampleTime };
+        while (hasReference && referenceTime + tolerance < decodedTime)
+        {
+            result.FramesUnmatched++;
+            hasReference = references.TryReadNext(referenceTime, reference);
+        }
+        if (!hasReference || referenceTime - tolerance > decodedTime)
+        {
+            result.FramesUnmatched++;
+            continue;
+        }
+
+        winrt::com_ptr<IMFMediaBuffer> buffer;
+        winrt::check_hresult(sample->GetBufferByIndex(0, buffer.put()));
+        auto buffer2d = buffer.as<IMF2DBuffer>();
+        BYTE* data = nullptr;
+        LONG pitch = 0;
+        winrt::check_hresult(buffer2d->Lock2D(&data, &pitch));
+        auto unlock = wil::scope_exit([&]() { buffer2d->Unlock2D(); });
+        QualityPlane decoded = { data, static_cast<uint32_t>(pitch), reference.Width, reference.Height };
+
+        auto start = std::chrono::steady_clock::now();
+        auto psnr = std::min(ComputePsnr(reference, decoded), MaxPsnr);
+        auto psnrEnd = std::chrono::steady_clock::now();
+        auto ssim = ComputeSsim(reference, decoded);
+        result.PsnrTime += psnrEnd - start;
+        result.SsimTime += std::chrono::steady_clock::now() - psnrEnd;
+        result.PixelsCompared += static_cast<uint64_t>(reference.Width) * reference.Height;
+        totalPsnr += psnr;
+        totalSsim += ssim;
+        result.MinPsnr = std::min(result.MinPsnr, psnr);
+        result.MinSsim = std::min(result.MinSsim, ssim);
+        frameResults << result.BitRate << "," << result.FramesCompared << ","
+            << std::chrono::duration_cast<std::chrono::milliseconds>(decodedTime).count() << ","
+            << psnr << "," << ssim << "\n";
+        result.FramesCompared++;
+
+        hasReference = references.TryReadNext(referenceTime, reference);
+    }
+
+    while (hasReference)
+    {
+        result.FramesUnmatched++;
+        hasReference = references.TryReadNext(referenceTime, reference);
+    }
+
+    if (result.FramesCompared > 0)
+    {
+        result.AveragePsnr = totalPsnr / static_cast<double>(result.FramesCompared);
+        result.AverageSsim = totalSsim / static_cast<double>(result.FramesCompared);
+    }
+}
+
+BitRateResult RunBitRate(
+    winrt::com_ptr<ID3D11Device> const& d3dDevice,
+    winrt::IDirect3DDevice const& device,
+    QualityBenchmarkOptions const& options,
+    uint32_t bitRate,
+    std::ofstream& frameResults)
+{
+    BitRateResult result;
+    result.BitRate = bitRate;
+
+    std::shared_ptr<FrameSource> source;
+    auto resolution = options.Resolution;
+    auto pixelFormat = winrt::DirectXPixelFormat::B8G8R8A8UIntNormalized;
+    if (options.TracePath.empty())
+    {
+        source = std::make_shared<SyntheticFrameSource>(d3dDevice, resolution, options.FrameRate, options.FrameCount);
+    }
+    else
+    {
+        auto replaySource = std::make_shared<TraceReplayFrameSource>(d3dDevice, options.TracePath, ReplaySpeed::Fast);
+        resolution = replaySource->InitialSize();
+        pixelFormat = replaySource->PixelFormat();
+        source = replaySource;
+    }
+
+    auto outputPath = std::filesystem::path(options.OutputPath);
+    auto recordingPath = (outputPath.parent_path() / (outputPath.stem().wstring() + L"-" + std::to_wstring(bitRate / 1000000) + L"Mbps.mp4")).wstring();
+    auto stream = winrt::FileRandomAccessStream::OpenAsync(
+        recordingPath,
+        winrt::FileAccessMode::ReadWrite,
+        winrt::StorageOpenOptions::None,
+        winrt::FileOpenDisposition::CreateAlways).get();
+
+    auto session = VideoRecordingSession::CreateFromSource(
+        device,
+        source,
+        resolution,
+        bitRate,
+        options.FrameRate,
+        pixelFormat,
+        stream);
+
+    // The session may have rounded the resolution up to something the encoder accepts
+    std::unique_ptr<ReferenceFrameStore> references;
+    session->EnableEncoderInputReadback([&](ReadbackFrame const& frame)
+    {
+        if (!references)
+        {
+            references = std::make_unique<ReferenceFrameStore>(recordingPath + L".reference", frame.Width, frame.Height);
+        }
+        references->Write(frame);
+    });
+    session->StartAsync().get();
+    auto stopMetrics = session->StopMetrics();
+    auto copyMetrics = session->CopyMetrics();
+    result.FramesWithAllocations = copyMetrics.FramesWithAllocations;
+    result.LastAllocatingFrame = copyMetrics.LastAllocatingFrame;
+    session = nullptr;
+    stream.Close();
+
+    if (!references || stopMetrics.FramesEncoded == 0)
+    {
+        throw winrt::hresult_error(E_FAIL, L"Nothing was encoded.");
+    }
+
+    auto frameDuration = std::chrono::duration_cast<winrt::TimeSpan>(std::chrono::seconds(1)) / options.FrameRate;
+    auto seconds = std::chrono::duration<double>(frameDuration * stopMetrics.FramesEncoded).count();
+    std::error_code error;
+    auto fileSize = std::filesystem::file_size(recordingPath, error);
+    if (error)
+    {
+        throw winrt::hresult_error(HRESULT_FROM_WIN32(error.value()), L"Couldn't get the size of the recording.");
+    }
+    result.ActualBitRate = static_cast<double>(fileSize) * 8.0 / seconds;
+
+    references->Rewind();
+    CompareRecording(recordingPath, *references, frameDuration, result, frameResults);
+    return result;
+}
+
+int RunQualityBenchmark(QualityBenchmarkOptions const& options)
+{
+    try
+    {
+        VerifyQualityKernels();
+
+        auto d3dDevice = util::CreateD3DDevice();
+        auto device = CreateDirect3DDevice(d3dDevice.as<IDXGIDevice>().get());
+
+        std::ofstream frameResults(options.OutputPath, std::ios::trunc);
+        frameResults << "bitrate,frame,timestamp_ms,psnr_y,ssim_y\n";
+
+        std::vector<BitRateResult> results;
+        for (auto&& bitRate : BenchmarkBitRates)
+        {
+            results.push_back(RunBitRate(d3dDevice, device, options, bitRate, frameResults));
+        }
+
+        auto outputPath = std::filesystem::path(options.OutputPath);
+        auto curvePath = outputPath.parent_path() / (outputPath.stem().wstring() + L"-curve.csv");
+        std::ofstream curve(curvePath, std::ios::trunc);
+        curve << "bitrate,actual_bitrate,frames,unmatched,psnr_avg,psnr_min,ssim_avg,ssim_min\n";
+
+        std::wstringstream report;
+        report << (options.TracePath.empty() ? L"Generated frames" : options.TracePath) << L" at " << options.FrameRate << L"fps" << std::endl;
+        uint64_t pixelsCompared = 0;
+        std::chrono::steady_clock::duration psnrTime = {};
+        std::chrono::steady_clock::duration ssimTime = {};
+        for (auto&& result : results)
+        {
+            pixelsCompared += result.PixelsCompared;
+            psnrTime += result.PsnrTime;
+            ssimTime += result.SsimTime;
+            curve << result.BitRate << "," << result.ActualBitRate << "," << result.FramesCompared << "," << result.FramesUnmatched << ","
+                << result.AveragePsnr << "," << result.MinPsnr << "," << result.AverageSsim << "," << result.MinSsim << "\n";
+            report << L"  " << result.BitRate / 1000000 << L" Mbps (" << result.ActualBitRate / 1000000.0 << L" actual): "
+                << L"PSNR avg " << result.AveragePsnr << L"dB min " << result.MinPsnr << L"dB, "
+                << L"SSIM avg " << result.AverageSsim << L" min " << result.MinSsim << L", "
+                << result.FramesCompared << L" frames";
+            if (result.FramesUnmatched > 0)
+            {
+                report << L" (" << result.FramesUnmatched << L" unmatched)";
+            }
+            if (result.FramesWithAllocations > 0)
+            {
+                report << L", " << result.FramesWithAllocations << L" frames allocated, the last was frame " << result.LastAllocatingFrame;
+            }
+            report << std::endl;
+        }
+        auto megapixels = static_cast<double>(pixelsCompared) / 1000000.0;
+        report << L"  Kernels: PSNR " << megapixels / std::max(std::chrono::duration<double>(psnrTime).count(), 1e-9)
+            << L" Mpixels/s, SSIM " << megapixels / std::max(std::chrono::duration<double>(ssimTime).count(), 1e-9)
+            << L" Mpixels/s over " << megapixels << L" Mpixels" << std::endl;
+        report << L"  " << options.OutputPath << std::endl << L"  " << curvePath.wstring() << std::endl;
+        WriteReport(report.str());
+        return 0;
+    }
+    catch (winrt::hresult_error const& error)
+    {
+        std::wstringstream report;
+        report << L"Quality benchmark failed: " << error.message().c_str() << std::endl;
+        WriteReport(report.str());
+        return 1;
+    }
+}
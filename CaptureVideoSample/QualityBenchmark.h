@@ -0,0 +1,22 @@
+#pragma once
+
+struct QualityBenchmarkOptions
+{
+    // Frames come from this capture trace, or are generated if it's empty
+    std::wstring TracePath;
+    // Per-frame results. The rate-quality curve is written next to it.
+    std::wstring OutputPath;
+    // Only used for generated frames, traces are recorded at their own size
+    winrt::Windows::Graphics::SizeInt32 Resolution = { 1920, 1080 };
+    uint32_t FrameRate = 60;
+    // Only used for generated frames
+    uint32_t FrameCount = 600;
+};
+
+// Looks for --quality-benchmark [--trace <path>] [--output <path>] [--frames <count>] [--fps <rate>].
+std::optional<QualityBenchmarkOptions> TryParseQualityBenchmarkOptions(std::vector<std::wstring> const& args);
+
+// Records the same frames at each of the bit rate presets, decodes the
+// results and compares them with what the encoder was given, reporting
+// luma PSNR and SSIM. Returns the process exit code.
+int RunQualityBenchmark(QualityBenchmarkOptions const& options);
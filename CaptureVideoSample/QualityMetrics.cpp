@@ -0,0 +1,259 @@
+#include "pch.h"
+#include "QualityMetrics.h"
+#if defined(_M_X64) || defined(_M_IX86)
+#include <emmintrin.h>
+#define QUALITY_METRICS_SSE2
+#endif
+
+// Sums over one 8x8 window, everything SSIM needs
+struct WindowSums
+{
+    uint32_t SumA = 0;
+    uint32_t SumB = 0;
+    // Sum of a^2 + b^2
+    uint32_t SumSquares = 0;
+    uint32_t SumProducts = 0;
+};
+
+const uint32_t SsimWindowSize = 8;
+const uint32_t SsimWindowStep = 4;
+
+uint64_t SumSquaredDifferencesScalar(uint8_t const* a, uint8_t const* b, uint32_t count)
+{
+    uint64_t sum = 0;
+    for (uint32_t i = 0; i < count; i++)
+    {
+        auto difference = static_cast<int32_t>(a[i]) - static_cast<int32_t>(b[i]);
+        sum += static_cast<uint64_t>(difference * difference);
+    }
+    return sum;
+}
+
+WindowSums ComputeWindowSumsScalar(uint8_t const* a, uint32_t aPitch, uint8_t const* b, uint32_t bPitch)
+{
+    WindowSums sums;
+    for (uint32_t y = 0; y < SsimWindowSize; y++)
+    {
+        for (uint32_t x = 0; x < SsimWindowSize; x++)
+        {
+            uint32_t valueA = a[y * aPitch + x];
+            uint32_t valueB = b[y * bPitch + x];
+            sums.SumA += valueA;
+            sums.SumB += valueB;
+            sums.SumSquares += valueA * valueA + valueB * valueB;
+            sums.SumProducts += valueA * valueB;
+        }
+    }
+    return sums;
+}
+
+#ifdef QUALITY_METRICS_SSE2
+uint32_t HorizontalSum(__m128i value)
+{
+    value = _mm_add_epi32(value, _mm_shuffle_epi32(value, _MM_SHUFFLE(1, 0, 3, 2)));
+    value = _mm_add_epi32(value, _mm_shuffle_epi32(value, _MM_SHUFFLE(2, 3, 0, 1)));
+    return static_cast<uint32_t>(_mm_cvtsi128_si32(value));
+}
+
+// Treats the lanes as unsigned and sums them without wrapping
+uint64_t HorizontalSum64(__m128i value)
+{
+    auto zero = _mm_setzero_si128();
+    auto sum = _mm_add_epi64(_mm_unpacklo_epi32(value, zero), _mm_unpackhi_epi32(value, zero));
+    sum = _mm_add_epi64(sum, _mm_srli_si128(sum, 8));
+    uint64_t result = 0;
+    _mm_storel_epi64(reinterpret_cast<__m128i*>(&result), sum);
+    return result;
+}
+
+uint64_t SumSquaredDifferencesSse2(uint8_t const* a, uint8_t const* b, uint32_t count)
+{
+    // Each 32-bit lane gains at most 4 * 255^2 per 16 pixels, so a lane can
+    // take rows up to ~260k pixels wide. Their total can't, it's summed in
+    // 64 bits.
+    auto zero = _mm_setzero_si128();
+    auto accumulator = _mm_setzero_si128();
+    uint32_t i = 0;
+    for (; i + 16 <= count; i += 16)
+    {
+        auto valuesA = _mm_loadu_si128(reinterpret_cast<__m128i const*>(a + i));
+        auto valuesB = _mm_loadu_si128(reinterpret_cast<__m128i const*>(b + i));
+        auto low = _mm_sub_epi16(_mm_unpacklo_epi8(valuesA, zero), _mm_unpacklo_epi8(valuesB, zero));
+        auto high = _mm_sub_epi16(_mm_unpackhi_epi8(valuesA, zero), _mm_unpackhi_epi8(valuesB, zero));
+        accumulator = _mm_add_epi32(accumulator, _mm_madd_epi16(low, low));
+        accumulator = _mm_add_epi32(accumulator, _mm_madd_epi16(high, high));
+    }
+    return HorizontalSum64(accumulator) + SumSquaredDifferencesScalar(a + i, b + i, count - i);
+}
+
+WindowSums ComputeWindowSumsSse2(uint8_t const* a, uint32_t aPitch, uint8_t const* b, uint32_t bPitch)
+{
+    auto zero = _mm_setzero_si128();
+    auto sumA = _mm_setzero_si128();
+    auto sumB = _mm_setzero_si128();
+    auto squares = _mm_setzero_si128();
+    auto products = _mm_setzero_si128();
+    for (uint32_t y = 0; y < SsimWindowSize; y++)
+    {
+        auto bytesA = _mm_loadl_epi64(reinterpret_cast<__m128i const*>(a + y * aPitch));
+        auto bytesB = _mm_loadl_epi64(reinterpret_cast<__m128i const*>(b + y * bPitch));
+        sumA = _mm_add_epi64(sumA, _mm_sad_epu8(bytesA, zero));
+        sumB = _mm_add_epi64(sumB, _mm_sad_epu8(bytesB, zero));
+
+        auto valuesA = _mm_unpacklo_epi8(bytesA, zero);
+        auto valuesB = _mm_unpacklo_epi8(bytesB, zero);
+        squares = _mm_add_epi32(squares, _mm_madd_epi16(valuesA, valuesA));
+        squares = _mm_add_epi32(squares, _mm_madd_epi16(valuesB, valuesB));
+        products = _mm_add_epi32(products, _mm_madd_epi16(valuesA, valuesB));
+    }
+
+    WindowSums sums;
+    // Only the low 64 bits were summed into
+    sums.SumA = static_cast<uint32_t>(_mm_cvtsi128_si32(sumA));
+    sums.SumB = static_cast<uint32_t>(_mm_cvtsi128_si32(sumB));
+    sums.SumSquares = HorizontalSum(squares);
+    sums.SumProducts = HorizontalSum(products);
+    return sums;
+}
+#endif
+
+uint64_t SumSquaredDifferences(uint8_t const* a, uint8_t const* b, uint32_t count)
+{
+#ifdef QUALITY_METRICS_SSE2
+    return SumSquaredDifferencesSse2(a, b, count);
+#else
+    return SumSquaredDifferencesScalar(a, b, count);
+#endif
+}
+
+WindowSums ComputeWindowSums(uint8_t const* a, uint32_t aPitch, uint8_t const* b, uint32_t bPitch)
+{
+#ifdef QUALITY_METRICS_SSE2
+    return ComputeWindowSumsSse2(a, aPitch, b, bPitch);
+#else
+    return ComputeWindowSumsScalar(a, aPitch, b, bPitch);
+#endif
+}
+
+double ComputeWindowSsim(WindowSums const& sums)
+{
+    const double count = SsimWindowSize * SsimWindowSize;
+    const double c1 = (0.01 * 255.0) * (0.01 * 255.0);
+    const double c2 = (0.03 * 255.0) * (0.03 * 255.0);
+
+    auto meanA = sums.SumA / count;
+    auto meanB = sums.SumB / count;
+    auto varianceSum = sums.SumSquares / count - meanA * meanA - meanB * meanB;
+    auto covariance = sums.SumProducts / count - meanA * meanB;
+    return ((2.0 * meanA * meanB + c1) * (2.0 * covariance + c2)) /
+        ((meanA * meanA + meanB * meanB + c1) * (varianceSum + c2));
+}
+
+double ComputePsnr(QualityPlane const& reference, QualityPlane const& distorted)
+{
+    WINRT_ASSERT(reference.Width == distorted.Width && reference.Height == distorted.Height);
+    uint64_t sum = 0;
+    for (uint32_t y = 0; y < reference.Height; y++)
+    {
+        sum += SumSquaredDifferences(
+            reference.Data + static_cast<size_t>(y) * reference.Pitch,
+            distorted.Data + static_cast<size_t>(y) * distorted.Pitch,
+            reference.Width);
+    }
+
+    if (sum == 0)
+    {
+        return std::numeric_limits<double>::infinity();
+    }
+    auto meanSquaredError = static_cast<double>(sum) / (static_cast<double>(reference.Width) * static_cast<double>(reference.Height));
+    return 10.0 * std::log10((255.0 * 255.0) / meanSquaredError);
+}
+
+double ComputeSsim(QualityPlane const& reference, QualityPlane const& distorted)
+{
+    WINRT_ASSERT(reference.Width == distorted.Width && reference.Height == distorted.Height);
+    if (reference.Width < SsimWindowSize || reference.Height < SsimWindowSize)
+    {
+        return 1.0;
+    }
+
+    double total = 0.0;
+    uint64_t windows = 0;
+    for (uint32_t y = 0; y + SsimWindowSize <= reference.Height; y += SsimWindowStep)
+    {
+        for (uint32_t x = 0; x + SsimWindowSize <= reference.Width; x += SsimWindowStep)
+        {
+            auto sums = ComputeWindowSums(
+                reference.Data + static_cast<size_t>(y) * reference.Pitch + x,
+                reference.Pitch,
+                distorted.Data + static_cast<size_t>(y) * distorted.Pitch + x,
+                distorted.Pitch);
+            total += ComputeWindowSsim(sums);
+            windows++;
+        }
+    }
+    return total / static_cast<double>(windows);
+}
+
+void CheckQualityKernel(bool condition, std::wstring const& message)
+{
+    if (!condition)
+    {
+        throw winrt::hresult_error(E_UNEXPECTED, L"Quality kernel check failed: " + message);
+    }
+}
+
+void VerifyQualityKernels()
+{
+    // Odd sizes so the scalar tails get exercised too
+    const uint32_t width = 67;
+    const uint32_t height = 21;
+    std::mt19937 random(42);
+    std::uniform_int_distribution<uint32_t> distribution(0, 255);
+    std::vector<uint8_t> a(width * height);
+    std::vector<uint8_t> b(width * height);
+    for (size_t i = 0; i < a.size(); i++)
+    {
+        a[i] = static_cast<uint8_t>(distribution(random));
+        b[i] = static_cast<uint8_t>(distribution(random));
+    }
+
+    for (uint32_t y = 0; y < height; y++)
+    {
+        auto rowA = a.data() + y * width;
+        auto rowB = b.data() + y * width;
+        CheckQualityKernel(
+            SumSquaredDifferences(rowA, rowB, width) == SumSquaredDifferencesScalar(rowA, rowB, width),
+            L"sum of squared differences");
+    }
+    // The largest error possible, over a row wide enough that the lanes'
+    // total doesn't fit in 32 bits
+    std::vector<uint8_t> black(100'000, 0);
+    std::vector<uint8_t> white(black.size(), 255);
+    CheckQualityKernel(
+        SumSquaredDifferences(black.data(), white.data(), static_cast<uint32_t>(black.size())) == black.size() * 255ull * 255ull,
+        L"sum of squared differences over a wide row");
+    for (uint32_t y = 0; y + SsimWindowSize <= height; y++)
+    {
+        for (uint32_t x = 0; x + SsimWindowSize <= width; x++)
+        {
+            auto vectorized = ComputeWindowSums(a.data() + y * width + x, width, b.data() + y * width + x, width);
+            auto scalar = ComputeWindowSumsScalar(a.data() + y * width + x, width, b.data() + y * width + x, width);
+            CheckQualityKernel(
+                vectorized.SumA == scalar.SumA && vectorized.SumB == scalar.SumB &&
+                vectorized.SumSquares == scalar.SumSquares && vectorized.SumProducts == scalar.SumProducts,
+                L"SSIM window sums");
+        }
+    }
+
+    // Identical planes are perfect, and an error of exactly 1 everywhere
+    // gives 10 * log10(255^2) dB.
+    QualityPlane planeA = { a.data(), width, width, height };
+    CheckQualityKernel(std::isinf(ComputePsnr(planeA, planeA)), L"PSNR of identical planes");
+    CheckQualityKernel(std::abs(ComputeSsim(planeA, planeA) - 1.0) < 1e-9, L"SSIM of identical planes");
+
+    std::vector<uint8_t> offset(a.size());
+    std::transform(a.begin(), a.end(), offset.begin(), [](uint8_t value) { return static_cast<uint8_t>(value < 255 ? value + 1 : value - 1); });
+    QualityPlane planeOffset = { offset.data(), width, width, height };
+    CheckQualityKernel(std::abs(ComputePsnr(planeA, planeOffset) - 48.1308036) < 1e-6, L"PSNR of a constant error");
+}
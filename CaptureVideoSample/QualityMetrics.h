@@ -0,0 +1,20 @@
+#pragma once
+
+// An 8-bit plane, normally the luma plane of an NV12 frame
+struct QualityPlane
+{
+    uint8_t const* Data = nullptr;
+    uint32_t Pitch = 0;
+    uint32_t Width = 0;
+    uint32_t Height = 0;
+};
+
+// In dB. Identical planes give infinity. Both planes must be the same size.
+double ComputePsnr(QualityPlane const& reference, QualityPlane const& distorted);
+// Mean SSIM over 8x8 windows spaced 4 pixels apart, 1.0 for identical planes.
+// Both planes must be the same size.
+double ComputeSsim(QualityPlane const& reference, QualityPlane const& distorted);
+
+// Checks the vectorized kernels against the scalar ones and against known
+// values. Throws if any of them disagree.
+void VerifyQualityKernels();
@@ -0,0 +1,135 @@
+#include "pch.h"
+#include "ReadbackRing.h"
+
+namespace winrt
+{
+    using namespace Windows::Foundation;
+}
+
+ReadbackRing::ReadbackRing(
+    winrt::com_ptr<ID3D11Device> const& d3dDevice,
+    winrt::com_ptr<ID3D11DeviceContext> const& d3dContext,
+    uint32_t width,
+    uint32_t height,
+    DXGI_FORMAT format,
+    uint32_t depth,
+    FrameHandler const& handler)
+{
+    m_d3dContext = d3dContext;
+    m_width = width;
+    m_height = height;
+    m_handler = handler;
+
+    D3D11_TEXTURE2D_DESC desc = {};
+    desc.Width = width;
+    desc.Height = height;
+    desc.MipLevels = 1;
+    desc.ArraySize = 1;
+    desc.Format = format;
+    desc.SampleDesc.Count = 1;
+    desc.Usage = D3D11_USAGE_STAGING;
+    desc.CPUAccessFlags = D3D11_CPU_ACCESS_READ;
+
+    m_slots.resize(std::max<uint32_t>(depth, 1));
+    for (auto&& slot : m_slots)
+    {
+        winrt::check_hresult(d3dDevice->CreateTexture2D(&desc, nullptr, slot.Texture.put()));
+    }
+}
+
+void ReadbackRing::Submit(ID3D11Texture2D* texture, winrt::TimeSpan const& timestamp)
+{
+    // Make room by handing over the frame submitted depth frames ago
+    if (m_inFlight == m_slots.size())
+    {
+        DeliverOldest();
+    }
+
+    auto& slot = m_slots[(m_oldest + m_inFlight) % m_slots.size()];
+    m_d3dContext->CopyResource(slot.Texture.get(), texture);
+    slot.Timestamp = timestamp;
+    slot.Submitted = std::chrono::steady_clock::now();
+    m_inFlight++;
+
+    auto lock = m_metricsLock.lock_exclusive();
+    m_metrics.FramesSubmitted++;
+}
+
+void ReadbackRing::Flush()
+{
+    while (m_inFlight > 0)
+    {
+        DeliverOldest();
+    }
+}
+
+void ReadbackRing::DeliverStale(std::chrono::milliseconds const& maxAge)
+{
+    auto now = std::chrono::steady_clock::now();
+    while (m_inFlight > 0 && now - m_slots[m_oldest].Submitted >= maxAge)
+    {
+        DeliverOldest();
+        auto lock = m_metricsLock.lock_exclusive();
+        m_metrics.StaleDeliveries++;
+    }
+}
+
+ReadbackMetrics ReadbackRing::Metrics()
+{
+    auto lock = m_metricsLock.lock_shared();
+    return m_metrics;
+}
+
+void ReadbackRing::DeliverOldest()
+{
+    auto& slot = m_slots[m_oldest];
+    // The slot is free again even if mapping or the handler fails
+    auto advance = wil::scope_exit([&]()
+    {
+        m_oldest = (m_oldest + 1) % m_slots.size();
+        m_inFlight--;
+    });
+
+    // Check whether the copy is done before committing to wait for it
+    D3D11_MAPPED_SUBRESOURCE mapped = {};
+    std::chrono::microseconds stall = {};
+    auto hr = m_d3dContext->Map(slot.Texture.get(), 0, D3D11_MAP_READ, D3D11_MAP_FLAG_DO_NOT_WAIT, &mapped);
+    if (hr == DXGI_ERROR_WAS_STILL_DRAWING)
+    {
+        auto start = std::chrono::steady_clock::now();
+        winrt::check_hresult(m_d3dContext->Map(slot.Texture.get(), 0, D3D11_MAP_READ, 0, &mapped));
+        stall = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start);
+    }
+    else
+    {
+        winrt::check_hresult(hr);
+    }
+    auto unmap = wil::scope_exit([&]() { m_d3dContext->Unmap(slot.Texture.get(), 0); });
+
+    {
+        auto lock = m_metricsLock.lock_exclusive();
+        if (hr == DXGI_ERROR_WAS_STILL_DRAWING)
+        {
+            m_metrics.Stalls++;
+            m_metrics.LastStall = stall;
+            m_metrics.MaxStall = std::max(m_metrics.MaxStall, stall);
+            m_metrics.TotalStall += stall;
+        }
+    }
+
+    ReadbackFrame frame;
+    frame.Data = static_cast<uint8_t const*>(mapped.pData);
+    frame.RowPitch = mapped.RowPitch;
+    frame.Width = m_width;
+    frame.Height = m_height;
+    frame.Timestamp = slot.Timestamp;
+    auto handlerStart = std::chrono::steady_clock::now();
+    m_handler(frame);
+    auto handlerTime = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - handlerStart);
+
+    auto lock = m_metricsLock.lock_exclusive();
+    m_metrics.FramesDelivered++;
+    m_metrics.LastHandlerTime = handlerTime;
+    m_metrics.MaxHandlerTime = std::max(m_metrics.MaxHandlerTime, handlerTime);
+    m_metrics.TotalHandlerTime += handlerTime;
+}
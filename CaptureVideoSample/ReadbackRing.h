@@ -0,0 +1,82 @@
+#pragma once
+
+struct ReadbackFrame
+{
+    uint8_t const* Data = nullptr;
+    uint32_t RowPitch = 0;
+    uint32_t Width = 0;
+    uint32_t Height = 0;
+    winrt::Windows::Foundation::TimeSpan Timestamp = {};
+};
+
+struct ReadbackMetrics
+{
+    uint64_t FramesSubmitted = 0;
+    uint64_t FramesDelivered = 0;
+    // Maps that had to wait for the GPU to finish the copy
+    uint64_t Stalls = 0;
+    std::chrono::microseconds LastStall = {};
+    std::chrono::microseconds MaxStall = {};
+    std::chrono::microseconds TotalStall = {};
+    // Time spent in the handler, which holds up the submitting thread
+    std::chrono::microseconds LastHandlerTime = {};
+    std::chrono::microseconds MaxHandlerTime = {};
+    std::chrono::microseconds TotalHandlerTime = {};
+    // Frames handed over by DeliverStale rather than pushed out by newer ones
+    uint64_t StaleDeliveries = 0;
+};
+
+// Gets frames from the GPU to the CPU without waiting on the copy. Each frame
+// is copied into the next of several staging textures and only mapped once
+// the ring has wrapped back around to it, by which point the GPU has usually
+// finished. Frames are handed over depth frames after they were submitted,
+// or sooner through DeliverStale, on the thread that submits them. The
+// handler runs on that thread too, so it should only copy what it needs and
+// leave slow work to others; see the handler times in ReadbackMetrics.
+// Mapping has to stay on the thread that owns the device context.
+class ReadbackRing
+{
+public:
+    using FrameHandler = std::function<void(ReadbackFrame const&)>;
+
+    ReadbackRing(
+        winrt::com_ptr<ID3D11Device> const& d3dDevice,
+        winrt::com_ptr<ID3D11DeviceContext> const& d3dContext,
+        uint32_t width,
+        uint32_t height,
+        DXGI_FORMAT format,
+        uint32_t depth,
+        FrameHandler const& handler);
+
+    // The texture must match the size and format the ring was created with.
+    void Submit(ID3D11Texture2D* texture, winrt::Windows::Foundation::TimeSpan const& timestamp);
+    // Hands over every frame that is still in flight, waiting on the GPU if needed.
+    void Flush();
+    // Hands over the frames that were submitted at least maxAge ago. Without
+    // this, the last frames before the content stops changing would wait for
+    // newer ones indefinitely.
+    void DeliverStale(std::chrono::milliseconds const& maxAge);
+    ReadbackMetrics Metrics();
+
+private:
+    struct Slot
+    {
+        winrt::com_ptr<ID3D11Texture2D> Texture;
+        winrt::Windows::Foundation::TimeSpan Timestamp = {};
+        std::chrono::steady_clock::time_point Submitted = {};
+    };
+
+    void DeliverOldest();
+
+private:
+    winrt::com_ptr<ID3D11DeviceContext> m_d3dContext;
+    uint32_t m_width = 0;
+    uint32_t m_height = 0;
+    FrameHandler m_handler;
+    std::vector<Slot> m_slots;
+    size_t m_oldest = 0;
+    size_t m_inFlight = 0;
+
+    wil::srwlock m_metricsLock;
+    ReadbackMetrics m_metrics;
+};
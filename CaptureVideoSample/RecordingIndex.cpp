@@ -0,0 +1,255 @@
+#include "pch.h"
+#include "RecordingIndex.h"
+#include "Mp4SampleTable.h"
+
+namespace winrt
+{
+    using namespace Windows::Foundation;
+}
+
+// Wide enough that a long recording's sheet doesn't end up as one tall strip
+const uint32_t MaxSheetColumns = 10;
+// Bounds how much of the recording's thumbnails are in memory at once
+const uint32_t MaxSheetRows = 10;
+
+void CheckRecordingIndex(bool condition)
+{
+    if (!condition)
+    {
+        throw winrt::hresult_error(HRESULT_FROM_WIN32(ERROR_INVALID_DATA), L"Not a recording index.");
+    }
+}
+
+std::wstring GetRecordingIndexPath(std::wstring const& recordingPath)
+{
+    return std::filesystem::path(recordingPath).replace_extension(L".cvindex").wstring();
+}
+
+RecordingIndexWriter::RecordingIndexWriter(
+    std::wstring const& scratchPath,
+    uint32_t thumbnailWidth,
+    uint32_t thumbnailHeight,
+    winrt::TimeSpan const& thumbnailInterval)
+{
+    m_thumbnailWidth = thumbnailWidth;
+    m_thumbnailHeight = thumbnailHeight;
+    m_thumbnailInterval = thumbnailInterval;
+    m_thumbnailFile.reset(CreateFileW(
+        scratchPath.c_str(),
+        GENERIC_READ | GENERIC_WRITE,
+        0,
+        nullptr,
+        CREATE_ALWAYS,
+        FILE_ATTRIBUTE_TEMPORARY | FILE_FLAG_DELETE_ON_CLOSE,
+        nullptr));
+    winrt::check_bool(static_cast<bool>(m_thumbnailFile));
+}
+
+void RecordingIndexWriter::AddThumbnail(ReadbackFrame const& frame)
+{
+    WINRT_ASSERT(frame.Width == m_thumbnailWidth && frame.Height == m_thumbnailHeight);
+    auto rowSize = static_cast<DWORD>(m_thumbnailWidth) * 4;
+    for (uint32_t y = 0; y < m_thumbnailHeight; y++)
+    {
+        DWORD written = 0;
+        winrt::check_bool(WriteFile(m_thumbnailFile.get(), frame.Data + static_cast<size_t>(y) * frame.RowPitch, rowSize, &written, nullptr));
+    }
+    m_thumbnailTimestamps.push_back(frame.Timestamp.count());
+}
+
+void RecordingIndexWriter::Write(std::wstring const& recordingPath, std::wstring const& indexPath)
+{
+    auto track = ReadMp4VideoTrack(recordingPath);
+
+    // The first sample is presented at time zero
+    int64_t firstPresentationTime = 0;
+    if (!track.Samples.empty())
+    {
+        firstPresentationTime = static_cast<int64_t>(track.Samples.front().DecodeTime) + track.Samples.front().CompositionOffset;
+    }
+    std::vector<RecordingIndexKeyFrame> keyFrames;
+    for (auto&& sample : track.Samples)
+    {
+        if (sample.IsKeyFrame)
+        {
+            RecordingIndexKeyFrame keyFrame = {};
+            auto presentationTime = static_cast<int64_t>(sample.DecodeTime) + sample.CompositionOffset - firstPresentationTime;
+            keyFrame.Timestamp = Mp4TimeToTimeSpan(presentationTime, track.Timescale).count();
+            keyFrame.Offset = sample.Offset;
+            keyFrame.Size = sample.Size;
+            keyFrames.push_back(keyFrame);
+        }
+    }
+    std::sort(keyFrames.begin(), keyFrames.end(), [](auto const& first, auto const& second) { return first.Timestamp < second.Timestamp; });
+
+    auto thumbnailCount = static_cast<uint32_t>(m_thumbnailTimestamps.size());
+    auto columns = std::min(thumbnailCount, MaxSheetColumns);
+    auto rows = columns > 0 ? std::min((thumbnailCount + columns - 1) / columns, MaxSheetRows) : 0;
+    auto thumbnailsPerSheet = columns * rows;
+    auto sheetCount = thumbnailsPerSheet > 0 ? (thumbnailCount + thumbnailsPerSheet - 1) / thumbnailsPerSheet : 0;
+
+    RecordingIndexHeader header = {};
+    header.Magic = RecordingIndexMagic;
+    header.Version = RecordingIndexVersion;
+    header.KeyFrameCount = static_cast<uint32_t>(keyFrames.size());
+    header.ThumbnailCount = thumbnailCount;
+    header.ThumbnailWidth = m_thumbnailWidth;
+    header.ThumbnailHeight = m_thumbnailHeight;
+    header.SheetColumns = columns;
+    header.SheetRows = rows;
+    header.ThumbnailInterval = m_thumbnailInterval.count();
+    header.KeyFramesOffset = sizeof(header);
+    header.ThumbnailsOffset = header.KeyFramesOffset + keyFrames.size() * sizeof(RecordingIndexKeyFrame);
+    header.SheetsOffset = header.ThumbnailsOffset + m_thumbnailTimestamps.size() * sizeof(int64_t);
+    header.SheetCount = sheetCount;
+
+    wil::unique_hfile file(CreateFileW(indexPath.c_str(), GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr));
+    winrt::check_bool(static_cast<bool>(file));
+    auto writeAt = [&file](uint64_t offset, void const* data, size_t size)
+    {
+        LARGE_INTEGER position = {};
+        position.QuadPart = static_cast<LONGLONG>(offset);
+        winrt::check_bool(SetFilePointerEx(file.get(), position, nullptr, FILE_BEGIN));
+        DWORD written = 0;
+        winrt::check_bool(WriteFile(file.get(), data, static_cast<DWORD>(size), &written, nullptr));
+    };
+
+    // The sheets go after their table, which is filled in as they're encoded
+    std::vector<RecordingIndexSheet> sheets(sheetCount);
+    auto sheetOffset = header.SheetsOffset + sheets.size() * sizeof(RecordingIndexSheet);
+    if (sheetCount > 0)
+    {
+        // We're called from whatever thread the recording finished on
+        auto coInitialize = wil::CoInitializeEx(COINIT_MULTITHREADED);
+        auto factory = winrt::create_instance<IWICImagingFactory>(CLSID_WICImagingFactory);
+        for (uint32_t i = 0; i < sheetCount; i++)
+        {
+            auto firstThumbnail = i * thumbnailsPerSheet;
+            auto sheet = EncodeSpriteSheet(factory.get(), firstThumbnail, std::min(thumbnailsPerSheet, thumbnailCount - firstThumbnail), columns);
+            writeAt(sheetOffset, sheet.data(), sheet.size());
+            sheets[i].Offset = sheetOffset;
+            sheets[i].Size = sheet.size();
+            sheetOffset += sheet.size();
+        }
+    }
+
+    writeAt(0, &header, sizeof(header));
+    writeAt(header.KeyFramesOffset, keyFrames.data(), keyFrames.size() * sizeof(RecordingIndexKeyFrame));
+    writeAt(header.ThumbnailsOffset, m_thumbnailTimestamps.data(), m_thumbnailTimestamps.size() * sizeof(int64_t));
+    writeAt(header.SheetsOffset, sheets.data(), sheets.size() * sizeof(RecordingIndexSheet));
+}
+
+std::vector<uint8_t> RecordingIndexWriter::EncodeSpriteSheet(IWICImagingFactory* factory, uint32_t firstThumbnail, uint32_t thumbnailCount, uint32_t columns)
+{
+    // The last sheet only has as many rows as it needs
+    auto rows = (thumbnailCount + columns - 1) / columns;
+    auto sheetWidth = columns * m_thumbnailWidth;
+    auto sheetHeight = rows * m_thumbnailHeight;
+    auto sheetStride = static_cast<size_t>(sheetWidth) * 4;
+    auto thumbnailStride = static_cast<size_t>(m_thumbnailWidth) * 4;
+    auto thumbnailSize = thumbnailStride * m_thumbnailHeight;
+    std::vector<uint8_t> pixels(sheetStride * sheetHeight, 0);
+
+    LARGE_INTEGER position = {};
+    position.QuadPart = static_cast<LONGLONG>(firstThumbnail * thumbnailSize);
+    winrt::check_bool(SetFilePointerEx(m_thumbnailFile.get(), position, nullptr, FILE_BEGIN));
+    for (size_t i = 0; i < thumbnailCount; i++)
+    {
+        auto left = (i % columns) * thumbnailStride;
+        auto top = (i / columns) * m_thumbnailHeight;
+        for (uint32_t y = 0; y < m_thumbnailHeight; y++)
+        {
+            DWORD read = 0;
+            winrt::check_bool(ReadFile(m_thumbnailFile.get(), pixels.data() + (top + y) * sheetStride + left, static_cast<DWORD>(thumbnailStride), &read, nullptr));
+            if (read != thumbnailStride)
+            {
+                throw winrt::hresult_error(HRESULT_FROM_WIN32(ERROR_HANDLE_EOF), L"A thumbnail is missing.");
+            }
+        }
+    }
+
+    winrt::com_ptr<IWICBitmap> bitmap;
+    winrt::check_hresult(factory->CreateBitmapFromMemory(
+        sheetWidth,
+        sheetHeight,
+        GUID_WICPixelFormat32bppBGRA,
+        static_cast<uint32_t>(sheetStride),
+        static_cast<uint32_t>(pixels.size()),
+        pixels.data(),
+        bitmap.put()));
+
+    winrt::com_ptr<IStream> stream;
+    winrt::check_hresult(CreateStreamOnHGlobal(nullptr, true, stream.put()));
+    winrt::com_ptr<IWICBitmapEncoder> encoder;
+    winrt::check_hresult(factory->CreateEncoder(GUID_ContainerFormatJpeg, nullptr, encoder.put()));
+    winrt::check_hresult(encoder->Initialize(stream.get(), WICBitmapEncoderNoCache));
+    winrt::com_ptr<IWICBitmapFrameEncode> frame;
+    winrt::check_hresult(encoder->CreateNewFrame(frame.put(), nullptr));
+    winrt::check_hresult(frame->Initialize(nullptr));
+    winrt::check_hresult(frame->SetSize(sheetWidth, sheetHeight));
+    // JPEG has no alpha, WriteSource converts for us
+    winrt::check_hresult(frame->WriteSource(bitmap.get(), nullptr));
+    winrt::check_hresult(frame->Commit());
+    winrt::check_hresult(encoder->Commit());
+
+    HGLOBAL global = nullptr;
+    winrt::check_hresult(GetHGlobalFromStream(stream.get(), &global));
+    STATSTG stat = {};
+    winrt::check_hresult(stream->Stat(&stat, STATFLAG_NONAME));
+    auto bytes = static_cast<uint8_t const*>(GlobalLock(global));
+    winrt::check_pointer(bytes);
+    auto unlock = wil::scope_exit([global]() { GlobalUnlock(global); });
+    return std::vector<uint8_t>(bytes, bytes + static_cast<size_t>(stat.cbSize.QuadPart));
+}
+
+RecordingIndexReader::RecordingIndexReader(std::wstring const& path)
+{
+    m_file.reset(CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr));
+    winrt::check_bool(static_cast<bool>(m_file));
+    LARGE_INTEGER fileSize = {};
+    winrt::check_bool(GetFileSizeEx(m_file.get(), &fileSize));
+    CheckRecordingIndex(static_cast<uint64_t>(fileSize.QuadPart) >= sizeof(RecordingIndexHeader));
+
+    m_mapping.reset(CreateFileMappingW(m_file.get(), nullptr, PAGE_READONLY, 0, 0, nullptr));
+    winrt::check_bool(static_cast<bool>(m_mapping));
+    m_view.reset(static_cast<uint8_t*>(MapViewOfFile(m_mapping.get(), FILE_MAP_READ, 0, 0, 0)));
+    winrt::check_bool(static_cast<bool>(m_view));
+
+    auto size = static_cast<uint64_t>(fileSize.QuadPart);
+    m_header = reinterpret_cast<RecordingIndexHeader const*>(m_view.get());
+    CheckRecordingIndex(m_header->Magic == RecordingIndexMagic && m_header->Version == RecordingIndexVersion);
+    CheckRecordingIndex(m_header->KeyFramesOffset + static_cast<uint64_t>(m_header->KeyFrameCount) * sizeof(RecordingIndexKeyFrame) <= size);
+    CheckRecordingIndex(m_header->ThumbnailsOffset + static_cast<uint64_t>(m_header->ThumbnailCount) * sizeof(int64_t) <= size);
+    CheckRecordingIndex(m_header->SheetsOffset + static_cast<uint64_t>(m_header->SheetCount) * sizeof(RecordingIndexSheet) <= size);
+    CheckRecordingIndex(m_header->ThumbnailCount <= static_cast<uint64_t>(m_header->SheetColumns) * m_header->SheetRows * m_header->SheetCount);
+    m_keyFrames = reinterpret_cast<RecordingIndexKeyFrame const*>(m_view.get() + m_header->KeyFramesOffset);
+    m_thumbnailTimestamps = reinterpret_cast<int64_t const*>(m_view.get() + m_header->ThumbnailsOffset);
+    m_sheets = reinterpret_cast<RecordingIndexSheet const*>(m_view.get() + m_header->SheetsOffset);
+    for (uint32_t i = 0; i < m_header->SheetCount; i++)
+    {
+        CheckRecordingIndex(m_sheets[i].Offset <= size && m_sheets[i].Size <= size - m_sheets[i].Offset);
+    }
+}
+
+RecordingIndexKeyFrame const* RecordingIndexReader::FindKeyFrame(winrt::TimeSpan const& timestamp) const
+{
+    auto begin = m_keyFrames;
+    auto end = m_keyFrames + m_header->KeyFrameCount;
+    auto it = std::upper_bound(begin, end, timestamp.count(), [](int64_t value, auto const& keyFrame) { return value < keyFrame.Timestamp; });
+    if (it == begin)
+    {
+        return m_header->KeyFrameCount > 0 ? begin : nullptr;
+    }
+    return it - 1;
+}
+
+RECT RecordingIndexReader::ThumbnailRect(uint32_t index) const
+{
+    index %= m_header->SheetColumns * m_header->SheetRows;
+    RECT rect = {};
+    rect.left = static_cast<LONG>((index % m_header->SheetColumns) * m_header->ThumbnailWidth);
+    rect.top = static_cast<LONG>((index / m_header->SheetColumns) * m_header->ThumbnailHeight);
+    rect.right = rect.left + static_cast<LONG>(m_header->ThumbnailWidth);
+    rect.bottom = rect.top + static_cast<LONG>(m_header->ThumbnailHeight);
+    return rect;
+}
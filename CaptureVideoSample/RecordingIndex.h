@@ -0,0 +1,125 @@
+#pragma once
+#include "ReadbackRing.h"
+
+// A sidecar written next to a recording, so review tools can seek and show
+// thumbnails without decoding the recording. Everything is stored at fixed
+// offsets so the file can be memory mapped and used in place:
+//
+//   RecordingIndexHeader
+//   RecordingIndexKeyFrame[KeyFrameCount], by timestamp
+//   int64_t[ThumbnailCount], each thumbnail's timestamp
+//   RecordingIndexSheet[SheetCount]
+//   The sprite sheets, JPEGs with up to SheetRows rows of SheetColumns
+//   thumbnails each. Only the last one can have fewer.
+
+const uint32_t RecordingIndexMagic = 0x58495643; // 'CVIX'
+const uint32_t RecordingIndexVersion = 2;
+
+struct RecordingIndexHeader
+{
+    uint32_t Magic;
+    uint32_t Version;
+    uint32_t KeyFrameCount;
+    uint32_t ThumbnailCount;
+    uint32_t ThumbnailWidth;
+    uint32_t ThumbnailHeight;
+    uint32_t SheetColumns;
+    uint32_t SheetRows;
+    // 100ns units
+    int64_t ThumbnailInterval;
+    // From the start of the file
+    uint64_t KeyFramesOffset;
+    uint64_t ThumbnailsOffset;
+    uint64_t SheetsOffset;
+    uint32_t SheetCount;
+    uint32_t Reserved;
+};
+
+struct RecordingIndexKeyFrame
+{
+    // Presentation time in 100ns units, relative to the start of the recording
+    int64_t Timestamp;
+    // Where the sample starts in the recording
+    uint64_t Offset;
+    uint32_t Size;
+    uint32_t Reserved;
+};
+
+struct RecordingIndexSheet
+{
+    // From the start of the file
+    uint64_t Offset;
+    uint64_t Size;
+};
+
+static_assert(sizeof(RecordingIndexHeader) == 72);
+static_assert(sizeof(RecordingIndexKeyFrame) == 24);
+static_assert(sizeof(RecordingIndexSheet) == 16);
+
+// e.g. recording.mp4 -> recording.cvindex
+std::wstring GetRecordingIndexPath(std::wstring const& recordingPath);
+
+// Collects thumbnails while recording. The keyframes are taken from the
+// recording's sample table once it has been finalized, which only means
+// reading its moov box. Thumbnails go to a temporary file at scratchPath
+// as they arrive, and are encoded one sheet at a time when the index is
+// written, so a long recording's don't pile up in memory.
+class RecordingIndexWriter
+{
+public:
+    RecordingIndexWriter(
+        std::wstring const& scratchPath,
+        uint32_t thumbnailWidth,
+        uint32_t thumbnailHeight,
+        winrt::Windows::Foundation::TimeSpan const& thumbnailInterval);
+
+    uint32_t ThumbnailWidth() const { return m_thumbnailWidth; }
+    uint32_t ThumbnailHeight() const { return m_thumbnailHeight; }
+    winrt::Windows::Foundation::TimeSpan ThumbnailInterval() const { return m_thumbnailInterval; }
+
+    // Frames are BGRA8 and ThumbnailWidth x ThumbnailHeight.
+    void AddThumbnail(ReadbackFrame const& frame);
+    void Write(std::wstring const& recordingPath, std::wstring const& indexPath);
+
+private:
+    std::vector<uint8_t> EncodeSpriteSheet(IWICImagingFactory* factory, uint32_t firstThumbnail, uint32_t thumbnailCount, uint32_t columns);
+
+private:
+    uint32_t m_thumbnailWidth = 0;
+    uint32_t m_thumbnailHeight = 0;
+    winrt::Windows::Foundation::TimeSpan m_thumbnailInterval = {};
+    std::vector<int64_t> m_thumbnailTimestamps;
+    // Tightly packed BGRA8, one thumbnail after another
+    wil::unique_hfile m_thumbnailFile;
+};
+
+class RecordingIndexReader
+{
+public:
+    RecordingIndexReader(std::wstring const& path);
+
+    RecordingIndexHeader const& Header() const { return *m_header; }
+    uint32_t KeyFrameCount() const { return m_header->KeyFrameCount; }
+    RecordingIndexKeyFrame const& KeyFrame(uint32_t index) const { return m_keyFrames[index]; }
+    // The last keyframe at or before the timestamp, where playback has to
+    // start from to show it. Returns nullptr if there are no keyframes.
+    RecordingIndexKeyFrame const* FindKeyFrame(winrt::Windows::Foundation::TimeSpan const& timestamp) const;
+
+    uint32_t ThumbnailCount() const { return m_header->ThumbnailCount; }
+    winrt::Windows::Foundation::TimeSpan ThumbnailTimestamp(uint32_t index) const { return winrt::Windows::Foundation::TimeSpan{ m_thumbnailTimestamps[index] }; }
+    uint32_t SheetCount() const { return m_header->SheetCount; }
+    // Which sprite sheet the thumbnail is in, and where in it
+    uint32_t ThumbnailSheet(uint32_t index) const { return index / (m_header->SheetColumns * m_header->SheetRows); }
+    RECT ThumbnailRect(uint32_t index) const;
+    uint8_t const* SheetData(uint32_t sheet) const { return m_view.get() + m_sheets[sheet].Offset; }
+    size_t SheetSize(uint32_t sheet) const { return static_cast<size_t>(m_sheets[sheet].Size); }
+
+private:
+    wil::unique_hfile m_file;
+    wil::unique_handle m_mapping;
+    wil::unique_mapview_ptr<uint8_t> m_view;
+    RecordingIndexHeader const* m_header = nullptr;
+    RecordingIndexKeyFrame const* m_keyFrames = nullptr;
+    int64_t const* m_thumbnailTimestamps = nullptr;
+    RecordingIndexSheet const* m_sheets = nullptr;
+};
@@ -0,0 +1,264 @@
+#include "pch.h"
+#include "RtpStreamSink.h"
+#include "SystemRelativeTime.h"
+
+namespace winrt
+{
+    using namespace Windows::Foundation;
+}
+
+// Returns the offset of the next 00 00 01 start code at or after start, or
+// size if there isn't one.
+size_t FindStartCode(uint8_t const* data, size_t size, size_t start)
+{
+    for (auto i = start; i + 2 < size; i++)
+    {
+        if (data[i] == 0 && data[i + 1] == 0 && data[i + 2] == 1)
+        {
+            return i;
+        }
+    }
+    return size;
+}
+
+// Calls function(nalUnit, size, isLast) for each NAL unit in Annex B data
+template <typename Function>
+void ForEachNalUnit(uint8_t const* data, size_t size, Function&& function)
+{
+    auto position = FindStartCode(data, size, 0);
+    while (position < size)
+    {
+        auto nalStart = position + 3;
+        auto next = FindStartCode(data, size, nalStart);
+        auto nalEnd = next;
+        // Drop the leading zero of a 4 byte start code and any trailing padding
+        while (nalEnd > nalStart && data[nalEnd - 1] == 0)
+        {
+            nalEnd--;
+        }
+        if (nalEnd > nalStart)
+        {
+            function(data + nalStart, nalEnd - nalStart, next >= size);
+        }
+        position = next;
+    }
+}
+
+const uint8_t NalUnitTypeSps = 7;
+const uint8_t NalUnitTypePps = 8;
+
+RtpStreamSink::RtpStreamSink(std::wstring const& host, uint16_t port)
+{
+    m_host = host;
+    m_port = port;
+
+    WSADATA data = {};
+    winrt::check_win32(WSAStartup(MAKEWORD(2, 2), &data));
+    // The destructor won't run if we throw, e.g. for a host that can't be resolved
+    auto cleanupWinsock = wil::scope_exit([&]()
+    {
+        m_socket.reset();
+        WSACleanup();
+    });
+
+    ADDRINFOW hints = {};
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_DGRAM;
+    hints.ai_protocol = IPPROTO_UDP;
+    ADDRINFOW* addresses = nullptr;
+    winrt::check_win32(GetAddrInfoW(host.c_str(), std::to_wstring(port).c_str(), &hints, &addresses));
+    auto cleanup = wil::scope_exit([&]() { FreeAddrInfoW(addresses); });
+
+    m_isIPv6 = addresses->ai_family == AF_INET6;
+    m_socket.reset(socket(addresses->ai_family, addresses->ai_socktype, addresses->ai_protocol));
+    if (!m_socket)
+    {
+        winrt::throw_hresult(HRESULT_FROM_WIN32(WSAGetLastError()));
+    }
+    // Connecting a UDP socket just fixes the destination so we can use send.
+    if (connect(m_socket.get(), addresses->ai_addr, static_cast<int>(addresses->ai_addrlen)) == SOCKET_ERROR)
+    {
+        winrt::throw_hresult(HRESULT_FROM_WIN32(WSAGetLastError()));
+    }
+
+    std::random_device random;
+    m_sequenceNumber = static_cast<uint16_t>(random());
+    m_ssrc = random();
+    m_timestampBase = random();
+    cleanupWinsock.release();
+}
+
+RtpStreamSink::~RtpStreamSink()
+{
+    m_socket.reset();
+    WSACleanup();
+}
+
+void RtpStreamSink::OnFrameEncoded(EncodedFrame const& frame)
+{
+    winrt::com_ptr<IMFMediaBuffer> buffer;
+    winrt::check_hresult(frame.Sample->ConvertToContiguousBuffer(buffer.put()));
+    uint8_t* data = nullptr;
+    DWORD size = 0;
+    winrt::check_hresult(buffer->Lock(&data, nullptr, &size));
+    auto unlock = wil::scope_exit([&]() { buffer->Unlock(); });
+
+    // RTP uses a 90kHz clock for video
+    auto timestamp = m_timestampBase + static_cast<uint32_t>((frame.Timestamp.count() * 9) / 1000);
+
+    // Receivers can only start decoding with the parameter sets. Encoders
+    // often only put them in front of the first keyframe, so they're sent
+    // again with every keyframe that doesn't carry its own. That covers
+    // receivers that join late and gaps after dropped frames.
+    if (m_sequenceParameterSet.empty() && frame.MediaType)
+    {
+        UINT32 headerSize = 0;
+        if (SUCCEEDED(frame.MediaType->GetBlobSize(MF_MT_MPEG_SEQUENCE_HEADER, &headerSize)) && headerSize > 0)
+        {
+            std::vector<uint8_t> header(headerSize);
+            winrt::check_hresult(frame.MediaType->GetBlob(MF_MT_MPEG_SEQUENCE_HEADER, header.data(), headerSize, nullptr));
+            UpdateParameterSets(header.data(), header.size());
+        }
+    }
+    auto hasParameterSets = UpdateParameterSets(data, size);
+    if (frame.IsKeyFrame && !hasParameterSets && !m_sequenceParameterSet.empty() && !m_pictureParameterSet.empty())
+    {
+        SendNalUnit(m_sequenceParameterSet.data(), m_sequenceParameterSet.size(), timestamp, false);
+        SendNalUnit(m_pictureParameterSet.data(), m_pictureParameterSet.size(), timestamp, false);
+    }
+
+    ForEachNalUnit(data, size, [&](uint8_t const* nalUnit, size_t nalSize, bool isLast)
+    {
+        SendNalUnit(nalUnit, nalSize, timestamp, isLast);
+    });
+
+    auto sendLatency = std::chrono::duration_cast<std::chrono::microseconds>(GetSystemRelativeTime() - frame.CaptureTime);
+    auto lock = m_lock.lock_exclusive();
+    m_metrics.FramesSent++;
+    m_metrics.LastSendLatency = sendLatency;
+    m_metrics.MaxSendLatency = std::max(m_metrics.MaxSendLatency, sendLatency);
+    m_metrics.TotalSendLatency += sendLatency;
+}
+
+bool RtpStreamSink::UpdateParameterSets(uint8_t const* data, size_t size)
+{
+    auto found = false;
+    ForEachNalUnit(data, size, [&](uint8_t const* nalUnit, size_t nalSize, bool)
+    {
+        auto type = nalUnit[0] & 0x1f;
+        if (type == NalUnitTypeSps)
+        {
+            m_sequenceParameterSet.assign(nalUnit, nalUnit + nalSize);
+            found = true;
+        }
+        else if (type == NalUnitTypePps)
+        {
+            m_pictureParameterSet.assign(nalUnit, nalUnit + nalSize);
+            found = true;
+        }
+    });
+    return found;
+}
+
+void RtpStreamSink::Close()
+{
+    m_socket.reset();
+}
+
+RtpStreamMetrics RtpStreamSink::Metrics()
+{
+    auto lock = m_lock.lock_exclusive();
+    return m_metrics;
+}
+
+std::string RtpStreamSink::CreateSessionDescription()
+{
+    auto host = winrt::to_string(m_host);
+    auto addressType = m_isIPv6 ? "IP6" : "IP4";
+    std::stringstream stream;
+    stream << "v=0\r\n";
+    stream << "o=- 0 0 IN " << addressType << " " << host << "\r\n";
+    stream << "s=CaptureVideoSample\r\n";
+    stream << "c=IN " << addressType << " " << host << "\r\n";
+    stream << "t=0 0\r\n";
+    stream << "m=video " << m_port << " RTP/AVP " << static_cast<uint32_t>(PayloadType) << "\r\n";
+    stream << "a=rtpmap:" << static_cast<uint32_t>(PayloadType) << " H264/90000\r\n";
+    stream << "a=fmtp:" << static_cast<uint32_t>(PayloadType) << " packetization-mode=1\r\n";
+    return stream.str();
+}
+
+void RtpStreamSink::SendNalUnit(uint8_t const* nalUnit, size_t size, uint32_t timestamp, bool isLastInAccessUnit)
+{
+    if (size <= MaxPayloadSize)
+    {
+        // Single NAL unit packet
+        SendPacket(nullptr, 0, nalUnit, size, timestamp, isLastInAccessUnit);
+        return;
+    }
+
+    // FU-A: the NAL header is replaced by an indicator and a fragment header
+    auto nalHeader = nalUnit[0];
+    auto payload = nalUnit + 1;
+    auto remaining = size - 1;
+    auto isFirst = true;
+    while (remaining > 0)
+    {
+        auto fragmentSize = std::min(remaining, MaxPayloadSize - 2);
+        auto isLast = fragmentSize == remaining;
+
+        std::array<uint8_t, 2> header = {};
+        header[0] = static_cast<uint8_t>((nalHeader & 0xE0) | 28);
+        header[1] = static_cast<uint8_t>((isFirst ? 0x80 : 0) | (isLast ? 0x40 : 0) | (nalHeader & 0x1F));
+        SendPacket(header.data(), header.size(), payload, fragmentSize, timestamp, isLast && isLastInAccessUnit);
+
+        payload += fragmentSize;
+        remaining -= fragmentSize;
+        isFirst = false;
+    }
+}
+
+void RtpStreamSink::SendPacket(
+    uint8_t const* payloadHeader,
+    size_t payloadHeaderSize,
+    uint8_t const* payload,
+    size_t payloadSize,
+    uint32_t timestamp,
+    bool marker)
+{
+    auto packet = m_packet.data();
+    packet[0] = 0x80; // Version 2, no padding, no extension, no CSRCs
+    packet[1] = static_cast<uint8_t>((marker ? 0x80 : 0) | PayloadType);
+    packet[2] = static_cast<uint8_t>(m_sequenceNumber >> 8);
+    packet[3] = static_cast<uint8_t>(m_sequenceNumber);
+    packet[4] = static_cast<uint8_t>(timestamp >> 24);
+    packet[5] = static_cast<uint8_t>(timestamp >> 16);
+    packet[6] = static_cast<uint8_t>(timestamp >> 8);
+    packet[7] = static_cast<uint8_t>(timestamp);
+    packet[8] = static_cast<uint8_t>(m_ssrc >> 24);
+    packet[9] = static_cast<uint8_t>(m_ssrc >> 16);
+    packet[10] = static_cast<uint8_t>(m_ssrc >> 8);
+    packet[11] = static_cast<uint8_t>(m_ssrc);
+    m_sequenceNumber++;
+
+    auto size = RtpHeaderSize;
+    if (payloadHeaderSize > 0)
+    {
+        memcpy(packet + size, payloadHeader, payloadHeaderSize);
+        size += payloadHeaderSize;
+    }
+    memcpy(packet + size, payload, payloadSize);
+    size += payloadSize;
+
+    // UDP is best effort, a lost packet shouldn't stop the recording.
+    auto sent = send(m_socket.get(), reinterpret_cast<char const*>(packet), static_cast<int>(size), 0);
+    auto lock = m_lock.lock_exclusive();
+    if (sent == SOCKET_ERROR)
+    {
+        m_metrics.SendErrors++;
+    }
+    else
+    {
+        m_metrics.PacketsSent++;
+        m_metrics.BytesSent += static_cast<uint64_t>(sent);
+    }
+}
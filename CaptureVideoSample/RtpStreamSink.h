@@ -0,0 +1,66 @@
+#pragma once
+#include "EncodedFrameSink.h"
+
+struct RtpStreamMetrics
+{
+    uint64_t FramesSent = 0;
+    uint64_t PacketsSent = 0;
+    uint64_t BytesSent = 0;
+    uint64_t SendErrors = 0;
+    // Time from the frame being captured to its last packet leaving the
+    // socket. This is only the sending side, it doesn't include the network
+    // or the receiver's decode and display.
+    std::chrono::microseconds LastSendLatency = {};
+    std::chrono::microseconds MaxSendLatency = {};
+    std::chrono::microseconds TotalSendLatency = {};
+};
+
+// Sends H.264 over RTP/UDP (RFC 6184, packetization-mode=1) as soon as each
+// access unit leaves the encoder. Large NAL units are split into FU-A
+// fragments so every datagram fits in a typical MTU.
+class RtpStreamSink : public EncodedFrameSink
+{
+public:
+    RtpStreamSink(std::wstring const& host, uint16_t port);
+    ~RtpStreamSink();
+
+    void OnFrameEncoded(EncodedFrame const& frame) override;
+    void Close() override;
+
+    RtpStreamMetrics Metrics();
+    // An SDP description that players (e.g. ffplay, VLC) can use to receive
+    // the stream. The parameter sets aren't in it, they're sent in-band.
+    std::string CreateSessionDescription();
+
+private:
+    // Keeps the SPS and PPS in Annex B data, returns true if it had either.
+    bool UpdateParameterSets(uint8_t const* data, size_t size);
+    void SendNalUnit(uint8_t const* nalUnit, size_t size, uint32_t timestamp, bool isLastInAccessUnit);
+    void SendPacket(
+        uint8_t const* payloadHeader,
+        size_t payloadHeaderSize,
+        uint8_t const* payload,
+        size_t payloadSize,
+        uint32_t timestamp,
+        bool marker);
+
+private:
+    static const size_t MaxPayloadSize = 1200;
+    static const size_t RtpHeaderSize = 12;
+    static const uint8_t PayloadType = 96;
+
+    std::wstring m_host;
+    uint16_t m_port = 0;
+    bool m_isIPv6 = false;
+    wil::unique_socket m_socket;
+    uint16_t m_sequenceNumber = 0;
+    uint32_t m_ssrc = 0;
+    uint32_t m_timestampBase = 0;
+    std::array<uint8_t, RtpHeaderSize + MaxPayloadSize> m_packet = {};
+    // The most recent ones seen, without start codes
+    std::vector<uint8_t> m_sequenceParameterSet;
+    std::vector<uint8_t> m_pictureParameterSet;
+
+    wil::srwlock m_lock;
+    RtpStreamMetrics m_metrics;
+};
@@ -0,0 +1,200 @@
+#include "pch.h"
+#include "SharedFrameRing.h"
+
+size_t AlignUp(size_t value, size_t alignment)
+{
+    return (value + alignment - 1) & ~(alignment - 1);
+}
+
+size_t GetSlotHeadersOffset()
+{
+    return AlignUp(sizeof(SharedFrameRingHeader), 64);
+}
+
+size_t GetSlotDataOffset(uint32_t slotCount)
+{
+    return AlignUp(GetSlotHeadersOffset() + slotCount * sizeof(SharedFrameSlotHeader), 4096);
+}
+
+SharedFrameRingWriter::SharedFrameRingWriter(std::wstring const& name, uint32_t slotCount, uint32_t width, uint32_t height)
+{
+    WINRT_VERIFY(slotCount > 1);
+    auto stride = width * 4;
+    auto slotSize = static_cast<uint32_t>(AlignUp(static_cast<size_t>(stride) * height, 4096));
+    auto dataOffset = GetSlotDataOffset(slotCount);
+    uint64_t totalSize = dataOffset + static_cast<uint64_t>(slotSize) * slotCount;
+
+    m_mapping.reset(CreateFileMappingW(
+        INVALID_HANDLE_VALUE,
+        nullptr,
+        PAGE_READWRITE,
+        static_cast<DWORD>(totalSize >> 32),
+        static_cast<DWORD>(totalSize & 0xFFFFFFFF),
+        name.c_str()));
+    winrt::check_bool(static_cast<bool>(m_mapping));
+    auto alreadyExists = GetLastError() == ERROR_ALREADY_EXISTS;
+    m_view.reset(static_cast<uint8_t*>(MapViewOfFile(m_mapping.get(), FILE_MAP_ALL_ACCESS, 0, 0, 0)));
+    winrt::check_bool(static_cast<bool>(m_view));
+
+    auto base = m_view.get();
+    m_slots = reinterpret_cast<SharedFrameSlotHeader*>(base + GetSlotHeadersOffset());
+    m_data = base + dataOffset;
+    if (alreadyExists)
+    {
+        // A reader kept the last writer's section open. Its size was fixed
+        // when it was created, so only take it over if the layout matches.
+        m_header = reinterpret_cast<SharedFrameRingHeader*>(base);
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (m_header->Magic != SharedFrameRingMagic || m_header->Version != SharedFrameRingVersion ||
+            m_header->SlotCount != slotCount || m_header->Width != width || m_header->Height != height)
+        {
+            throw winrt::hresult_error(HRESULT_FROM_WIN32(ERROR_ALREADY_EXISTS), L"A shared frame ring with this name and a different layout is still open.");
+        }
+        if (m_header->IsWriterAlive.exchange(1, std::memory_order_acq_rel) != 0)
+        {
+            throw winrt::hresult_error(HRESULT_FROM_WIN32(ERROR_ALREADY_EXISTS), L"Another writer is using this shared frame ring.");
+        }
+        // A writer that died mid-frame leaves its slot looking busy. That
+        // frame was never published, so nobody will miss it.
+        for (uint32_t i = 0; i < slotCount; i++)
+        {
+            auto sequence = m_slots[i].Sequence.load(std::memory_order_relaxed);
+            if (sequence % 2 != 0)
+            {
+                m_slots[i].Sequence.store(sequence + 1, std::memory_order_release);
+            }
+        }
+        m_header->Generation.fetch_add(1, std::memory_order_acq_rel);
+        return;
+    }
+
+    m_header = new (base) SharedFrameRingHeader();
+    for (uint32_t i = 0; i < slotCount; i++)
+    {
+        new (&m_slots[i]) SharedFrameSlotHeader();
+    }
+
+    m_header->Version = SharedFrameRingVersion;
+    m_header->SlotCount = slotCount;
+    m_header->SlotSize = slotSize;
+    m_header->Width = width;
+    m_header->Height = height;
+    m_header->Stride = stride;
+    m_header->Format = DXGI_FORMAT_B8G8R8A8_UNORM;
+    m_header->WriteIndex.store(0, std::memory_order_relaxed);
+    m_header->Generation.store(0, std::memory_order_relaxed);
+    m_header->IsWriterAlive.store(1, std::memory_order_relaxed);
+    // Readers check the magic last, so publish it after everything else.
+    std::atomic_thread_fence(std::memory_order_release);
+    m_header->Magic = SharedFrameRingMagic;
+}
+
+SharedFrameRingWriter::~SharedFrameRingWriter()
+{
+    m_header->IsWriterAlive.store(0, std::memory_order_release);
+}
+
+void SharedFrameRingWriter::WriteFrame(uint8_t const* data, uint32_t rowPitch, uint32_t width, uint32_t height, int64_t timestamp)
+{
+    width = std::min(width, m_header->Width);
+    height = std::min(height, m_header->Height);
+
+    auto frameIndex = m_header->WriteIndex.load(std::memory_order_relaxed);
+    auto& slot = m_slots[frameIndex % m_header->SlotCount];
+    auto slotData = m_data + (frameIndex % m_header->SlotCount) * static_cast<size_t>(m_header->SlotSize);
+
+    auto sequence = slot.Sequence.load(std::memory_order_relaxed);
+    slot.Sequence.store(sequence + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    auto rowSize = static_cast<size_t>(width) * 4;
+    for (uint32_t row = 0; row < height; row++)
+    {
+        memcpy(slotData + row * static_cast<size_t>(m_header->Stride), data + row * static_cast<size_t>(rowPitch), rowSize);
+    }
+    slot.FrameIndex = frameIndex;
+    slot.Timestamp = timestamp;
+    slot.Width = width;
+    slot.Height = height;
+
+    slot.Sequence.store(sequence + 2, std::memory_order_release);
+    m_header->WriteIndex.store(frameIndex + 1, std::memory_order_release);
+}
+
+SharedFrameRingReader::SharedFrameRingReader(std::wstring const& name)
+{
+    m_mapping.reset(OpenFileMappingW(FILE_MAP_READ, false, name.c_str()));
+    winrt::check_bool(static_cast<bool>(m_mapping));
+    m_view.reset(static_cast<uint8_t*>(MapViewOfFile(m_mapping.get(), FILE_MAP_READ, 0, 0, 0)));
+    winrt::check_bool(static_cast<bool>(m_view));
+
+    auto base = m_view.get();
+    m_header = reinterpret_cast<SharedFrameRingHeader*>(base);
+    if (m_header->Magic != SharedFrameRingMagic || m_header->Version != SharedFrameRingVersion)
+    {
+        throw winrt::hresult_error(E_UNEXPECTED, L"Unrecognized shared frame ring.");
+    }
+    std::atomic_thread_fence(std::memory_order_acquire);
+    m_slots = reinterpret_cast<SharedFrameSlotHeader*>(base + GetSlotHeadersOffset());
+    m_data = base + GetSlotDataOffset(m_header->SlotCount);
+
+    // Start with the newest frame rather than replaying old ones.
+    auto writeIndex = m_header->WriteIndex.load(std::memory_order_acquire);
+    m_nextIndex = writeIndex > 0 ? writeIndex - 1 : 0;
+}
+
+std::optional<SharedFrameInfo> SharedFrameRingReader::TryReadNextFrame(std::vector<uint8_t>& buffer)
+{
+    auto slotCount = m_header->SlotCount;
+    uint64_t skipped = 0;
+    while (true)
+    {
+        auto writeIndex = m_header->WriteIndex.load(std::memory_order_acquire);
+        if (m_nextIndex >= writeIndex)
+        {
+            return std::nullopt;
+        }
+
+        // The slot we want may be getting overwritten, jump to the newest
+        // frame instead. The writer only ever touches one slot at a time.
+        if (writeIndex - m_nextIndex >= slotCount)
+        {
+            skipped += (writeIndex - 1) - m_nextIndex;
+            m_nextIndex = writeIndex - 1;
+        }
+
+        auto& slot = m_slots[m_nextIndex % slotCount];
+        auto slotData = m_data + (m_nextIndex % slotCount) * static_cast<size_t>(m_header->SlotSize);
+
+        auto sequence = slot.Sequence.load(std::memory_order_acquire);
+        if (sequence % 2 != 0)
+        {
+            // Mid-write, which means the writer lapped us.
+            continue;
+        }
+
+        SharedFrameInfo info = {};
+        info.FrameIndex = slot.FrameIndex;
+        info.Timestamp = slot.Timestamp;
+        info.Width = slot.Width;
+        info.Height = slot.Height;
+        info.Stride = m_header->Stride;
+        auto size = static_cast<size_t>(info.Stride) * info.Height;
+        if (info.FrameIndex == m_nextIndex && size <= m_header->SlotSize)
+        {
+            buffer.resize(size);
+            memcpy(buffer.data(), slotData, size);
+        }
+
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (slot.Sequence.load(std::memory_order_relaxed) != sequence || info.FrameIndex != m_nextIndex)
+        {
+            // Torn read, try again with whatever is newest.
+            continue;
+        }
+
+        m_nextIndex++;
+        info.SkippedFrames = skipped;
+        return info;
+    }
+}
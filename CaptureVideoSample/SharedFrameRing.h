@@ -0,0 +1,98 @@
+#pragma once
+
+// Frames are published into a named file mapping so that other processes on
+// the machine can consume them without capturing the screen themselves.
+//
+// The section is laid out as:
+//   SharedFrameRingHeader
+//   SharedFrameSlotHeader[SlotCount]
+//   SlotCount slots of SlotSize bytes, tightly packed BGRA8 rows
+//
+// Each slot is guarded by a seqlock: the writer makes Sequence odd before it
+// touches the slot and even again once it is done. Readers copy the slot and
+// then check that Sequence didn't change. A reader that falls more than
+// SlotCount - 1 frames behind skips ahead to the newest frame.
+//
+// The section outlives the writer as long as a reader has it open. The next
+// writer with the same name and geometry takes it over where the last one
+// left off, bumping Generation, so readers can keep reading.
+
+static_assert(std::atomic<uint64_t>::is_always_lock_free);
+
+const uint32_t SharedFrameRingMagic = 0x52465643; // 'CVFR'
+const uint32_t SharedFrameRingVersion = 2;
+
+struct SharedFrameRingHeader
+{
+    uint32_t Magic;
+    uint32_t Version;
+    uint32_t SlotCount;
+    uint32_t SlotSize;
+    uint32_t Width;
+    uint32_t Height;
+    uint32_t Stride;
+    uint32_t Format;
+    // Number of frames published so far, by every writer
+    std::atomic<uint64_t> WriteIndex;
+    // Bumped each time a writer takes the ring over
+    std::atomic<uint32_t> Generation;
+    // Cleared when the writer goes away
+    std::atomic<uint32_t> IsWriterAlive;
+};
+
+struct SharedFrameSlotHeader
+{
+    std::atomic<uint64_t> Sequence;
+    uint64_t FrameIndex;
+    // 100ns units, QPC based (same as SystemRelativeTime)
+    int64_t Timestamp;
+    uint32_t Width;
+    uint32_t Height;
+};
+
+struct SharedFrameInfo
+{
+    uint64_t FrameIndex;
+    int64_t Timestamp;
+    uint32_t Width;
+    uint32_t Height;
+    uint32_t Stride;
+    // Frames the reader missed because it fell behind
+    uint64_t SkippedFrames;
+};
+
+class SharedFrameRingWriter
+{
+public:
+    SharedFrameRingWriter(std::wstring const& name, uint32_t slotCount, uint32_t width, uint32_t height);
+    ~SharedFrameRingWriter();
+
+    void WriteFrame(uint8_t const* data, uint32_t rowPitch, uint32_t width, uint32_t height, int64_t timestamp);
+
+private:
+    wil::unique_handle m_mapping;
+    wil::unique_mapview_ptr<uint8_t> m_view;
+    SharedFrameRingHeader* m_header = nullptr;
+    SharedFrameSlotHeader* m_slots = nullptr;
+    uint8_t* m_data = nullptr;
+};
+
+class SharedFrameRingReader
+{
+public:
+    SharedFrameRingReader(std::wstring const& name);
+
+    // Returns std::nullopt if there isn't a new frame yet.
+    std::optional<SharedFrameInfo> TryReadNextFrame(std::vector<uint8_t>& buffer);
+    // Once this is false no new frames come until another writer takes over.
+    bool IsWriterAlive() const { return m_header->IsWriterAlive.load(std::memory_order_acquire) != 0; }
+    uint32_t Generation() const { return m_header->Generation.load(std::memory_order_acquire); }
+
+private:
+    wil::unique_handle m_mapping;
+    wil::unique_mapview_ptr<uint8_t> m_view;
+    SharedFrameRingHeader* m_header = nullptr;
+    SharedFrameSlotHeader* m_slots = nullptr;
+    uint8_t* m_data = nullptr;
+    uint64_t m_nextIndex = 0;
+};
@@ -0,0 +1,112 @@
+#include "pch.h"
+#include "SyntheticFrameSource.h"
+#include "SystemRelativeTime.h"
+
+namespace winrt
+{
+    using namespace Windows::Foundation;
+    using namespace Windows::Graphics;
+}
+
+// A cheap hash so that the "text" looks random but is the same every run
+uint32_t HashCell(uint32_t x, uint32_t y)
+{
+    auto hash = x * 0x9E3779B1u ^ y * 0x85EBCA77u;
+    hash ^= hash >> 15;
+    hash *= 0x2C1B3C6Du;
+    hash ^= hash >> 12;
+    return hash;
+}
+
+uint32_t PackBgra(uint32_t red, uint32_t green, uint32_t blue)
+{
+    return 0xFF000000u | (std::min(red, 255u) << 16) | (std::min(green, 255u) << 8) | std::min(blue, 255u);
+}
+
+SyntheticFrameSource::SyntheticFrameSource(
+    winrt::com_ptr<ID3D11Device> const& d3dDevice,
+    winrt::SizeInt32 const& size,
+    uint32_t frameRate,
+    uint32_t frameCount)
+{
+    d3dDevice->GetImmediateContext(m_d3dContext.put());
+    m_size = size;
+    m_frameDuration = std::chrono::duration_cast<winrt::TimeSpan>(std::chrono::seconds(1)) / frameRate;
+    m_frameCount = frameCount;
+    m_pixels.resize(static_cast<size_t>(size.Width) * static_cast<size_t>(size.Height));
+
+    D3D11_TEXTURE2D_DESC desc = {};
+    desc.Width = static_cast<uint32_t>(size.Width);
+    desc.Height = static_cast<uint32_t>(size.Height);
+    desc.MipLevels = 1;
+    desc.ArraySize = 1;
+    desc.Format = DXGI_FORMAT_B8G8R8A8_UNORM;
+    desc.SampleDesc.Count = 1;
+    desc.Usage = D3D11_USAGE_DEFAULT;
+    desc.BindFlags = D3D11_BIND_SHADER_RESOURCE;
+    winrt::check_hresult(d3dDevice->CreateTexture2D(&desc, nullptr, m_texture.put()));
+}
+
+std::optional<CapturedFrame> SyntheticFrameSource::TryGetNextFrame()
+{
+    if (m_stopped || m_nextFrame >= m_frameCount)
+    {
+        return std::nullopt;
+    }
+
+    // The session is done with the texture by the time it asks for another frame
+    auto index = m_nextFrame++;
+    DrawFrame(index);
+
+    CapturedFrame frame;
+    frame.Texture = m_texture;
+    frame.ContentSize = m_size;
+    frame.Timestamp = m_frameDuration * index;
+    frame.CaptureTime = GetSystemRelativeTime();
+    return frame;
+}
+
+void SyntheticFrameSource::DrawFrame(uint32_t index)
+{
+    auto width = static_cast<uint32_t>(m_size.Width);
+    auto height = static_cast<uint32_t>(m_size.Height);
+
+    // The top half is a slowly moving gradient, the bottom half scrolling
+    // "text" made of random glyph-sized blocks, and a square crosses both.
+    const uint32_t cellWidth = 8;
+    const uint32_t cellHeight = 16;
+    auto textTop = height / 2;
+    auto scroll = index * 2;
+    auto squareSize = std::max(height / 8, 1u);
+    auto squareLeft = (index * 6) % std::max(width - std::min(squareSize, width), 1u);
+    auto squareTop = height / 2 - squareSize / 2;
+
+    for (uint32_t y = 0; y < height; y++)
+    {
+        auto row = m_pixels.data() + static_cast<size_t>(y) * width;
+        for (uint32_t x = 0; x < width; x++)
+        {
+            uint32_t pixel = 0;
+            if (x >= squareLeft && x < squareLeft + squareSize && y >= squareTop && y < squareTop + squareSize)
+            {
+                pixel = PackBgra(230, 60, 40);
+            }
+            else if (y < textTop)
+            {
+                auto shade = (x + index * 3) * 255 / std::max(width, 1u);
+                pixel = PackBgra(shade % 256, (y * 255 / std::max(textTop, 1u)), 128);
+            }
+            else
+            {
+                auto textY = y - textTop + scroll;
+                auto cell = HashCell(x / cellWidth, textY / cellHeight);
+                // Most cells are glyphs, with a stroke pattern picked by the hash
+                auto inGlyph = (cell & 3) != 0 && ((cell >> (2 + (x % cellWidth) + (textY % cellHeight) % 4)) & 1) != 0;
+                pixel = inGlyph ? PackBgra(20, 20, 20) : PackBgra(245, 245, 240);
+            }
+            row[x] = pixel;
+        }
+    }
+
+    m_d3dContext->UpdateSubresource(m_texture.get(), 0, nullptr, m_pixels.data(), width * sizeof(uint32_t), 0);
+}
@@ -0,0 +1,34 @@
+#pragma once
+#include "FrameSource.h"
+
+// Generates a fixed number of frames as fast as they're asked for. The
+// content is a function of the frame index alone, with a mix of smooth
+// gradients, fine text-like detail and motion, so two runs produce exactly
+// the same frames.
+class SyntheticFrameSource : public FrameSource
+{
+public:
+    SyntheticFrameSource(
+        winrt::com_ptr<ID3D11Device> const& d3dDevice,
+        winrt::Windows::Graphics::SizeInt32 const& size,
+        uint32_t frameRate,
+        uint32_t frameCount);
+
+    std::optional<CapturedFrame> TryGetNextFrame() override;
+    std::optional<CapturedFrame> TryGetLatestFrame() override { return TryGetNextFrame(); }
+    void StopCapture() override { m_stopped = true; }
+    size_t AbortCapture() override { m_stopped = true; return 0; }
+
+private:
+    void DrawFrame(uint32_t index);
+
+private:
+    winrt::com_ptr<ID3D11DeviceContext> m_d3dContext;
+    winrt::com_ptr<ID3D11Texture2D> m_texture;
+    winrt::Windows::Graphics::SizeInt32 m_size = {};
+    winrt::Windows::Foundation::TimeSpan m_frameDuration = {};
+    uint32_t m_frameCount = 0;
+    uint32_t m_nextFrame = 0;
+    std::atomic<bool> m_stopped = false;
+    std::vector<uint32_t> m_pixels;
+};
@@ -0,0 +1,21 @@
+#include "pch.h"
+#include "SystemRelativeTime.h"
+
+namespace winrt
+{
+    using namespace Windows::Foundation;
+}
+
+winrt::TimeSpan GetSystemRelativeTime()
+{
+    LARGE_INTEGER counter = {};
+    LARGE_INTEGER frequency = {};
+    QueryPerformanceCounter(&counter);
+    QueryPerformanceFrequency(&frequency);
+
+    // Split the conversion to avoid overflowing on machines with a long uptime.
+    const int64_t ticksPerSecond = 10'000'000;
+    auto seconds = counter.QuadPart / frequency.QuadPart;
+    auto remainder = counter.QuadPart % frequency.QuadPart;
+    return winrt::TimeSpan{ seconds * ticksPerSecond + (remainder * ticksPerSecond) / frequency.QuadPart };
+}
@@ -0,0 +1,4 @@
+#pragma once
+
+// The current QPC time in the same units as Direct3D11CaptureFrame::SystemRelativeTime.
+winrt::Windows::Foundation::TimeSpan GetSystemRelativeTime();
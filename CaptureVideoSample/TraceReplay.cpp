@@ -0,0 +1,123 @@
+#include "pch.h"
+#include "TraceReplay.h"
+#include "VideoRecordingSession.h"
+
+namespace winrt
+{
+    using namespace Windows::Foundation;
+    using namespace Windows::Graphics;
+    using namespace Windows::Storage;
+    using namespace Windows::Storage::Streams;
+}
+
+namespace util
+{
+    using namespace robmikh::common::uwp;
+}
+
+const uint32_t ReplayBitRate = 18000000;
+const uint32_t ReplayFrameRate = 60;
+
+void WriteReport(std::wstring const& report)
+{
+    OutputDebugStringW(report.c_str());
+
+    // We're a windows app, so there's only somewhere to write to if our
+    // output was redirected or we were started from a console.
+    auto output = GetStdHandle(STD_OUTPUT_HANDLE);
+    if (output == nullptr || output == INVALID_HANDLE_VALUE)
+    {
+        if (!AttachConsole(ATTACH_PARENT_PROCESS))
+        {
+            return;
+        }
+        output = GetStdHandle(STD_OUTPUT_HANDLE);
+    }
+    auto text = winrt::to_string(report);
+    DWORD written = 0;
+    WriteFile(output, text.data(), static_cast<DWORD>(text.size()), &written, nullptr);
+}
+
+std::optional<TraceReplayOptions> TryParseTraceReplayOptions(std::vector<std::wstring> const& args)
+{
+    std::optional<TraceReplayOptions> options;
+    for (size_t i = 0; i < args.size(); i++)
+    {
+        auto hasValue = i + 1 < args.size();
+        if (args[i] == L"--replay-trace" && hasValue)
+        {
+            if (!options.has_value())
+            {
+                options = TraceReplayOptions{};
+            }
+            options->TracePath = args[++i];
+        }
+        else if (args[i] == L"--output" && hasValue && options.has_value())
+        {
+            options->OutputPath = args[++i];
+        }
+        else if (args[i] == L"--fast" && options.has_value())
+        {
+            options->Speed = ReplaySpeed::Fast;
+        }
+    }
+
+    if (options.has_value() && options->OutputPath.empty())
+    {
+        options->OutputPath = std::filesystem::path(options->TracePath).replace_extension(L".mp4").wstring();
+    }
+    return options;
+}
+
+int RunTraceReplay(TraceReplayOptions const& options)
+{
+    try
+    {
+        auto d3dDevice = util::CreateD3DDevice();
+        auto device = CreateDirect3DDevice(d3dDevice.as<IDXGIDevice>().get());
+
+        auto source = std::make_shared<TraceReplayFrameSource>(d3dDevice, options.TracePath, options.Speed);
+        auto stream = winrt::FileRandomAccessStream::OpenAsync(
+            options.OutputPath,
+            winrt::FileAccessMode::ReadWrite,
+            winrt::StorageOpenOptions::None,
+            winrt::FileOpenDisposition::CreateAlways).get();
+
+        auto session = VideoRecordingSession::CreateFromSource(
+            device,
+            source,
+            source->InitialSize(),
+            ReplayBitRate,
+            ReplayFrameRate,
+            source->PixelFormat(),
+            stream);
+        session->StartAsync().get();
+
+        auto metrics = source->Metrics();
+        auto stopMetrics = session->StopMetrics();
+        auto seconds = std::chrono::duration<double>(metrics.Elapsed).count();
+        auto fps = seconds > 0.0 ? static_cast<double>(metrics.FramesDelivered) / seconds : 0.0;
+        auto averageLatency = metrics.FramesDelivered > 0 ? metrics.TotalLatency.count() / static_cast<int64_t>(metrics.FramesDelivered) : 0;
+
+        std::wstringstream report;
+        report << options.TracePath << L" (" << (options.Speed == ReplaySpeed::Fast ? L"fast" : L"original speed") << L")" << std::endl
+            << L"  frames: " << metrics.FramesRead << L" read, " << metrics.FramesThrottled << L" throttled, "
+            << metrics.FramesDropped << L" dropped, " << metrics.FramesDelivered << L" delivered, "
+            << stopMetrics.FramesEncoded << L" encoded" << std::endl
+            << L"  fps: " << fps << L" over " << seconds << L"s" << std::endl;
+        if (options.Speed == ReplaySpeed::Original)
+        {
+            report << L"  latency: avg " << averageLatency << L"us max " << metrics.MaxLatency.count() << L"us" << std::endl
+                << L"  read stalls: " << metrics.ReadStalls << L", " << metrics.TotalReadStall.count() << L"us (excluded from latency)" << std::endl;
+        }
+        WriteReport(report.str());
+        return 0;
+    }
+    catch (winrt::hresult_error const& error)
+    {
+        std::wstringstream report;
+        report << options.TracePath << L": " << error.message().c_str() << std::endl;
+        WriteReport(report.str());
+        return 1;
+    }
+}
@@ -0,0 +1,20 @@
+#pragma once
+#include "TraceReplayFrameSource.h"
+
+struct TraceReplayOptions
+{
+    std::wstring TracePath;
+    // Defaults to the trace path with an .mp4 extension
+    std::wstring OutputPath;
+    ReplaySpeed Speed = ReplaySpeed::Original;
+};
+
+// Writes to stdout, if there is one, and to the debugger.
+void WriteReport(std::wstring const& report);
+
+// Looks for --replay-trace <path> [--fast] [--output <path>].
+std::optional<TraceReplayOptions> TryParseTraceReplayOptions(std::vector<std::wstring> const& args);
+
+// Records a trace through the same pipeline a capture goes through, without
+// any UI, and reports how it went on stdout. Returns the process exit code.
+int RunTraceReplay(TraceReplayOptions const& options);
@@ -0,0 +1,340 @@
+#include "pch.h"
+#include "TraceReplayFrameSource.h"
+#include "SystemRelativeTime.h"
+
+namespace winrt
+{
+    using namespace Windows::Foundation;
+    using namespace Windows::Graphics;
+    using namespace Windows::Graphics::DirectX;
+}
+
+TraceReplayFrameSource::TraceReplayFrameSource(
+    winrt::com_ptr<ID3D11Device> const& d3dDevice,
+    std::wstring const& path,
+    ReplaySpeed speed) : m_reader(path)
+{
+    m_d3dDevice = d3dDevice;
+    m_d3dDevice->GetImmediateContext(m_d3dContext.put());
+    m_speed = speed;
+
+    m_endEvent = wil::shared_event(wil::EventOptions::ManualReset);
+    // The default timer resolution is too coarse to reproduce bursts of frames
+    m_timer.reset(CreateWaitableTimerExW(nullptr, nullptr, CREATE_WAITABLE_TIMER_HIGH_RESOLUTION, TIMER_ALL_ACCESS));
+    winrt::check_bool(static_cast<bool>(m_timer));
+
+    m_recordPrefetched.create(wil::EventOptions::None);
+    m_prefetchSpace.create(wil::EventOptions::None);
+    m_prefetchThread = std::thread([this]() { RunPrefetch(); });
+
+    // The destructor won't run if we throw
+    auto stopPrefetch = wil::scope_exit([this]() { StopPrefetch(); });
+    ReadNextRecord();
+    if (!m_nextRecord.has_value())
+    {
+        throw winrt::hresult_error(HRESULT_FROM_WIN32(ERROR_INVALID_DATA), L"The capture trace is empty.");
+    }
+    stopPrefetch.release();
+    m_traceStart = m_nextRecord->Record.ArrivalTime;
+    m_initialSize =
+    {
+        static_cast<int32_t>(m_nextRecord->Record.SurfaceWidth),
+        static_cast<int32_t>(m_nextRecord->Record.SurfaceHeight)
+    };
+}
+
+TraceReplayFrameSource::~TraceReplayFrameSource()
+{
+    StopPrefetch();
+}
+
+winrt::DirectXPixelFormat TraceReplayFrameSource::PixelFormat() const
+{
+    // DirectXPixelFormat uses the same values as DXGI_FORMAT
+    return static_cast<winrt::DirectXPixelFormat>(m_reader.Format());
+}
+
+TraceReplayMetrics TraceReplayFrameSource::Metrics()
+{
+    auto lock = m_lock.lock_exclusive();
+    return m_metrics;
+}
+
+std::optional<CapturedFrame> TraceReplayFrameSource::TryGetNextFrame()
+{
+    while (true)
+    {
+        {
+            auto lock = m_lock.lock_exclusive();
+            auto now = GetSystemRelativeTime();
+            if (!m_replayStart.has_value())
+            {
+                m_replayStart = now;
+            }
+            if (!m_endEvent.is_signaled())
+            {
+                ProcessArrivals(now);
+            }
+
+            if (!m_queue.empty())
+            {
+                auto queued = std::move(m_queue.front());
+                m_queue.pop_front();
+                return CreateFrame(queued, now);
+            }
+            else if (m_endEvent.is_signaled() || !m_nextRecord.has_value())
+            {
+                m_metrics.Elapsed = std::chrono::duration_cast<std::chrono::microseconds>(now - m_replayStart.value());
+                return std::nullopt;
+            }
+
+            // Negative due times are relative
+            LARGE_INTEGER dueTime = {};
+            dueTime.QuadPart = -std::max<int64_t>((ToReplayTime(m_nextRecord->Record.ArrivalTime) - now).count(), 1);
+            winrt::check_bool(SetWaitableTimer(m_timer.get(), &dueTime, 0, nullptr, nullptr, false));
+        }
+
+        std::array<HANDLE, 2> events = { m_endEvent.get(), m_timer.get() };
+        auto waitResult = WaitForMultipleObjectsEx(static_cast<DWORD>(events.size()), events.data(), false, INFINITE, false);
+        WINRT_VERIFY(waitResult == WAIT_OBJECT_0 || waitResult == WAIT_OBJECT_0 + 1);
+    }
+}
+
+std::optional<CapturedFrame> TraceReplayFrameSource::TryGetLatestFrame()
+{
+    auto lock = m_lock.lock_exclusive();
+    auto now = GetSystemRelativeTime();
+    if (!m_replayStart.has_value())
+    {
+        m_replayStart = now;
+    }
+    if (!m_endEvent.is_signaled())
+    {
+        ProcessArrivals(now);
+    }
+    if (m_queue.empty())
+    {
+        return std::nullopt;
+    }
+
+    auto queued = std::move(m_queue.back());
+    m_metrics.FramesDropped += m_queue.size() - 1;
+    m_queue.clear();
+    return CreateFrame(queued, now);
+}
+
+void TraceReplayFrameSource::StopCapture()
+{
+    m_endEvent.SetEvent();
+}
+
+size_t TraceReplayFrameSource::AbortCapture()
+{
+    auto lock = m_lock.lock_exclusive();
+    m_endEvent.SetEvent();
+    auto count = m_queue.size();
+    m_queue.clear();
+    return count;
+}
+
+void TraceReplayFrameSource::ReadNextRecord()
+{
+    std::optional<std::chrono::steady_clock::time_point> stallStart;
+    while (true)
+    {
+        {
+            auto lock = m_prefetchLock.lock_exclusive();
+            if (!m_prefetched.IsEmpty())
+            {
+                m_nextRecord = m_prefetched.PopFront();
+                m_prefetchSpace.SetEvent();
+                break;
+            }
+            else if (m_prefetchError.has_value())
+            {
+                throw m_prefetchError.value();
+            }
+            else if (m_prefetchDone)
+            {
+                m_nextRecord.reset();
+                break;
+            }
+        }
+
+        if (!stallStart.has_value())
+        {
+            stallStart = std::chrono::steady_clock::now();
+        }
+        std::array<HANDLE, 2> events = { m_endEvent.get(), m_recordPrefetched.get() };
+        auto waitResult = WaitForMultipleObjectsEx(static_cast<DWORD>(events.size()), events.data(), false, INFINITE, false);
+        WINRT_VERIFY(waitResult == WAIT_OBJECT_0 || waitResult == WAIT_OBJECT_0 + 1);
+        if (waitResult == WAIT_OBJECT_0)
+        {
+            m_nextRecord.reset();
+            break;
+        }
+    }
+
+    // Pause the replay clock for as long as we waited, the capture never had
+    // to wait on a disk
+    if (stallStart.has_value() && m_replayStart.has_value())
+    {
+        auto stall = std::chrono::duration_cast<winrt::TimeSpan>(std::chrono::steady_clock::now() - stallStart.value());
+        m_replayStart = m_replayStart.value() + stall;
+        m_metrics.ReadStalls++;
+        m_metrics.TotalReadStall += std::chrono::duration_cast<std::chrono::microseconds>(stall);
+    }
+}
+
+void TraceReplayFrameSource::RunPrefetch()
+{
+    try
+    {
+        QueuedRecord queued;
+        while (m_reader.TryReadNextRecord(queued.Record, queued.Payload))
+        {
+            while (true)
+            {
+                {
+                    auto lock = m_prefetchLock.lock_exclusive();
+                    if (m_prefetched.TryPushBack(std::move(queued)))
+                    {
+                        m_recordPrefetched.SetEvent();
+                        break;
+                    }
+                }
+
+                std::array<HANDLE, 2> events = { m_endEvent.get(), m_prefetchSpace.get() };
+                auto waitResult = WaitForMultipleObjectsEx(static_cast<DWORD>(events.size()), events.data(), false, INFINITE, false);
+                WINRT_VERIFY(waitResult == WAIT_OBJECT_0 || waitResult == WAIT_OBJECT_0 + 1);
+                if (waitResult == WAIT_OBJECT_0)
+                {
+                    return;
+                }
+            }
+            queued = {};
+        }
+    }
+    catch (winrt::hresult_error const& error)
+    {
+        auto lock = m_prefetchLock.lock_exclusive();
+        m_prefetchError = error;
+    }
+
+    auto lock = m_prefetchLock.lock_exclusive();
+    m_prefetchDone = true;
+    m_recordPrefetched.SetEvent();
+}
+
+void TraceReplayFrameSource::StopPrefetch()
+{
+    m_endEvent.SetEvent();
+    if (m_prefetchThread.joinable())
+    {
+        m_prefetchThread.join();
+    }
+}
+
+winrt::TimeSpan TraceReplayFrameSource::ToReplayTime(int64_t traceTime) const
+{
+    return m_replayStart.value() + winrt::TimeSpan{ traceTime - m_traceStart };
+}
+
+void TraceReplayFrameSource::ProcessArrivals(winrt::TimeSpan const& now)
+{
+    if (m_speed == ReplaySpeed::Original)
+    {
+        // Everything that would have arrived by now
+        while (m_nextRecord.has_value() && ToReplayTime(m_nextRecord->Record.ArrivalTime) <= now)
+        {
+            auto queued = std::move(m_nextRecord.value());
+            ReadNextRecord();
+            Enqueue(std::move(queued));
+        }
+    }
+    else
+    {
+        while (m_queue.empty() && m_nextRecord.has_value())
+        {
+            auto queued = std::move(m_nextRecord.value());
+            ReadNextRecord();
+            Enqueue(std::move(queued));
+        }
+    }
+}
+
+void TraceReplayFrameSource::Enqueue(QueuedRecord&& queued)
+{
+    m_metrics.FramesRead++;
+    if (!m_decimator.TryKeepFrame(winrt::TimeSpan{ queued.Record.FrameTime }).has_value())
+    {
+        m_metrics.FramesThrottled++;
+    }
+    // One buffer is always held by whoever is consuming frames
+    else if (m_queue.size() >= PoolSize - 1)
+    {
+        m_metrics.FramesDropped++;
+    }
+    else
+    {
+        queued.ArrivalTime = ToReplayTime(queued.Record.ArrivalTime);
+        queued.FrameTime = ToReplayTime(queued.Record.FrameTime);
+        m_queue.push_back(std::move(queued));
+    }
+}
+
+CapturedFrame TraceReplayFrameSource::CreateFrame(QueuedRecord const& queued, winrt::TimeSpan const& now)
+{
+    m_metrics.FramesDelivered++;
+    if (m_speed == ReplaySpeed::Original)
+    {
+        auto latency = std::chrono::duration_cast<std::chrono::microseconds>(now - queued.ArrivalTime);
+        m_metrics.MaxLatency = std::max(m_metrics.MaxLatency, latency);
+        m_metrics.TotalLatency += latency;
+    }
+
+    auto& record = queued.Record;
+    D3D11_TEXTURE2D_DESC desc = {};
+    if (m_texture)
+    {
+        m_texture->GetDesc(&desc);
+    }
+    if (!m_texture || desc.Width != record.SurfaceWidth || desc.Height != record.SurfaceHeight)
+    {
+        desc = {};
+        desc.Width = record.SurfaceWidth;
+        desc.Height = record.SurfaceHeight;
+        desc.MipLevels = 1;
+        desc.ArraySize = 1;
+        desc.Format = m_reader.Format();
+        desc.SampleDesc.Count = 1;
+        desc.Usage = D3D11_USAGE_DEFAULT;
+        desc.BindFlags = D3D11_BIND_SHADER_RESOURCE | D3D11_BIND_RENDER_TARGET;
+        m_texture = nullptr;
+        m_renderTargetView = nullptr;
+        m_textureGeneration++;
+        winrt::check_hresult(m_d3dDevice->CreateTexture2D(&desc, nullptr, m_texture.put()));
+        winrt::check_hresult(m_d3dDevice->CreateRenderTargetView(m_texture.get(), nullptr, m_renderTargetView.put()));
+    }
+
+    if (!queued.Payload.empty())
+    {
+        auto rowPitch = record.SurfaceWidth * GetBytesPerPixel(m_reader.Format());
+        m_d3dContext->UpdateSubresource(m_texture.get(), 0, nullptr, queued.Payload.data(), rowPitch, 0);
+    }
+    else
+    {
+        // Without pixels, give the encoder something that changes every frame
+        auto shade = static_cast<float>(m_metrics.FramesDelivered % 64) / 63.0f;
+        const float color[] = { shade, 0.5f, 1.0f - shade, 1.0f };
+        m_d3dContext->ClearRenderTargetView(m_renderTargetView.get(), color);
+    }
+
+    CapturedFrame frame;
+    frame.Texture = m_texture;
+    frame.ContentSize = { record.ContentWidth, record.ContentHeight };
+    frame.Timestamp = queued.FrameTime;
+    frame.CaptureTime = queued.FrameTime;
+    frame.TextureGeneration = m_textureGeneration;
+    return frame;
+}
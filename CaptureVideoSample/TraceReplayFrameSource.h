@@ -0,0 +1,104 @@
+#pragma once
+#include "FrameSource.h"
+#include "FrameDecimator.h"
+#include "CaptureTrace.h"
+#include "BoundedQueue.h"
+
+enum class ReplaySpeed
+{
+    // Frames arrive with the same timing they were captured with
+    Original,
+    // Every frame is available as soon as it's asked for
+    Fast,
+};
+
+struct TraceReplayMetrics
+{
+    uint64_t FramesRead = 0;
+    // Dropped by the same throttling CaptureFrameGenerator does
+    uint64_t FramesThrottled = 0;
+    // Dropped because the consumer fell behind and the pool was full
+    uint64_t FramesDropped = 0;
+    uint64_t FramesDelivered = 0;
+    std::chrono::microseconds Elapsed = {};
+    // From when a frame arrived until it was handed out. Only measured at
+    // original speed.
+    std::chrono::microseconds MaxLatency = {};
+    std::chrono::microseconds TotalLatency = {};
+    // Times the replay had to wait for the disk to catch up. The replay
+    // clock is paused while it waits, so this isn't part of the latency.
+    uint64_t ReadStalls = 0;
+    std::chrono::microseconds TotalReadStall = {};
+};
+
+// Plays a capture trace back in place of a capture frame pool. Records are
+// read ahead on a thread of their own so that disk I/O stays out of the
+// replay's timing; frames that "arrived" while the consumer was busy are
+// queued the way CaptureFrameGenerator would have queued them.
+class TraceReplayFrameSource : public FrameSource
+{
+public:
+    TraceReplayFrameSource(winrt::com_ptr<ID3D11Device> const& d3dDevice, std::wstring const& path, ReplaySpeed speed);
+    ~TraceReplayFrameSource();
+
+    winrt::Windows::Graphics::DirectX::DirectXPixelFormat PixelFormat() const;
+    // The surface size of the first frame
+    winrt::Windows::Graphics::SizeInt32 InitialSize() const { return m_initialSize; }
+    TraceReplayMetrics Metrics();
+
+    std::optional<CapturedFrame> TryGetNextFrame() override;
+    std::optional<CapturedFrame> TryGetLatestFrame() override;
+    void StopCapture() override;
+    size_t AbortCapture() override;
+
+private:
+    struct QueuedRecord
+    {
+        CaptureTraceRecord Record = {};
+        std::vector<uint8_t> Payload;
+        winrt::Windows::Foundation::TimeSpan ArrivalTime = {};
+        winrt::Windows::Foundation::TimeSpan FrameTime = {};
+    };
+
+    void ReadNextRecord();
+    void RunPrefetch();
+    void StopPrefetch();
+    winrt::Windows::Foundation::TimeSpan ToReplayTime(int64_t traceTime) const;
+    void ProcessArrivals(winrt::Windows::Foundation::TimeSpan const& now);
+    void Enqueue(QueuedRecord&& queued);
+    CapturedFrame CreateFrame(QueuedRecord const& queued, winrt::Windows::Foundation::TimeSpan const& now);
+
+private:
+    // Same as the capture frame pool
+    static const size_t PoolSize = 3;
+    // Payloads can be tens of MB each with pixels, so don't read too far ahead
+    static const size_t PrefetchDepth = 4;
+
+    winrt::com_ptr<ID3D11Device> m_d3dDevice;
+    winrt::com_ptr<ID3D11DeviceContext> m_d3dContext;
+    CaptureTraceReader m_reader;
+    ReplaySpeed m_speed = ReplaySpeed::Original;
+    winrt::Windows::Graphics::SizeInt32 m_initialSize = {};
+
+    wil::srwlock m_lock;
+    wil::shared_event m_endEvent;
+    wil::unique_handle m_timer;
+    std::optional<QueuedRecord> m_nextRecord;
+
+    wil::srwlock m_prefetchLock;
+    BoundedQueue<QueuedRecord> m_prefetched{ PrefetchDepth };
+    wil::unique_event m_recordPrefetched;
+    wil::unique_event m_prefetchSpace;
+    bool m_prefetchDone = false;
+    std::optional<winrt::hresult_error> m_prefetchError;
+    std::thread m_prefetchThread;
+    std::deque<QueuedRecord> m_queue;
+    FrameDecimator m_decimator{ std::chrono::milliseconds(16) };
+    int64_t m_traceStart = 0;
+    std::optional<winrt::Windows::Foundation::TimeSpan> m_replayStart;
+    TraceReplayMetrics m_metrics;
+
+    winrt::com_ptr<ID3D11Texture2D> m_texture;
+    winrt::com_ptr<ID3D11RenderTargetView> m_renderTargetView;
+    uint32_t m_textureGeneration = 0;
+};
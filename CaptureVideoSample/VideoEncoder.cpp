@@ -0,0 +1,383 @@
+#include "pch.h"
+#include "VideoEncoder.h"
+
+namespace winrt
+{
+    using namespace Windows::Foundation;
+    using namespace Windows::Graphics;
+}
+
+winrt::com_ptr<IMFTransform> CreateEncoderTransform(uint32_t flags)
+{
+    MFT_REGISTER_TYPE_INFO inputType = { MFMediaType_Video, MFVideoFormat_NV12 };
+    MFT_REGISTER_TYPE_INFO outputType = { MFMediaType_Video, MFVideoFormat_H264 };
+    IMFActivate** activates = nullptr;
+    uint32_t count = 0;
+    winrt::check_hresult(MFTEnumEx(
+        MFT_CATEGORY_VIDEO_ENCODER,
+        flags | MFT_ENUM_FLAG_SORTANDFILTER,
+        &inputType,
+        &outputType,
+        &activates,
+        &count));
+    auto cleanup = wil::scope_exit([&]()
+    {
+        for (uint32_t i = 0; i < count; i++)
+        {
+            activates[i]->Release();
+        }
+        CoTaskMemFree(activates);
+    });
+
+    winrt::com_ptr<IMFTransform> transform;
+    for (uint32_t i = 0; i < count && !transform; i++)
+    {
+        if (FAILED(activates[i]->ActivateObject(winrt::guid_of<IMFTransform>(), transform.put_void())))
+        {
+            transform = nullptr;
+        }
+    }
+    return transform;
+}
+
+VideoEncoder::VideoEncoder(
+    winrt::com_ptr<ID3D11Device> const& d3dDevice,
+    winrt::SizeInt32 const& size,
+    uint32_t bitRate,
+    uint32_t frameRate)
+{
+    m_d3dDevice = d3dDevice;
+    m_size = size;
+    m_bitRate = bitRate;
+    m_frameRate = frameRate;
+    m_frameDuration = std::chrono::duration_cast<winrt::TimeSpan>(std::chrono::seconds(1)) / frameRate;
+
+    m_transform = CreateEncoderTransform(MFT_ENUM_FLAG_HARDWARE);
+    if (!m_transform)
+    {
+        m_transform = CreateEncoderTransform(MFT_ENUM_FLAG_SYNCMFT);
+    }
+    if (!m_transform)
+    {
+        throw winrt::hresult_error(MF_E_TOPO_CODEC_NOT_FOUND, L"Couldn't find an H.264 encoder.");
+    }
+
+    winrt::com_ptr<IMFAttributes> attributes;
+    if (SUCCEEDED(m_transform->GetAttributes(attributes.put())))
+    {
+        m_isAsync = MFGetAttributeUINT32(attributes.get(), MF_TRANSFORM_ASYNC, FALSE) != FALSE;
+    }
+
+    if (m_isAsync)
+    {
+        winrt::check_hresult(attributes->SetUINT32(MF_TRANSFORM_ASYNC_UNLOCK, TRUE));
+        m_eventGenerator = m_transform.as<IMFMediaEventGenerator>();
+
+        // Hardware encoders can read our textures directly
+        winrt::check_hresult(MFCreateDXGIDeviceManager(&m_resetToken, m_deviceManager.put()));
+        winrt::check_hresult(m_deviceManager->ResetDevice(m_d3dDevice.get(), m_resetToken));
+        winrt::check_hresult(m_transform->ProcessMessage(MFT_MESSAGE_SET_D3D_MANAGER, reinterpret_cast<ULONG_PTR>(m_deviceManager.get())));
+    }
+
+    auto hr = m_transform->GetStreamIDs(1, &m_inputStreamId, 1, &m_outputStreamId);
+    if (hr == E_NOTIMPL)
+    {
+        m_inputStreamId = 0;
+        m_outputStreamId = 0;
+    }
+    else
+    {
+        winrt::check_hresult(hr);
+    }
+
+    m_codecApi = m_transform.try_as<ICodecAPI>();
+    SetEncoderProperties(bitRate);
+    SetMediaTypes(size, bitRate, frameRate);
+}
+
+void VideoEncoder::SetEncoderProperties(uint32_t bitRate)
+{
+    if (!m_codecApi)
+    {
+        return;
+    }
+
+    // Not every encoder supports every property, so these are best effort.
+    VARIANT value = {};
+    value.vt = VT_UI4;
+    value.ulVal = eAVEncCommonRateControlMode_CBR;
+    m_codecApi->SetValue(&CODECAPI_AVEncCommonRateControlMode, &value);
+    value.ulVal = bitRate;
+    m_codecApi->SetValue(&CODECAPI_AVEncCommonMeanBitRate, &value);
+
+    // No lookahead, frames come out as soon as they're encoded. Some hardware
+    // encoders still use B-frames with the Main profile in low latency mode,
+    // so ask for none explicitly as well.
+    value.vt = VT_BOOL;
+    value.boolVal = VARIANT_TRUE;
+    m_codecApi->SetValue(&CODECAPI_AVLowLatencyMode, &value);
+    value.vt = VT_UI4;
+    value.ulVal = 0;
+    m_codecApi->SetValue(&CODECAPI_AVEncMPVDefaultBPictureCount, &value);
+
+    // Encoders read this when the output type is set
+    if (m_gopSize > 0)
+    {
+        value.ulVal = m_gopSize;
+        m_codecApi->SetValue(&CODECAPI_AVEncMPVGOPSize, &value);
+    }
+}
+
+void VideoEncoder::SetKeyFrameInterval(winrt::TimeSpan const& interval)
+{
+    m_keyFrameScheduler.Interval(interval);
+
+    // Let the encoder place keyframes on its own where it can. The scheduler
+    // covers encoders that ignore this and variable frame rate input.
+    uint32_t gopSize = 0;
+    if (interval.count() > 0)
+    {
+        auto seconds = std::chrono::duration<double>(interval).count();
+        gopSize = static_cast<uint32_t>(std::max(1.0, std::round(seconds * m_frameRate)));
+    }
+    if (m_codecApi && gopSize != m_gopSize)
+    {
+        // The media types were set in the constructor, so they have to be
+        // set again for the encoder to pick up the new GOP size.
+        m_gopSize = gopSize;
+        SetEncoderProperties(m_bitRate);
+        SetMediaTypes(m_size, m_bitRate, m_frameRate);
+    }
+}
+
+void VideoEncoder::ForceKeyFrame()
+{
+    if (m_codecApi)
+    {
+        VARIANT value = {};
+        value.vt = VT_UI4;
+        value.ulVal = 1;
+        m_codecApi->SetValue(&CODECAPI_AVEncVideoForceKeyFrame, &value);
+    }
+}
+
+void VideoEncoder::SetMediaTypes(winrt::SizeInt32 const& size, uint32_t bitRate, uint32_t frameRate)
+{
+    auto width = static_cast<uint32_t>(size.Width);
+    auto height = static_cast<uint32_t>(size.Height);
+
+    if (m_outputType)
+    {
+        // Setting them again, the input type depends on the output type
+        m_transform->SetInputType(m_inputStreamId, nullptr, 0);
+        m_outputType = nullptr;
+    }
+
+    // The output type has to be set first
+    winrt::com_ptr<IMFMediaType> outputType;
+    winrt::check_hresult(MFCreateMediaType(outputType.put()));
+    winrt::check_hresult(outputType->SetGUID(MF_MT_MAJOR_TYPE, MFMediaType_Video));
+    winrt::check_hresult(outputType->SetGUID(MF_MT_SUBTYPE, MFVideoFormat_H264));
+    winrt::check_hresult(outputType->SetUINT32(MF_MT_AVG_BITRATE, bitRate));
+    winrt::check_hresult(outputType->SetUINT32(MF_MT_INTERLACE_MODE, MFVideoInterlace_Progressive));
+    winrt::check_hresult(outputType->SetUINT32(MF_MT_MPEG2_PROFILE, eAVEncH264VProfile_Main));
+    winrt::check_hresult(MFSetAttributeSize(outputType.get(), MF_MT_FRAME_SIZE, width, height));
+    winrt::check_hresult(MFSetAttributeRatio(outputType.get(), MF_MT_FRAME_RATE, frameRate, 1));
+    winrt::check_hresult(MFSetAttributeRatio(outputType.get(), MF_MT_PIXEL_ASPECT_RATIO, 1, 1));
+    winrt::check_hresult(m_transform->SetOutputType(m_outputStreamId, outputType.get(), 0));
+
+    winrt::com_ptr<IMFMediaType> inputType;
+    for (DWORD i = 0; !inputType; i++)
+    {
+        winrt::com_ptr<IMFMediaType> candidate;
+        auto hr = m_transform->GetInputAvailableType(m_inputStreamId, i, candidate.put());
+        if (hr == MF_E_NO_MORE_TYPES)
+        {
+            break;
+        }
+        winrt::check_hresult(hr);
+
+        GUID subtype = {};
+        winrt::check_hresult(candidate->GetGUID(MF_MT_SUBTYPE, &subtype));
+        if (subtype == MFVideoFormat_NV12)
+        {
+            inputType = candidate;
+        }
+    }
+    if (!inputType)
+    {
+        throw winrt::hresult_error(MF_E_INVALIDMEDIATYPE, L"The encoder doesn't accept NV12 input.");
+    }
+    winrt::check_hresult(MFSetAttributeSize(inputType.get(), MF_MT_FRAME_SIZE, width, height));
+    winrt::check_hresult(MFSetAttributeRatio(inputType.get(), MF_MT_FRAME_RATE, frameRate, 1));
+    winrt::check_hresult(m_transform->SetInputType(m_inputStreamId, inputType.get(), 0));
+
+    winrt::check_hresult(m_transform->GetOutputCurrentType(m_outputStreamId, m_outputType.put()));
+}
+
+void VideoEncoder::Run(
+    std::function<std::optional<VideoEncoderInputSample>()> const& sampleRequested,
+    std::function<void(EncodedFrame const&)> const& frameEncoded)
+{
+    winrt::check_hresult(m_transform->ProcessMessage(MFT_MESSAGE_COMMAND_FLUSH, 0));
+    winrt::check_hresult(m_transform->ProcessMessage(MFT_MESSAGE_NOTIFY_BEGIN_STREAMING, 0));
+    winrt::check_hresult(m_transform->ProcessMessage(MFT_MESSAGE_NOTIFY_START_OF_STREAM, 0));
+
+    if (m_isAsync)
+    {
+        RunAsync(sampleRequested, frameEncoded);
+    }
+    else
+    {
+        RunSync(sampleRequested, frameEncoded);
+    }
+
+    winrt::check_hresult(m_transform->ProcessMessage(MFT_MESSAGE_NOTIFY_END_STREAMING, 0));
+}
+
+void VideoEncoder::RunAsync(
+    std::function<std::optional<VideoEncoderInputSample>()> const& sampleRequested,
+    std::function<void(EncodedFrame const&)> const& frameEncoded)
+{
+    auto endOfStream = false;
+    while (true)
+    {
+        winrt::com_ptr<IMFMediaEvent> event;
+        winrt::check_hresult(m_eventGenerator->GetEvent(0, event.put()));
+        MediaEventType eventType = MEUnknown;
+        winrt::check_hresult(event->GetType(&eventType));
+
+        switch (eventType)
+        {
+        case METransformNeedInput:
+            if (!endOfStream)
+            {
+                if (auto sample = sampleRequested())
+                {
+                    ProcessInput(*sample);
+                }
+                else
+                {
+                    endOfStream = true;
+                    EndOfStream();
+                    if (m_aborted)
+                    {
+                        // Flushing doesn't produce a DrainComplete event
+                        return;
+                    }
+                }
+            }
+            break;
+        case METransformHaveOutput:
+            TryProcessOutput(frameEncoded);
+            break;
+        case METransformDrainComplete:
+            return;
+        }
+    }
+}
+
+void VideoEncoder::RunSync(
+    std::function<std::optional<VideoEncoderInputSample>()> const& sampleRequested,
+    std::function<void(EncodedFrame const&)> const& frameEncoded)
+{
+    while (auto sample = sampleRequested())
+    {
+        ProcessInput(*sample);
+        while (TryProcessOutput(frameEncoded));
+    }
+
+    EndOfStream();
+    if (!m_aborted)
+    {
+        while (TryProcessOutput(frameEncoded));
+    }
+}
+
+void VideoEncoder::EndOfStream()
+{
+    winrt::check_hresult(m_transform->ProcessMessage(MFT_MESSAGE_NOTIFY_END_OF_STREAM, 0));
+    if (m_aborted)
+    {
+        winrt::check_hresult(m_transform->ProcessMessage(MFT_MESSAGE_COMMAND_FLUSH, 0));
+    }
+    else
+    {
+        winrt::check_hresult(m_transform->ProcessMessage(MFT_MESSAGE_COMMAND_DRAIN, 0));
+    }
+}
+
+void VideoEncoder::ProcessInput(VideoEncoderInputSample const& input)
+{
+    auto sample = input.Sample;
+    winrt::check_hresult(sample->SetSampleTime(input.Timestamp.count()));
+    winrt::check_hresult(sample->SetSampleDuration(m_frameDuration.count()));
+
+    if (m_keyFrameScheduler.ShouldForceKeyFrame(input.Timestamp))
+    {
+        ForceKeyFrame();
+    }
+    winrt::check_hresult(m_transform->ProcessInput(m_inputStreamId, sample.get(), 0));
+}
+
+bool VideoEncoder::TryProcessOutput(std::function<void(EncodedFrame const&)> const& frameEncoded)
+{
+    MFT_OUTPUT_STREAM_INFO streamInfo = {};
+    winrt::check_hresult(m_transform->GetOutputStreamInfo(m_outputStreamId, &streamInfo));
+    auto encoderProvidesSamples = (streamInfo.dwFlags & (MFT_OUTPUT_STREAM_PROVIDES_SAMPLES | MFT_OUTPUT_STREAM_CAN_PROVIDE_SAMPLES)) != 0;
+
+    winrt::com_ptr<IMFSample> outputSample;
+    if (!encoderProvidesSamples)
+    {
+        winrt::com_ptr<IMFMediaBuffer> buffer;
+        winrt::check_hresult(MFCreateMemoryBuffer(streamInfo.cbSize, buffer.put()));
+        winrt::check_hresult(MFCreateSample(outputSample.put()));
+        winrt::check_hresult(outputSample->AddBuffer(buffer.get()));
+    }
+
+    MFT_OUTPUT_DATA_BUFFER outputBuffer = {};
+    outputBuffer.dwStreamID = m_outputStreamId;
+    outputBuffer.pSample = outputSample.get();
+    DWORD status = 0;
+    auto hr = m_transform->ProcessOutput(0, 1, &outputBuffer, &status);
+    if (outputBuffer.pEvents)
+    {
+        outputBuffer.pEvents->Release();
+    }
+    if (encoderProvidesSamples)
+    {
+        outputSample.attach(outputBuffer.pSample);
+    }
+
+    if (hr == MF_E_TRANSFORM_NEED_MORE_INPUT)
+    {
+        return false;
+    }
+    else if (hr == MF_E_TRANSFORM_STREAM_CHANGE)
+    {
+        // The encoder wants to renegotiate its output type, usually to
+        // attach the sequence header.
+        winrt::com_ptr<IMFMediaType> outputType;
+        winrt::check_hresult(m_transform->GetOutputAvailableType(m_outputStreamId, 0, outputType.put()));
+        winrt::check_hresult(m_transform->SetOutputType(m_outputStreamId, outputType.get(), 0));
+        m_outputType = nullptr;
+        winrt::check_hresult(m_transform->GetOutputCurrentType(m_outputStreamId, m_outputType.put()));
+        return true;
+    }
+    winrt::check_hresult(hr);
+
+    LONGLONG sampleTime = 0;
+    winrt::check_hresult(outputSample->GetSampleTime(&sampleTime));
+
+    EncodedFrame frame;
+    frame.Sample = outputSample;
+    frame.MediaType = m_outputType;
+    frame.Timestamp = winrt::TimeSpan{ sampleTime };
+    frame.IsKeyFrame = MFGetAttributeUINT32(outputSample.get(), MFSampleExtension_CleanPoint, FALSE) != FALSE;
+    if (frame.IsKeyFrame)
+    {
+        frame.IsRequestedKeyFrame = m_keyFrameScheduler.OnKeyFrameEncoded(frame.Timestamp);
+    }
+    frameEncoded(frame);
+    return true;
+}
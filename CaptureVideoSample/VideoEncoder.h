@@ -0,0 +1,76 @@
+#pragma once
+#include "EncodedFrameSink.h"
+#include "KeyFrameScheduler.h"
+
+struct VideoEncoderInputSample
+{
+    // Wraps an NV12 texture the same size as the encoder. The encoder may
+    // hold on to it for a few frames.
+    winrt::com_ptr<IMFSample> Sample;
+    winrt::Windows::Foundation::TimeSpan Timestamp = {};
+};
+
+// Wraps an H.264 encoder MFT. Hardware encoders are preferred; they are
+// asynchronous and tell us when they want input. The software encoder is
+// used as a fallback and is driven synchronously.
+class VideoEncoder
+{
+public:
+    VideoEncoder(
+        winrt::com_ptr<ID3D11Device> const& d3dDevice,
+        winrt::Windows::Graphics::SizeInt32 const& size,
+        uint32_t bitRate,
+        uint32_t frameRate);
+
+    // Must be called before Run.
+    void SetKeyFrameInterval(winrt::Windows::Foundation::TimeSpan const& interval);
+    // Asks for the next frame to be encoded as an IDR frame. Safe to call from any thread.
+    void RequestKeyFrame() { m_keyFrameScheduler.RequestKeyFrame(); }
+
+    // Makes Run discard whatever the encoder is still holding once
+    // sampleRequested returns std::nullopt, instead of draining it.
+    void Abort() { m_aborted = true; }
+
+    // Blocks until sampleRequested returns std::nullopt and every
+    // remaining frame has been handed to frameEncoded.
+    void Run(
+        std::function<std::optional<VideoEncoderInputSample>()> const& sampleRequested,
+        std::function<void(EncodedFrame const&)> const& frameEncoded);
+
+private:
+    void SetEncoderProperties(uint32_t bitRate);
+    void SetMediaTypes(winrt::Windows::Graphics::SizeInt32 const& size, uint32_t bitRate, uint32_t frameRate);
+    void RunAsync(
+        std::function<std::optional<VideoEncoderInputSample>()> const& sampleRequested,
+        std::function<void(EncodedFrame const&)> const& frameEncoded);
+    void RunSync(
+        std::function<std::optional<VideoEncoderInputSample>()> const& sampleRequested,
+        std::function<void(EncodedFrame const&)> const& frameEncoded);
+    void ProcessInput(VideoEncoderInputSample const& input);
+    void ForceKeyFrame();
+    // Called once sampleRequested has returned std::nullopt.
+    void EndOfStream();
+    // Returns false if the encoder needs more input before it can produce output.
+    bool TryProcessOutput(std::function<void(EncodedFrame const&)> const& frameEncoded);
+
+private:
+    winrt::com_ptr<ID3D11Device> m_d3dDevice;
+    winrt::com_ptr<IMFDXGIDeviceManager> m_deviceManager;
+    uint32_t m_resetToken = 0;
+
+    winrt::com_ptr<IMFTransform> m_transform;
+    winrt::com_ptr<IMFMediaEventGenerator> m_eventGenerator;
+    winrt::com_ptr<ICodecAPI> m_codecApi;
+    winrt::com_ptr<IMFMediaType> m_outputType;
+    DWORD m_inputStreamId = 0;
+    DWORD m_outputStreamId = 0;
+    bool m_isAsync = false;
+    std::atomic<bool> m_aborted = false;
+    winrt::Windows::Graphics::SizeInt32 m_size = {};
+    uint32_t m_bitRate = 0;
+    uint32_t m_frameRate = 0;
+    // 0 leaves it up to the encoder
+    uint32_t m_gopSize = 0;
+    winrt::Windows::Foundation::TimeSpan m_frameDuration = {};
+    KeyFrameScheduler m_keyFrameScheduler;
+};
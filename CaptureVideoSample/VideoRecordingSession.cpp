@@ -1,6 +1,10 @@
 #include "pch.h"
 #include "VideoRecordingSession.h"
 #include "CaptureFrameGenerator.h"
+#include "Mp4FileSink.h"
+#include "DirtyRects.h"
+#include "AllocationCounter.h"
+#include "SystemRelativeTime.h"
 
 namespace winrt
 {
@@ -11,9 +15,6 @@ namespace winrt
     using namespace Windows::Graphics::DirectX::Direct3D11;
     using namespace Windows::Storage;
     using namespace Windows::UI::Composition;
-    using namespace Windows::Media::Core;
-    using namespace Windows::Media::Transcoding;
-    using namespace Windows::Media::MediaProperties;
 }
 
 namespace util
@@ -22,6 +23,29 @@ namespace util
 }
 
 const float CLEARCOLOR[] = { 0.0f, 0.0f, 0.0f, 1.0f };
+// Past this, issuing more copies costs more than copying a bit extra
+const size_t MaxDirtyRects = 8;
+// Exported frames trail the capture by this many frames
+const uint32_t ExportReadbackDepth = 3;
+// Frames that are read back are handed over after this even if no newer
+// frames come along to push them out, e.g. on a static screen.
+const std::chrono::milliseconds MaxReadbackAge = std::chrono::milliseconds(250);
+// Enough for what hardware encoders usually hold on to, the pool grows if not
+const size_t InitialSamplePoolSize = 8;
+// An hour of keyframes two seconds apart, so the list doesn't grow on the
+// encoder thread in most recordings
+const size_t InitialKeyFrameCapacity = 1800;
+// The first frames create views and fill the pools. Past this a frame should
+// only allocate if one of those has to grow.
+const uint64_t AllocationWarmUpFrames = 30;
+const uint32_t ThumbnailWidth = 160;
+// The recording's own file can't lose frames, so the encoder waits for it
+// instead. Encoded frames are small, so that takes a few seconds of slow disk.
+const SinkQueueOptions FileSinkQueueOptions = { 240, SinkOverflowPolicy::Block };
+// The recording's file is always added first
+const size_t FileSinkIndex = 0;
+// A live viewer would rather skip ahead than fall further behind
+const SinkQueueOptions RtpSinkQueueOptions = { 30, SinkOverflowPolicy::DropUntilKeyFrame };
 
 int32_t EnsureEven(int32_t value)
 {
@@ -36,68 +60,83 @@ int32_t EnsureEven(int32_t value)
 }
 
 VideoRecordingSession::VideoRecordingSession(
-    winrt::IDirect3DDevice const& device, 
-    winrt::GraphicsCaptureItem const& item, 
-    winrt::SizeInt32 const& resolution, 
-    uint32_t bitRate, 
-    uint32_t frameRate, 
+    winrt::IDirect3DDevice const& device,
+    winrt::GraphicsCaptureItem const& item,
+    std::shared_ptr<FrameSource> const& frameSource,
+    winrt::SizeInt32 const& resolution,
+    uint32_t bitRate,
+    uint32_t frameRate,
+    winrt::DirectXPixelFormat pixelFormat,
     winrt::Windows::Storage::Streams::IRandomAccessStream const& stream)
 {
     m_device = device;
+    m_frameRate = frameRate;
     m_d3dDevice = GetDXGIInterfaceFromObject<ID3D11Device>(m_device);
     m_d3dDevice->GetImmediateContext(m_d3dContext.put());
+    // The encoder uses our device from its own threads
+    m_d3dDevice.as<ID3D11Multithread>()->SetMultithreadProtected(true);
 
-    m_item = item;
-    auto itemSize = item.Size();
-    auto inputWidth = EnsureEven(itemSize.Width);
-    auto inputHeight = EnsureEven(itemSize.Height);
     auto outputWidth = EnsureEven(resolution.Width);
     auto outputHeight = EnsureEven(resolution.Height);
 
-    m_frameGenerator = std::make_shared<CaptureFrameGenerator>(m_device, m_item, winrt::SizeInt32{ inputWidth, inputHeight });
-    auto weakPointer{ std::weak_ptr{ m_frameGenerator } };
-    m_itemClosed = item.Closed(winrt::auto_revoke, [weakPointer](auto&, auto&)
-    {
-        auto sharedPointer{ weakPointer.lock() };
+    // Frames are drawn into a BGRA8 texture at the output size, which is then
+    // converted to NV12 for the encoder. HDR content is captured as FP16 and
+    // tone mapped down when we draw it.
+    m_pixelFormat = pixelFormat;
+    m_frameRenderer = std::make_unique<FrameRenderer>(m_d3dDevice);
+    m_outputSize = { outputWidth, outputHeight };
+    m_outputBounds = ComputeRegionRect(LayoutRegion{}, m_outputSize);
+    m_compositor = std::make_unique<FrameCompositor>(m_outputSize);
 
-        if (sharedPointer)
+    if (item != nullptr)
+    {
+        m_item = item;
+        auto itemSize = item.Size();
+        m_frameGenerator = CaptureFrameGenerator::Create(m_device, m_item, winrt::SizeInt32{ EnsureEven(itemSize.Width), EnsureEven(itemSize.Height) }, m_pixelFormat);
+        m_frameSource = m_frameGenerator;
+        auto weakPointer{ std::weak_ptr{ m_frameGenerator } };
+        m_itemClosed = item.Closed(winrt::auto_revoke, [weakPointer](auto&, auto&)
         {
-            sharedPointer->StopCapture();
-        }
-    });
+            auto sharedPointer{ weakPointer.lock() };
+
+            if (sharedPointer)
+            {
+                sharedPointer->StopCapture();
+            }
+        });
+    }
+    else
+    {
+        m_frameSource = frameSource;
+    }
 
     // Describe out output: H264 video with an MP4 container
-    m_encodingProfile = winrt::MediaEncodingProfile();
-    m_encodingProfile.Container().Subtype(L"MPEG4");
-    auto video = m_encodingProfile.Video();
-    video.Subtype(L"H264");
-    video.Width(outputWidth);
-    video.Height(outputHeight);
-    video.Bitrate(bitRate);
-    video.FrameRate().Numerator(frameRate);
-    video.FrameRate().Denominator(1);
-    video.PixelAspectRatio().Numerator(1);
-    video.PixelAspectRatio().Denominator(1);
-    m_encodingProfile.Video(video);
-
-    // Describe our input: uncompressed BGRA8 buffers
-    auto properties = winrt::VideoEncodingProperties::CreateUncompressed(
-        winrt::MediaEncodingSubtypes::Bgra8(),
-        static_cast<uint32_t>(inputWidth),
-        static_cast<uint32_t>(inputHeight));
-    m_videoDescriptor = winrt::VideoStreamDescriptor(properties);
-
-    m_stream = stream;
+    m_nv12Converter = std::make_shared<NV12Converter>(m_d3dDevice, m_d3dContext, m_outputSize, frameRate);
+    m_samplePool = VideoSamplePool::Create(m_nv12Converter, InitialSamplePoolSize);
+    m_encoder = std::make_unique<VideoEncoder>(m_d3dDevice, m_outputSize, bitRate, frameRate);
+    m_keyFrames.reserve(InitialKeyFrameCapacity);
+    m_sinks.AddSink(std::make_shared<Mp4FileSink>(stream), FileSinkQueueOptions);
+
+    D3D11_TEXTURE2D_DESC desc = {};
+    desc.Width = static_cast<uint32_t>(outputWidth);
+    desc.Height = static_cast<uint32_t>(outputHeight);
+    desc.MipLevels = 1;
+    desc.ArraySize = 1;
+    desc.Format = DXGI_FORMAT_B8G8R8A8_UNORM;
+    desc.SampleDesc.Count = 1;
+    desc.Usage = D3D11_USAGE_DEFAULT;
+    desc.BindFlags = D3D11_BIND_SHADER_RESOURCE | D3D11_BIND_RENDER_TARGET;
+    winrt::check_hresult(m_d3dDevice->CreateTexture2D(&desc, nullptr, m_composeTexture.put()));
+    winrt::check_hresult(m_d3dDevice->CreateRenderTargetView(m_composeTexture.get(), nullptr, m_renderTargetView.put()));
 
     m_previewSwapChain = util::CreateDXGISwapChain(
-        m_d3dDevice, 
-        static_cast<uint32_t>(inputWidth),
-        static_cast<uint32_t>(inputHeight),
-        DXGI_FORMAT_B8G8R8A8_UNORM, 
+        m_d3dDevice,
+        static_cast<uint32_t>(outputWidth),
+        static_cast<uint32_t>(outputHeight),
+        DXGI_FORMAT_B8G8R8A8_UNORM,
         2);
-    winrt::com_ptr<ID3D11Texture2D> backBuffer;
-    winrt::check_hresult(m_previewSwapChain->GetBuffer(0, winrt::guid_of<ID3D11Texture2D>(), backBuffer.put_void()));
-    winrt::check_hresult(m_d3dDevice->CreateRenderTargetView(backBuffer.get(), nullptr, m_renderTargetView.put()));
+    winrt::check_hresult(m_previewSwapChain->GetBuffer(0, winrt::guid_of<ID3D11Texture2D>(), m_previewBackBuffer.put_void()));
+    m_copyRects.reserve(MaxFrameDirtyRects);
 }
 
 std::shared_ptr<VideoRecordingSession> VideoRecordingSession::Create(
@@ -106,9 +145,22 @@ std::shared_ptr<VideoRecordingSession> VideoRecordingSession::Create(
     winrt::SizeInt32 const& resolution,
     uint32_t bitRate,
     uint32_t frameRate,
+    winrt::DirectXPixelFormat pixelFormat,
     winrt::Windows::Storage::Streams::IRandomAccessStream const& stream)
 {
-    return std::shared_ptr<VideoRecordingSession>(new VideoRecordingSession(device, item, resolution, bitRate, frameRate, stream));
+    return std::shared_ptr<VideoRecordingSession>(new VideoRecordingSession(device, item, nullptr, resolution, bitRate, frameRate, pixelFormat, stream));
+}
+
+std::shared_ptr<VideoRecordingSession> VideoRecordingSession::CreateFromSource(
+    winrt::IDirect3DDevice const& device,
+    std::shared_ptr<FrameSource> const& frameSource,
+    winrt::SizeInt32 const& resolution,
+    uint32_t bitRate,
+    uint32_t frameRate,
+    winrt::DirectXPixelFormat pixelFormat,
+    winrt::Windows::Storage::Streams::IRandomAccessStream const& stream)
+{
+    return std::shared_ptr<VideoRecordingSession>(new VideoRecordingSession(device, nullptr, frameSource, resolution, bitRate, frameRate, pixelFormat, stream));
 }
 
 VideoRecordingSession::~VideoRecordingSession()
@@ -118,138 +170,624 @@ VideoRecordingSession::~VideoRecordingSession()
 
 winrt::IAsyncAction VideoRecordingSession::StartAsync()
 {
-    auto expected = false;
-    if (m_isRecording.compare_exchange_strong(expected, true))
     {
-        // Create our MediaStreamSource
-        m_streamSource = winrt::MediaStreamSource(m_videoDescriptor);
-        m_streamSource.BufferTime(std::chrono::seconds(0));
-        m_streamSource.Starting({ this, &VideoRecordingSession::OnMediaStreamSourceStarting });
-        m_streamSource.SampleRequested({ this, &VideoRecordingSession::OnMediaStreamSourceSampleRequested });
-
-        // Create our transcoder
-        m_transcoder = winrt::MediaTranscoder();
-        m_transcoder.HardwareAccelerationEnabled(true);
-
-        // Hold a reference to ourselves
-        auto self = shared_from_this();
-
-        // Start encoding
-        auto transcode = co_await m_transcoder.PrepareMediaStreamSourceTranscodeAsync(m_streamSource, m_stream, m_encodingProfile);
-        co_await transcode.TranscodeAsync();
+        auto lock = m_stateLock.lock_exclusive();
+        if (m_state != RecordingState::Created)
+        {
+            co_return;
+        }
+        m_state = RecordingState::Recording;
+    }
+
+    // Hold a reference to ourselves
+    auto self = shared_from_this();
+
+    // The encoder blocks until the capture ends, keep it off the caller's thread
+    co_await winrt::resume_background();
+
+    // Start encoding
+    try
+    {
+        m_encoder->Run(
+            [this]() { return OnEncoderSampleRequested(); },
+            [this](auto const& frame) { OnEncoderFrameEncoded(frame); });
+    }
+    catch (winrt::hresult_error const& error)
+    {
+        OutputDebugStringW(error.message().c_str());
+        Stop(StopMode::Abort);
+    }
+    m_itemClosed.revoke();
+    m_sourceItemsClosed.clear();
+    m_compositor->StopCapture();
+
+    StopMode stopMode;
+    {
+        auto lock = m_stateLock.lock_exclusive();
+        if (m_state == RecordingState::Recording)
+        {
+            // The capture ended on its own (e.g. the window was closed)
+            m_state = RecordingState::Stopping;
+            m_stopRequested = std::chrono::steady_clock::now();
+        }
+        stopMode = m_stopMode;
+    }
+
+    // The last few frames are still waiting to be read back
+    if (stopMode == StopMode::Drain)
+    {
+        for (auto&& readback : { m_exportReadback.get(), m_encoderInputReadback.get(), m_thumbnailReadback.get() })
+        {
+            if (readback)
+            {
+                try
+                {
+                    readback->Flush();
+                }
+                catch (winrt::hresult_error const& error)
+                {
+                    OutputDebugStringW(error.message().c_str());
+                }
+            }
+        }
+    }
+
+    CloseSinks();
+
+    // The recording has to be finalized before we can read its sample table
+    if (m_indexWriter && m_framesEncoded > 0)
+    {
+        try
+        {
+            m_indexWriter->Write(m_recordingPath, GetRecordingIndexPath(m_recordingPath));
+        }
+        catch (winrt::hresult_error const& error)
+        {
+            OutputDebugStringW(error.message().c_str());
+        }
+    }
+
+    {
+        auto lock = m_stateLock.lock_exclusive();
+        m_state = RecordingState::Stopped;
+        m_stopMetrics.Mode = m_stopMode;
+        m_stopMetrics.Latency = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - m_stopRequested);
+        m_stopMetrics.FramesEncoded = m_framesEncoded;
+        m_stopMetrics.FramesDiscarded = m_framesDiscarded;
     }
     co_return;
 }
 
-void VideoRecordingSession::Close()
+void VideoRecordingSession::Stop(StopMode mode)
 {
-    auto expected = false;
-    if (m_closed.compare_exchange_strong(expected, true))
+    auto lock = m_stateLock.lock_exclusive();
+    switch (m_state)
     {
-        expected = true;
-        if (!m_isRecording.compare_exchange_strong(expected, false))
+    case RecordingState::Created:
+        // Nothing has been captured or encoded yet
+        m_state = RecordingState::Stopped;
+        m_stopMode = mode;
+        lock.reset();
+        m_itemClosed.revoke();
+        m_sourceItemsClosed.clear();
+        m_framesDiscarded += m_frameSource->AbortCapture();
+        m_compositor->StopCapture();
+        CloseSinks();
+        return;
+    case RecordingState::Recording:
+        m_state = RecordingState::Stopping;
+        m_stopMode = mode;
+        m_stopRequested = std::chrono::steady_clock::now();
+        break;
+    case RecordingState::Stopping:
+        if (mode == StopMode::Drain || m_stopMode == StopMode::Abort)
         {
-            CloseInternal();
+            return;
         }
-        else
+        m_stopMode = mode;
+        break;
+    case RecordingState::Stopped:
+        return;
+    }
+    lock.reset();
+
+    // Ending the capture makes the encoder's next request for a frame come up
+    // empty. Draining returns the queued frames first.
+    if (mode == StopMode::Abort)
+    {
+        m_encoder->Abort();
+        m_framesDiscarded += m_frameSource->AbortCapture();
+    }
+    else
+    {
+        m_frameSource->StopCapture();
+    }
+}
+
+RecordingStopMetrics VideoRecordingSession::StopMetrics()
+{
+    auto lock = m_stateLock.lock_shared();
+    return m_stopMetrics;
+}
+
+bool VideoRecordingSession::IsCreated()
+{
+    auto lock = m_stateLock.lock_shared();
+    return m_state == RecordingState::Created;
+}
+
+void VideoRecordingSession::CloseSinks()
+{
+    // Each sink's errors are caught and logged on its own thread
+    m_sinks.Close();
+}
+
+void VideoRecordingSession::EnableSharedFrameExport(std::wstring const& name, uint32_t slotCount)
+{
+    WINRT_VERIFY(IsCreated());
+    m_sharedFrameWriter = std::make_unique<SharedFrameRingWriter>(
+        name,
+        slotCount,
+        static_cast<uint32_t>(m_outputSize.Width),
+        static_cast<uint32_t>(m_outputSize.Height));
+
+    // Mapping a frame as soon as it's drawn would wait on the GPU, so frames
+    // are read back a few frames late instead.
+    m_exportReadback = std::make_unique<ReadbackRing>(
+        m_d3dDevice,
+        m_d3dContext,
+        static_cast<uint32_t>(m_outputSize.Width),
+        static_cast<uint32_t>(m_outputSize.Height),
+        DXGI_FORMAT_B8G8R8A8_UNORM,
+        ExportReadbackDepth,
+        [this](ReadbackFrame const& frame)
         {
-            m_frameGenerator->StopCapture();
+            m_sharedFrameWriter->WriteFrame(frame.Data, frame.RowPitch, frame.Width, frame.Height, frame.Timestamp.count());
+        });
+}
+
+void VideoRecordingSession::EnableEncoderInputReadback(ReadbackRing::FrameHandler const& handler)
+{
+    WINRT_VERIFY(IsCreated());
+    m_encoderInputReadback = std::make_unique<ReadbackRing>(
+        m_d3dDevice,
+        m_d3dContext,
+        static_cast<uint32_t>(m_outputSize.Width),
+        static_cast<uint32_t>(m_outputSize.Height),
+        DXGI_FORMAT_NV12,
+        ExportReadbackDepth,
+        handler);
+}
+
+void VideoRecordingSession::EnableRecordingIndex(std::wstring const& recordingPath, winrt::TimeSpan const& thumbnailInterval)
+{
+    WINRT_VERIFY(IsCreated());
+    m_recordingPath = recordingPath;
+    auto thumbnailHeight = static_cast<uint32_t>(EnsureEven(static_cast<int32_t>(ThumbnailWidth * m_outputSize.Height / m_outputSize.Width)));
+    m_indexWriter = std::make_unique<RecordingIndexWriter>(
+        GetRecordingIndexPath(recordingPath) + L".thumbnails",
+        ThumbnailWidth,
+        std::max(thumbnailHeight, 2u),
+        thumbnailInterval);
+
+    D3D11_TEXTURE2D_DESC desc = {};
+    desc.Width = m_indexWriter->ThumbnailWidth();
+    desc.Height = m_indexWriter->ThumbnailHeight();
+    desc.MipLevels = 1;
+    desc.ArraySize = 1;
+    desc.Format = DXGI_FORMAT_B8G8R8A8_UNORM;
+    desc.SampleDesc.Count = 1;
+    desc.Usage = D3D11_USAGE_DEFAULT;
+    desc.BindFlags = D3D11_BIND_RENDER_TARGET;
+    winrt::check_hresult(m_d3dDevice->CreateTexture2D(&desc, nullptr, m_thumbnailTexture.put()));
+    winrt::check_hresult(m_d3dDevice->CreateRenderTargetView(m_thumbnailTexture.get(), nullptr, m_thumbnailRenderTargetView.put()));
+
+    // Thumbnails are taken rarely, but there's still no reason to wait on them
+    m_thumbnailReadback = std::make_unique<ReadbackRing>(
+        m_d3dDevice,
+        m_d3dContext,
+        desc.Width,
+        desc.Height,
+        desc.Format,
+        2,
+        [this](ReadbackFrame const& frame) { m_indexWriter->AddThumbnail(frame); });
+}
+
+std::shared_ptr<RtpStreamSink> VideoRecordingSession::EnableRtpStreaming(std::wstring const& host, uint16_t port)
+{
+    WINRT_VERIFY(IsCreated());
+    auto sink = std::make_shared<RtpStreamSink>(host, port);
+    m_sinks.AddSink(sink, RtpSinkQueueOptions);
+    return sink;
+}
+
+void VideoRecordingSession::AddSink(std::shared_ptr<EncodedFrameSink> const& sink, SinkQueueOptions const& options)
+{
+    WINRT_VERIFY(IsCreated());
+    m_sinks.AddSink(sink, options);
+}
+
+void VideoRecordingSession::SetKeyFrameInterval(winrt::TimeSpan const& interval)
+{
+    WINRT_VERIFY(IsCreated());
+    m_encoder->SetKeyFrameInterval(interval);
+}
+
+void VideoRecordingSession::SetLayoutRegion(LayoutRegion const& region)
+{
+    WINRT_VERIFY(IsCreated());
+    m_outputBounds = ComputeRegionRect(region, m_outputSize);
+}
+
+void VideoRecordingSession::AddSource(winrt::GraphicsCaptureItem const& item, LayoutRegion const& region)
+{
+    WINRT_VERIFY(IsCreated());
+    auto itemSize = item.Size();
+    auto generator = CaptureFrameGenerator::Create(m_device, item, winrt::SizeInt32{ EnsureEven(itemSize.Width), EnsureEven(itemSize.Height) }, m_pixelFormat);
+    auto weakPointer{ std::weak_ptr{ generator } };
+    m_sourceItemsClosed.push_back(item.Closed(winrt::auto_revoke, [weakPointer](auto&, auto&)
+    {
+        auto sharedPointer{ weakPointer.lock() };
+
+        if (sharedPointer)
+        {
+            sharedPointer->StopCapture();
         }
+    }));
+    m_compositor->AddSource(generator, region);
+}
+
+void VideoRecordingSession::EnableTimelapse(winrt::TimeSpan const& interval)
+{
+    WINRT_VERIFY(IsCreated() && m_frameGenerator);
+    m_frameGenerator->EnableTimelapse(interval, m_frameRate);
+    m_isTimelapse = true;
+}
+
+void VideoRecordingSession::SetToneMapSettings(ToneMapSettings const& settings)
+{
+    WINRT_VERIFY(IsCreated());
+    m_frameRenderer->ToneMap(settings);
+}
+
+void VideoRecordingSession::EnableCaptureTrace(std::wstring const& path, bool includePixels)
+{
+    WINRT_VERIFY(IsCreated() && m_frameGenerator);
+    m_frameGenerator->EnableTrace(std::make_shared<CaptureTraceWriter>(path, static_cast<DXGI_FORMAT>(m_pixelFormat), includePixels));
+}
+
+std::vector<KeyFrameInfo> VideoRecordingSession::KeyFrames()
+{
+    auto lock = m_keyFramesLock.lock_shared();
+    return m_keyFrames;
+}
+
+FrameCopyMetrics VideoRecordingSession::CopyMetrics()
+{
+    auto lock = m_copyMetricsLock.lock_shared();
+    return m_copyMetrics;
+}
+
+void VideoRecordingSession::RecordFrameCopy(uint64_t bytesCopied, double dirtyRatio, bool incremental)
+{
+    auto lock = m_copyMetricsLock.lock_exclusive();
+    auto& metrics = m_copyMetrics;
+    metrics.Frames++;
+    if (incremental)
+    {
+        metrics.IncrementalFrames++;
     }
+    metrics.LastBytesCopied = bytesCopied;
+    metrics.TotalBytesCopied += bytesCopied;
+    metrics.LastDirtyRatio = dirtyRatio;
+    metrics.AverageDirtyRatio += (dirtyRatio - metrics.AverageDirtyRatio) / static_cast<double>(metrics.Frames);
 }
 
-void VideoRecordingSession::CloseInternal()
+void VideoRecordingSession::RecordFrameAllocations(uint64_t allocations, bool expected)
 {
-    m_frameGenerator->StopCapture();
-    m_itemClosed.revoke();
+    if (allocations > 0)
+    {
+        auto lock = m_copyMetricsLock.lock_exclusive();
+        auto& metrics = m_copyMetrics;
+        // Something on the per-frame path has started allocating again
+        WINRT_ASSERT(expected || metrics.Frames <= AllocationWarmUpFrames);
+        metrics.Allocations += allocations;
+        metrics.FramesWithAllocations++;
+        metrics.LastAllocatingFrame = metrics.Frames;
+    }
+}
+
+std::optional<CapturedFrame> VideoRecordingSession::WaitForFrameToCompose()
+{
+    // A timelapse only keeps the frames its own item produces
+    auto repeatsItemFrame = m_compositor->SourceCount() > 0 && !m_isTimelapse;
+    auto hasReadbacks = m_exportReadback || m_encoderInputReadback || m_thumbnailReadback;
+    if (!repeatsItemFrame && !hasReadbacks)
+    {
+        return m_frameSource->TryGetNextFrame();
+    }
+
+    // The other sources have to keep updating while the item has nothing
+    // new, e.g. a video drawn over a window that doesn't change. They're
+    // checked once per output frame, and when one of them has something the
+    // item's last frame is drawn under it again. Frames still being read
+    // back are handed over on the same ticks once they're old enough.
+    auto frameDuration = std::chrono::milliseconds(std::max(1u, 1000 / m_frameRate));
+    while (!m_frameSource->WaitForNextFrame(frameDuration))
+    {
+        DeliverStaleReadbacks();
+        if (repeatsItemFrame && m_lastItemFrame.has_value() && m_compositor->UpdateFrames(m_frameRenderer.get()))
+        {
+            auto frame = m_lastItemFrame.value();
+            frame.Timestamp = GetSystemRelativeTime();
+            frame.CaptureTime = frame.Timestamp;
+            frame.HasDirtyRects = false;
+            m_lastRepeatTimestamp = frame.Timestamp;
+            return frame;
+        }
+    }
+    auto frame = m_frameSource->TryGetNextFrame();
+    if (repeatsItemFrame)
+    {
+        // Releases the last frame once the capture has stopped
+        m_lastItemFrame = frame;
+    }
+    // A frame captured just before a repeat can arrive just after it, and
+    // the encoder needs its timestamps in order.
+    if (frame.has_value() && frame->Timestamp <= m_lastRepeatTimestamp)
+    {
+        frame->Timestamp = m_lastRepeatTimestamp + winrt::TimeSpan{ 1 };
+    }
+    return frame;
 }
 
-void VideoRecordingSession::OnMediaStreamSourceStarting(
-    winrt::MediaStreamSource const&, 
-    winrt::MediaStreamSourceStartingEventArgs const& args)
+void VideoRecordingSession::DeliverStaleReadbacks()
 {
-    // Fast users may end the recording before we've received a frame.
-    if (auto frame = m_frameGenerator->TryGetNextFrame())
+    for (auto&& readback : { m_exportReadback.get(), m_encoderInputReadback.get(), m_thumbnailReadback.get() })
     {
-        args.Request().SetActualStartPosition(frame->SystemRelativeTime());
+        if (readback)
+        {
+            try
+            {
+                readback->DeliverStale(MaxReadbackAge);
+            }
+            catch (winrt::hresult_error const& error)
+            {
+                OutputDebugStringW(error.message().c_str());
+            }
+        }
     }
 }
 
-void VideoRecordingSession::OnMediaStreamSourceSampleRequested(
-    winrt::MediaStreamSource const&, 
-    winrt::MediaStreamSourceSampleRequestedEventArgs const& args)
+std::optional<VideoEncoderInputSample> VideoRecordingSession::OnEncoderSampleRequested()
 {
-    auto request = args.Request();
-    if (auto frame = m_frameGenerator->TryGetNextFrame())
+    if (auto frame = WaitForFrameToCompose())
     {
         try
         {
-            auto timeStamp = frame->SystemRelativeTime();
-            auto contentSize = frame->ContentSize();
-            auto frameTexture = GetDXGIInterfaceFromObject<ID3D11Texture2D>(frame->Surface());
+            auto allocationsBefore = GetThreadAllocationCount();
+            auto viewsCreatedBefore = m_frameRenderer->ViewsCreated();
+            auto samplePoolSizeBefore = m_samplePool->Count();
+            auto tookThumbnail = false;
+            auto timeStamp = frame->Timestamp;
+            auto contentSize = frame->ContentSize;
+            auto frameTexture = frame->Texture;
+            if (frame->TextureGeneration != m_textureGeneration)
+            {
+                // Don't keep the previous frame pool's textures alive
+                m_textureGeneration = frame->TextureGeneration;
+                m_frameRenderer->ReleaseCachedViews();
+            }
             D3D11_TEXTURE2D_DESC desc = {};
             frameTexture->GetDesc(&desc);
 
-            // TODO: Update preview
-            winrt::com_ptr<ID3D11Texture2D> backBuffer;
-            winrt::check_hresult(m_previewSwapChain->GetBuffer(0, winrt::guid_of<ID3D11Texture2D>(), backBuffer.put_void()));
-
-            // In order to support window resizing, we need to only copy out the part of
-            // the buffer that contains the window. If the window is smaller than the buffer,
-            // then it's a straight forward copy using the ContentSize. If the window is larger,
-            // we need to clamp to the size of the buffer. For simplicity, we always clamp.
-            auto width = std::clamp(contentSize.Width, 0, static_cast<int32_t>(desc.Width));
-            auto height = std::clamp(contentSize.Height, 0, static_cast<int32_t>(desc.Height));
-
-            D3D11_BOX region = {};
-            region.left = 0;
-            region.right = width;
-            region.top = 0;
-            region.bottom = height;
-            region.back = 1;
-
-            m_d3dContext->ClearRenderTargetView(m_renderTargetView.get(), CLEARCOLOR);
-            m_d3dContext->CopySubresourceRegion(
-                backBuffer.get(),
-                0,
-                0, 0, 0,
-                frameTexture.get(),
-                0,
-                &region);
-
-            // CopyResource can fail if our new texture isn't the same size as the back buffer
-            // TODO: Fix how resolutions are handled
-            desc = {};
-            backBuffer->GetDesc(&desc);
-
-            desc.Usage = D3D11_USAGE_DEFAULT;
-            desc.BindFlags = D3D11_BIND_SHADER_RESOURCE | D3D11_BIND_RENDER_TARGET;
-            desc.CPUAccessFlags = 0;
-            desc.MiscFlags = 0;
-            winrt::com_ptr<ID3D11Texture2D> sampleTexture;
-            winrt::check_hresult(m_d3dDevice->CreateTexture2D(&desc, nullptr, sampleTexture.put()));
-            m_d3dContext->CopyResource(sampleTexture.get(), backBuffer.get());
-            auto dxgiSurface = sampleTexture.as<IDXGISurface>();
-            auto sampleSurface = CreateDirect3DSurface(dxgiSurface.get());
+            // The window may have been resized since we started. The frame pool gets
+            // recreated to follow the content, but the encoder's input size is fixed,
+            // so fit the content into it. When nothing needs to be scaled or converted
+            // a straight copy is all we need.
+            auto sourceRect = ComputeSourceRect(contentSize, desc);
+            auto sourceWidth = sourceRect.right - sourceRect.left;
+            auto sourceHeight = sourceRect.bottom - sourceRect.top;
+            auto destinationRect = ComputeDestinationRect({ sourceWidth, sourceHeight }, m_outputBounds, m_resizeMode);
+            auto toneMap = m_pixelFormat == winrt::DirectXPixelFormat::R16G16B16A16Float;
+            auto needsScaling = sourceWidth != destinationRect.right - destinationRect.left ||
+                sourceHeight != destinationRect.bottom - destinationRect.top;
+            auto sourceArea = static_cast<int64_t>(sourceWidth) * static_cast<int64_t>(sourceHeight);
+            auto bytesPerPixel = GetBytesPerPixel(desc.Format);
+
+            // If the last frame was copied to the same place and nothing else was
+            // drawn, the compose texture already holds everything that didn't change.
+            auto copyDirtyRects = !toneMap && !needsScaling && sourceArea > 0 &&
+                frame->HasDirtyRects &&
+                m_compositor->SourceCount() == 0 &&
+                m_composedCopyRect.has_value() &&
+                m_composedCopyRect->left == destinationRect.left &&
+                m_composedCopyRect->top == destinationRect.top &&
+                m_composedCopyRect->right == destinationRect.right &&
+                m_composedCopyRect->bottom == destinationRect.bottom;
+
+            if (!copyDirtyRects)
+            {
+                m_d3dContext->ClearRenderTargetView(m_renderTargetView.get(), CLEARCOLOR);
+            }
+            m_composedCopyRect = std::nullopt;
+
+            if (sourceArea <= 0)
+            {
+                // Nothing to draw (e.g. the window is minimized)
+                RecordFrameCopy(0, 0.0, false);
+            }
+            else if (toneMap || needsScaling)
+            {
+                m_frameRenderer->Render(
+                    m_d3dContext.get(),
+                    frameTexture.get(),
+                    sourceRect,
+                    m_renderTargetView.get(),
+                    destinationRect,
+                    toneMap);
+                RecordFrameCopy(static_cast<uint64_t>(sourceArea) * bytesPerPixel, 1.0, false);
+            }
+            else
+            {
+                // Without dirty regions we have to assume the whole frame changed
+                auto& copyRects = m_copyRects;
+                copyRects.clear();
+                if (copyDirtyRects)
+                {
+                    copyRects.insert(copyRects.end(), frame->DirtyRects.begin(), frame->DirtyRects.begin() + frame->DirtyRectCount);
+                    ClipRects(copyRects, sourceRect);
+                    CoalesceRects(copyRects, MaxDirtyRects);
+                }
+                else
+                {
+                    copyRects.push_back(sourceRect);
+                }
+
+                for (auto&& rect : copyRects)
+                {
+                    D3D11_BOX region = {};
+                    region.left = rect.left;
+                    region.right = rect.right;
+                    region.top = rect.top;
+                    region.bottom = rect.bottom;
+                    region.back = 1;
+
+                    m_d3dContext->CopySubresourceRegion(
+                        m_composeTexture.get(),
+                        0,
+                        destinationRect.left + rect.left - sourceRect.left,
+                        destinationRect.top + rect.top - sourceRect.top,
+                        0,
+                        frameTexture.get(),
+                        0,
+                        &region);
+                }
+                m_composedCopyRect = destinationRect;
 
+                auto copiedArea = ComputeTotalArea(copyRects);
+                RecordFrameCopy(
+                    static_cast<uint64_t>(copiedArea) * bytesPerPixel,
+                    static_cast<double>(copiedArea) / static_cast<double>(sourceArea),
+                    copyDirtyRects);
+            }
+
+            // Any other sources are drawn on top, using whatever they captured last
+            if (m_compositor->SourceCount() > 0)
+            {
+                m_composedCopyRect = std::nullopt;
+                m_compositor->UpdateFrames(m_frameRenderer.get());
+                m_compositor->Compose(
+                    m_d3dContext.get(),
+                    m_frameRenderer.get(),
+                    m_renderTargetView.get(),
+                    m_resizeMode,
+                    toneMap);
+            }
+
+            // The encoder may hold on to its input for a few frames, so each frame
+            // gets its own NV12 texture from the pool.
+            auto pooledSample = m_samplePool->Acquire();
+            m_nv12Converter->Convert(m_composeTexture.get(), pooledSample.OutputView.get());
+
+            if (m_exportReadback)
+            {
+                m_exportReadback->Submit(m_composeTexture.get(), frame->CaptureTime);
+            }
+
+            m_d3dContext->CopyResource(m_previewBackBuffer.get(), m_composeTexture.get());
             DXGI_PRESENT_PARAMETERS presentParameters{};
             winrt::check_hresult(m_previewSwapChain->Present1(0, 0, &presentParameters));
 
-            auto sample = winrt::MediaStreamSample::CreateFromDirect3D11Surface(sampleSurface, timeStamp);
-            request.Sample(sample);
+            if (!m_firstTimestamp.has_value())
+            {
+                m_firstTimestamp = timeStamp;
+            }
+            VideoEncoderInputSample sample;
+            sample.Sample = std::move(pooledSample.Sample);
+            sample.Timestamp = timeStamp - m_firstTimestamp.value();
+            if (m_pendingCaptureTimes.IsFull())
+            {
+                m_pendingCaptureTimes.PopFront();
+            }
+            m_pendingCaptureTimes.TryPushBack({ sample.Timestamp, frame->CaptureTime });
+
+            if (m_encoderInputReadback)
+            {
+                m_encoderInputReadback->Submit(pooledSample.Texture.get(), sample.Timestamp);
+            }
+
+            if (m_indexWriter && (!m_lastThumbnailTimestamp.has_value() ||
+                sample.Timestamp - m_lastThumbnailTimestamp.value() >= m_indexWriter->ThumbnailInterval()))
+            {
+                m_lastThumbnailTimestamp = sample.Timestamp;
+                tookThumbnail = true;
+                D3D11_RECT thumbnailRect = { 0, 0, static_cast<LONG>(m_indexWriter->ThumbnailWidth()), static_cast<LONG>(m_indexWriter->ThumbnailHeight()) };
+                m_frameRenderer->Render(
+                    m_d3dContext.get(),
+                    m_composeTexture.get(),
+                    ComputeRegionRect(LayoutRegion{}, m_outputSize),
+                    m_thumbnailRenderTargetView.get(),
+                    thumbnailRect,
+                    false);
+                m_thumbnailReadback->Submit(m_thumbnailTexture.get(), sample.Timestamp);
+            }
+            // Caches and pools that had to grow, and the thumbnail index, are
+            // allowed to allocate
+            auto allocationsExpected = tookThumbnail ||
+                m_frameRenderer->ViewsCreated() != viewsCreatedBefore ||
+                m_samplePool->Count() != samplePoolSizeBefore;
+            RecordFrameAllocations(GetThreadAllocationCount() - allocationsBefore, allocationsExpected);
+            return sample;
         }
         catch (winrt::hresult_error const& error)
         {
             OutputDebugStringW(error.message().c_str());
-            request.Sample(nullptr);
-            CloseInternal();
-            return;
+            Stop(StopMode::Abort);
+            return std::nullopt;
         }
     }
     else
     {
-        request.Sample(nullptr);
-        CloseInternal();
+        // The capture has stopped and every queued frame has been encoded
+        return std::nullopt;
+    }
+}
+
+void VideoRecordingSession::OnEncoderFrameEncoded(EncodedFrame const& frame)
+{
+    auto encodedFrame = frame;
+    encodedFrame.CaptureTime = frame.Timestamp + m_firstTimestamp.value_or(winrt::TimeSpan{});
+    // Encoders that reorder frames hand them back out of order, so only the
+    // matching entry is taken out. Any the encoder never returns are pushed
+    // out by newer ones once the queue is full.
+    auto pendingCount = m_pendingCaptureTimes.Size();
+    for (size_t i = 0; i < pendingCount; i++)
+    {
+        auto pending = m_pendingCaptureTimes.PopFront();
+        if (pending.Timestamp == frame.Timestamp)
+        {
+            encodedFrame.CaptureTime = pending.CaptureTime;
+        }
+        else
+        {
+            m_pendingCaptureTimes.TryPushBack(std::move(pending));
+        }
+    }
+    if (frame.IsKeyFrame)
+    {
+        auto lock = m_keyFramesLock.lock_exclusive();
+        m_keyFrames.push_back({ frame.Timestamp, frame.IsRequestedKeyFrame });
+    }
+    m_framesEncoded++;
+    m_sinks.OnFrameEncoded(encodedFrame);
+
+    // Only a failure cuts the file off. There's no point in going on
+    // without it, what was written so far is finalized.
+    if (m_sinks.Metrics(FileSinkIndex).IsDisconnected)
+    {
+        OutputDebugStringW(L"Writing the recording failed, stopping\n");
+        Stop(StopMode::Abort);
     }
 }
 
@@ -1,5 +1,60 @@
 #pragma once
 #include "CaptureFrameGenerator.h"
+#include "FrameRenderer.h"
+#include "FrameGeometry.h"
+#include "FrameCompositor.h"
+#include "SharedFrameRing.h"
+#include "VideoEncoder.h"
+#include "NV12Converter.h"
+#include "VideoSamplePool.h"
+#include "RtpStreamSink.h"
+#include "EncodedFrameTee.h"
+#include "ReadbackRing.h"
+#include "RecordingIndex.h"
+
+enum class StopMode
+{
+    // Encode every frame that has already been captured, then finalize.
+    Drain,
+    // Discard queued frames and whatever the encoder is holding, then
+    // finalize what has already been written.
+    Abort,
+};
+
+struct RecordingStopMetrics
+{
+    StopMode Mode = StopMode::Drain;
+    // From the stop request until every sink has been closed
+    std::chrono::microseconds Latency = {};
+    uint64_t FramesEncoded = 0;
+    uint64_t FramesDiscarded = 0;
+};
+
+struct KeyFrameInfo
+{
+    // Relative to the start of the recording
+    winrt::Windows::Foundation::TimeSpan Timestamp = {};
+    // True if the keyframe came from RequestKeyFrame rather than the interval
+    bool WasRequested = false;
+};
+
+struct FrameCopyMetrics
+{
+    uint64_t Frames = 0;
+    // Frames where only what changed was copied
+    uint64_t IncrementalFrames = 0;
+    uint64_t LastBytesCopied = 0;
+    uint64_t TotalBytesCopied = 0;
+    // How much of the captured content was copied, 1.0 for a full copy
+    double LastDirtyRatio = 0.0;
+    double AverageDirtyRatio = 0.0;
+    // Heap allocations made while preparing frames for the encoder. Only
+    // counted in debug builds, see AllocationCounter.h.
+    uint64_t Allocations = 0;
+    uint64_t FramesWithAllocations = 0;
+    // 1-based, 0 if no frame has allocated
+    uint64_t LastAllocatingFrame = 0;
+};
 
 class VideoRecordingSession : public std::enable_shared_from_this<VideoRecordingSession>
 {
@@ -10,48 +65,169 @@ public:
         winrt::Windows::Graphics::SizeInt32 const& resolution,
         uint32_t bitRate,
         uint32_t frameRate,
+        winrt::Windows::Graphics::DirectX::DirectXPixelFormat pixelFormat,
+        winrt::Windows::Storage::Streams::IRandomAccessStream const& stream);
+    // Records frames from something other than a capture, e.g. a trace replay.
+    [[nodiscard]] static std::shared_ptr<VideoRecordingSession> CreateFromSource(
+        winrt::Windows::Graphics::DirectX::Direct3D11::IDirect3DDevice const& device,
+        std::shared_ptr<FrameSource> const& frameSource,
+        winrt::Windows::Graphics::SizeInt32 const& resolution,
+        uint32_t bitRate,
+        uint32_t frameRate,
+        winrt::Windows::Graphics::DirectX::DirectXPixelFormat pixelFormat,
         winrt::Windows::Storage::Streams::IRandomAccessStream const& stream);
     ~VideoRecordingSession();
 
+    // Completes once the recording has stopped and every sink has been closed.
     winrt::Windows::Foundation::IAsyncAction StartAsync();
-    void Close();
+    // Can be called from any thread, and more than once. A drain can be
+    // turned into an abort if it's taking too long.
+    void Stop(StopMode mode);
+    void Close() { Stop(StopMode::Abort); }
+    // Only valid once StartAsync has completed.
+    RecordingStopMetrics StopMetrics();
     winrt::Windows::UI::Composition::ICompositionSurface CreatePreviewSurface(winrt::Windows::UI::Composition::Compositor const& compositor);
+    void SetResizeMode(ResizeMode mode) { m_resizeMode = mode; }
+    // Where the item the session was created with is drawn. Defaults to the whole output.
+    void SetLayoutRegion(LayoutRegion const& region);
+    // Adds another item to draw on top of the first, in the given region.
+    void AddSource(winrt::Windows::Graphics::Capture::GraphicsCaptureItem const& item, LayoutRegion const& region);
+    // These must be called before StartAsync.
+    // How HDR content is brought down to SDR, see GetMonitorToneMapSettings.
+    void SetToneMapSettings(ToneMapSettings const& settings);
+    void EnableSharedFrameExport(std::wstring const& name, uint32_t slotCount);
+    std::shared_ptr<RtpStreamSink> EnableRtpStreaming(std::wstring const& host, uint16_t port);
+    // Every sink gets the same encoded frames through its own queue, see
+    // EncodedFrameTee. The recording's own file is always the first sink.
+    void AddSink(std::shared_ptr<EncodedFrameSink> const& sink, SinkQueueOptions const& options);
+    // Hands each frame to the handler exactly as the encoder received it, as
+    // NV12 (the luma plane followed by the interleaved chroma plane), a few
+    // frames after it was encoded. Timestamps are relative to the start.
+    void EnableEncoderInputReadback(ReadbackRing::FrameHandler const& handler);
+    // Writes a seek index and a sprite sheet with a thumbnail every interval
+    // next to the recording once it has been finalized. The stream the
+    // session was created with must be the file at recordingPath.
+    void EnableRecordingIndex(std::wstring const& recordingPath, winrt::Windows::Foundation::TimeSpan const& thumbnailInterval);
+    // Keeps one frame per interval and plays them back at the output frame rate.
+    void EnableTimelapse(winrt::Windows::Foundation::TimeSpan const& interval);
+    void SetKeyFrameInterval(winrt::Windows::Foundation::TimeSpan const& interval);
+    // The next captured frame will be encoded as a keyframe.
+    void RequestKeyFrame() { m_encoder->RequestKeyFrame(); }
+    std::vector<KeyFrameInfo> KeyFrames();
+    // Records the timing of every frame the capture produces to a file.
+    void EnableCaptureTrace(std::wstring const& path, bool includePixels);
+    FrameCopyMetrics CopyMetrics();
+    // How long exporting frames had to wait on the GPU
+    ReadbackMetrics ExportMetrics() { return m_exportReadback ? m_exportReadback->Metrics() : ReadbackMetrics{}; }
+    // In the order the sinks were added, the recording's own file first
+    size_t SinkCount() { return m_sinks.SinkCount(); }
+    SinkQueueMetrics SinkMetrics(size_t index) { return m_sinks.Metrics(index); }
+    // Only grows while the encoder holds on to more frames than it has so far.
+    size_t SamplePoolSize() { return m_samplePool->Count(); }
+    FramePoolResizeMetrics ResizeMetrics() { return m_frameGenerator ? m_frameGenerator->ResizeMetrics() : FramePoolResizeMetrics{}; }
 
 private:
+    enum class RecordingState
+    {
+        Created,
+        Recording,
+        Stopping,
+        Stopped,
+    };
+
     VideoRecordingSession(
         winrt::Windows::Graphics::DirectX::Direct3D11::IDirect3DDevice const& device,
         winrt::Windows::Graphics::Capture::GraphicsCaptureItem const& item,
+        std::shared_ptr<FrameSource> const& frameSource,
         winrt::Windows::Graphics::SizeInt32 const& resolution,
         uint32_t bitRate,
         uint32_t frameRate,
+        winrt::Windows::Graphics::DirectX::DirectXPixelFormat pixelFormat,
         winrt::Windows::Storage::Streams::IRandomAccessStream const& stream);
-    void CloseInternal();
+    bool IsCreated();
+    void CloseSinks();
+    void RecordFrameCopy(uint64_t bytesCopied, double dirtyRatio, bool incremental);
+    // Asserts in debug builds if a frame allocated after the first few
+    // without a reason to.
+    void RecordFrameAllocations(uint64_t allocations, bool expected);
+    std::optional<CapturedFrame> WaitForFrameToCompose();
+    void DeliverStaleReadbacks();
 
-    void OnMediaStreamSourceStarting(
-        winrt::Windows::Media::Core::MediaStreamSource const& sender,
-        winrt::Windows::Media::Core::MediaStreamSourceStartingEventArgs const& args);
-    void OnMediaStreamSourceSampleRequested(
-        winrt::Windows::Media::Core::MediaStreamSource const& sender,
-        winrt::Windows::Media::Core::MediaStreamSourceSampleRequestedEventArgs const& args);
+    std::optional<VideoEncoderInputSample> OnEncoderSampleRequested();
+    void OnEncoderFrameEncoded(EncodedFrame const& frame);
 
 private:
+    // More than any encoder holds on to
+    static const size_t MaxPendingCaptureTimes = 32;
+
     winrt::Windows::Graphics::DirectX::Direct3D11::IDirect3DDevice m_device{ nullptr };
     winrt::com_ptr<ID3D11Device> m_d3dDevice;
     winrt::com_ptr<ID3D11DeviceContext> m_d3dContext;
 
     winrt::Windows::Graphics::Capture::GraphicsCaptureItem m_item{ nullptr };
     winrt::Windows::Graphics::Capture::GraphicsCaptureItem::Closed_revoker m_itemClosed;
+    std::shared_ptr<FrameSource> m_frameSource;
+    // Only set when recording a capture item
     std::shared_ptr<CaptureFrameGenerator> m_frameGenerator;
+    winrt::Windows::Graphics::DirectX::DirectXPixelFormat m_pixelFormat = winrt::Windows::Graphics::DirectX::DirectXPixelFormat::B8G8R8A8UIntNormalized;
+    std::unique_ptr<FrameRenderer> m_frameRenderer;
+    winrt::Windows::Graphics::SizeInt32 m_outputSize = {};
+    uint32_t m_frameRate = 0;
+    std::atomic<ResizeMode> m_resizeMode = ResizeMode::Letterbox;
+    D3D11_RECT m_outputBounds = {};
+    std::unique_ptr<FrameCompositor> m_compositor;
+    // Drawn again under the other sources when only they have changed
+    std::optional<CapturedFrame> m_lastItemFrame;
+    winrt::Windows::Foundation::TimeSpan m_lastRepeatTimestamp = {};
+    bool m_isTimelapse = false;
+    std::vector<winrt::Windows::Graphics::Capture::GraphicsCaptureItem::Closed_revoker> m_sourceItemsClosed;
 
-    winrt::Windows::Storage::Streams::IRandomAccessStream m_stream{ nullptr };
-    winrt::Windows::Media::MediaProperties::MediaEncodingProfile m_encodingProfile{ nullptr };
-    winrt::Windows::Media::Core::VideoStreamDescriptor m_videoDescriptor{ nullptr };
-    winrt::Windows::Media::Core::MediaStreamSource m_streamSource{ nullptr };
-    winrt::Windows::Media::Transcoding::MediaTranscoder m_transcoder{ nullptr };
+    std::shared_ptr<NV12Converter> m_nv12Converter;
+    std::shared_ptr<VideoSamplePool> m_samplePool;
+    std::unique_ptr<VideoEncoder> m_encoder;
+    EncodedFrameTee m_sinks;
+    std::optional<winrt::Windows::Foundation::TimeSpan> m_firstTimestamp;
+    uint32_t m_textureGeneration = 0;
+    // Frames the encoder hasn't returned yet. In a timelapse the timestamps
+    // the encoder sees have nothing to do with when the frames were captured.
+    struct PendingCaptureTime
+    {
+        winrt::Windows::Foundation::TimeSpan Timestamp = {};
+        winrt::Windows::Foundation::TimeSpan CaptureTime = {};
+    };
+    BoundedQueue<PendingCaptureTime> m_pendingCaptureTimes{ MaxPendingCaptureTimes };
+    wil::srwlock m_keyFramesLock;
+    std::vector<KeyFrameInfo> m_keyFrames;
 
-    winrt::com_ptr<IDXGISwapChain1> m_previewSwapChain;
+    std::unique_ptr<SharedFrameRingWriter> m_sharedFrameWriter;
+    std::unique_ptr<ReadbackRing> m_exportReadback;
+    std::unique_ptr<ReadbackRing> m_encoderInputReadback;
+
+    std::wstring m_recordingPath;
+    std::unique_ptr<RecordingIndexWriter> m_indexWriter;
+    winrt::com_ptr<ID3D11Texture2D> m_thumbnailTexture;
+    winrt::com_ptr<ID3D11RenderTargetView> m_thumbnailRenderTargetView;
+    std::unique_ptr<ReadbackRing> m_thumbnailReadback;
+    std::optional<winrt::Windows::Foundation::TimeSpan> m_lastThumbnailTimestamp;
+
+    winrt::com_ptr<ID3D11Texture2D> m_composeTexture;
     winrt::com_ptr<ID3D11RenderTargetView> m_renderTargetView;
+    // Where the last straight copy put its frame, if the compose texture
+    // still holds nothing else
+    std::optional<D3D11_RECT> m_composedCopyRect;
+    // Reused from frame to frame
+    std::vector<D3D11_RECT> m_copyRects;
+    wil::srwlock m_copyMetricsLock;
+    FrameCopyMetrics m_copyMetrics;
+    winrt::com_ptr<IDXGISwapChain1> m_previewSwapChain;
+    // With a flip model swap chain, buffer 0 is always the one we draw to next
+    winrt::com_ptr<ID3D11Texture2D> m_previewBackBuffer;
 
-    std::atomic<bool> m_isRecording = false;
-    std::atomic<bool> m_closed = false;
+    wil::srwlock m_stateLock;
+    RecordingState m_state = RecordingState::Created;
+    StopMode m_stopMode = StopMode::Drain;
+    std::chrono::steady_clock::time_point m_stopRequested = {};
+    RecordingStopMetrics m_stopMetrics;
+    uint64_t m_framesEncoded = 0;
+    std::atomic<uint64_t> m_framesDiscarded = 0;
 };
\ No newline at end of file
@@ -0,0 +1,122 @@
+#include "pch.h"
+#include "VideoSamplePool.h"
+
+// Tracked samples call this once their last reference is released, handing
+// the sample back to us as the result's object.
+struct SampleReturnedCallback : winrt::implements<SampleReturnedCallback, IMFAsyncCallback>
+{
+    SampleReturnedCallback(std::weak_ptr<VideoSamplePool> const& pool, size_t index)
+    {
+        m_pool = pool;
+        m_index = index;
+    }
+
+    IFACEMETHODIMP GetParameters(DWORD*, DWORD*) override
+    {
+        return E_NOTIMPL;
+    }
+
+    IFACEMETHODIMP Invoke(IMFAsyncResult* result) noexcept override
+    {
+        // The pool may already be gone, in which case the sample is released
+        if (auto pool = m_pool.lock())
+        {
+            winrt::com_ptr<IUnknown> object;
+            if (SUCCEEDED(result->GetObject(object.put())))
+            {
+                pool->OnSampleReturned(m_index, object.as<IMFSample>());
+            }
+        }
+        return S_OK;
+    }
+
+private:
+    std::weak_ptr<VideoSamplePool> m_pool;
+    size_t m_index = 0;
+};
+
+VideoSamplePool::VideoSamplePool(std::shared_ptr<NV12Converter> const& converter)
+{
+    m_converter = converter;
+}
+
+std::shared_ptr<VideoSamplePool> VideoSamplePool::Create(
+    std::shared_ptr<NV12Converter> const& converter,
+    size_t initialCount)
+{
+    auto pool = std::shared_ptr<VideoSamplePool>(new VideoSamplePool(converter));
+    auto lock = pool->m_lock.lock_exclusive();
+    pool->m_slots.reserve(initialCount);
+    pool->m_freeSlots.reserve(initialCount);
+    for (size_t i = 0; i < initialCount; i++)
+    {
+        pool->AddSlot();
+    }
+    return pool;
+}
+
+PooledVideoSample VideoSamplePool::Acquire()
+{
+    auto lock = m_lock.lock_exclusive();
+    if (m_freeSlots.empty())
+    {
+        AddSlot();
+
+        std::wstringstream stream;
+        stream << L"Grew the video sample pool to " << m_slots.size() << L" samples" << std::endl;
+        OutputDebugStringW(stream.str().c_str());
+    }
+
+    auto index = m_freeSlots.back();
+    auto& slot = m_slots[index];
+    // The callback is only good for one release, so it's set every time
+    winrt::check_hresult(slot.Sample.as<IMFTrackedSample>()->SetAllocator(slot.Callback.get(), nullptr));
+    m_freeSlots.pop_back();
+
+    PooledVideoSample result;
+    result.Sample = std::move(slot.Sample);
+    result.Texture = slot.Texture;
+    result.OutputView = slot.OutputView;
+    return result;
+}
+
+size_t VideoSamplePool::Count()
+{
+    auto lock = m_lock.lock_shared();
+    return m_slots.size();
+}
+
+void VideoSamplePool::AddSlot()
+{
+    Slot slot;
+    slot.Texture = m_converter->CreateOutputTexture();
+    slot.OutputView = m_converter->CreateOutputView(slot.Texture.get());
+    slot.Callback = winrt::make_self<SampleReturnedCallback>(weak_from_this(), m_slots.size()).as<IMFAsyncCallback>();
+
+    winrt::com_ptr<IMFMediaBuffer> buffer;
+    winrt::check_hresult(MFCreateDXGISurfaceBuffer(winrt::guid_of<ID3D11Texture2D>(), slot.Texture.get(), 0, false, buffer.put()));
+    // Software encoders look at the length of the buffer
+    if (auto buffer2d = buffer.try_as<IMF2DBuffer>())
+    {
+        DWORD length = 0;
+        winrt::check_hresult(buffer2d->GetContiguousLength(&length));
+        winrt::check_hresult(buffer->SetCurrentLength(length));
+    }
+
+    winrt::com_ptr<IMFTrackedSample> trackedSample;
+    winrt::check_hresult(MFCreateTrackedSample(trackedSample.put()));
+    slot.Sample = trackedSample.as<IMFSample>();
+    winrt::check_hresult(slot.Sample->AddBuffer(buffer.get()));
+
+    // Every slot can be free at once, make sure returning one never has to grow this
+    m_freeSlots.reserve(m_slots.size() + 1);
+    m_freeSlots.push_back(m_slots.size());
+    m_slots.push_back(std::move(slot));
+}
+
+void VideoSamplePool::OnSampleReturned(size_t index, winrt::com_ptr<IMFSample> const& sample)
+{
+    auto lock = m_lock.lock_exclusive();
+    m_slots[index].Sample = sample;
+    m_freeSlots.push_back(index);
+}
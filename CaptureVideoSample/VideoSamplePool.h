@@ -0,0 +1,49 @@
+#pragma once
+#include "NV12Converter.h"
+
+struct PooledVideoSample
+{
+    // Wraps Texture, ready to be handed to the encoder
+    winrt::com_ptr<IMFSample> Sample;
+    winrt::com_ptr<ID3D11Texture2D> Texture;
+    winrt::com_ptr<ID3D11VideoProcessorOutputView> OutputView;
+};
+
+// NV12 textures for the encoder, each wrapped in a media sample once up
+// front. The encoder may hold on to its input for a few frames, so a sample
+// only comes back to the pool once the last reference to it is released.
+class VideoSamplePool : public std::enable_shared_from_this<VideoSamplePool>
+{
+public:
+    [[nodiscard]] static std::shared_ptr<VideoSamplePool> Create(
+        std::shared_ptr<NV12Converter> const& converter,
+        size_t initialCount);
+
+    // Only creates a new sample if every existing one is still in use.
+    PooledVideoSample Acquire();
+    // How many samples have been created, in use or not
+    size_t Count();
+
+private:
+    friend struct SampleReturnedCallback;
+
+    struct Slot
+    {
+        winrt::com_ptr<ID3D11Texture2D> Texture;
+        winrt::com_ptr<ID3D11VideoProcessorOutputView> OutputView;
+        winrt::com_ptr<IMFAsyncCallback> Callback;
+        // Null while the sample is in use
+        winrt::com_ptr<IMFSample> Sample;
+    };
+
+    VideoSamplePool(std::shared_ptr<NV12Converter> const& converter);
+    // m_lock must be held
+    void AddSlot();
+    void OnSampleReturned(size_t index, winrt::com_ptr<IMFSample> const& sample);
+
+private:
+    std::shared_ptr<NV12Converter> m_converter;
+    wil::srwlock m_lock;
+    std::vector<Slot> m_slots;
+    std::vector<size_t> m_freeSlots;
+};
@@ -1,6 +1,9 @@
 ﻿#include "pch.h"
 #include "MainWindow.h"
 #include "App.h"
+#include "TraceReplay.h"
+#include "QualityBenchmark.h"
+#include "Mp4StreamCopy.h"
 
 #pragma comment(linker,"/manifestdependency:\"type='win32' name='Microsoft.Windows.Common-Controls' version='6.0.0.0' processorArchitecture='*' publicKeyToken='6595b64144ccf1df' language='*'\"")
 
@@ -12,7 +15,6 @@ namespace winrt
     using namespace Windows::UI;
     using namespace Windows::UI::Composition;
     using namespace Windows::Graphics::Capture;
-    using namespace Windows::Media::Core;
 }
 
 namespace util
@@ -20,15 +22,54 @@ namespace util
     using namespace robmikh::common::desktop;
 }
 
+std::vector<std::wstring> GetCommandLineArgs()
+{
+    auto argc = 0;
+    auto argv = CommandLineToArgvW(GetCommandLineW(), &argc);
+    winrt::check_pointer(argv);
+    auto freeArgs = wil::scope_exit([argv]() { LocalFree(argv); });
+
+    std::vector<std::wstring> args;
+    for (auto i = 1; i < argc; i++)
+    {
+        args.push_back(argv[i]);
+    }
+    return args;
+}
+
 int __stdcall WinMain(HINSTANCE, HINSTANCE, PSTR, int)
 {
+    auto args = GetCommandLineArgs();
+
+    // Replaying a capture trace doesn't need any UI
+    if (auto replayOptions = TryParseTraceReplayOptions(args))
+    {
+        winrt::init_apartment(winrt::apartment_type::multi_threaded);
+        winrt::check_hresult(MFStartup(MF_VERSION));
+        auto mfShutdown = wil::scope_exit([]() { MFShutdown(); });
+        return RunTraceReplay(replayOptions.value());
+    }
+
+    if (auto benchmarkOptions = TryParseQualityBenchmarkOptions(args))
+    {
+        winrt::init_apartment(winrt::apartment_type::multi_threaded);
+        winrt::check_hresult(MFStartup(MF_VERSION));
+        auto mfShutdown = wil::scope_exit([]() { MFShutdown(); });
+        return RunQualityBenchmark(benchmarkOptions.value());
+    }
+
+    // Trimming and joining recordings only touches the files
+    if (auto streamCopyOptions = TryParseMp4StreamCopyOptions(args))
+    {
+        return RunMp4StreamCopy(streamCopyOptions.value());
+    }
+
     // Initialize COM
     winrt::init_apartment(winrt::apartment_type::single_threaded);
 
     // Check to see that we have the minimum required features
     auto isCaptureSupported = winrt::GraphicsCaptureSession::IsSupported();
-    auto sampleSupported = winrt::ApiInformation::IsMethodPresent(winrt::name_of<winrt::MediaStreamSample>(), L"CreateFromDirect3D11Surface");
-    if (!isCaptureSupported || !sampleSupported)
+    if (!isCaptureSupported)
     {
         MessageBoxW(nullptr,
             L"This release of Windows does not have the minimum required features! Please update to a newer release.",
@@ -37,6 +78,10 @@ int __stdcall WinMain(HINSTANCE, HINSTANCE, PSTR, int)
         return 1;
     }
 
+    // Initialize Media Foundation, used for encoding
+    winrt::check_hresult(MFStartup(MF_VERSION));
+    auto mfShutdown = wil::scope_exit([]() { MFShutdown(); });
+
     // Create the DispatcherQueue that the compositor needs to run
     auto controller = util::CreateDispatcherQueueControllerForCurrentThread();
 
@@ -50,8 +95,16 @@ int __stdcall WinMain(HINSTANCE, HINSTANCE, PSTR, int)
     // Create our app
     auto app = std::make_shared<App>(root);
 
+    // --record-trace <path> [--trace-pixels]
+    auto recordTrace = std::find(args.begin(), args.end(), L"--record-trace");
+    if (recordTrace != args.end() && std::next(recordTrace) != args.end())
+    {
+        auto includePixels = std::find(args.begin(), args.end(), L"--trace-pixels") != args.end();
+        app->EnableCaptureTrace(*std::next(recordTrace), includePixels);
+    }
+
     // Create our window and connect our visual tree
-    auto window = MainWindow(L"CaptureVideoSample", 800, 600, app);
+    auto window = MainWindow(L"CaptureVideoSample", 800, 780, app);
     auto target = window.CreateWindowTarget(compositor);
     target.Root(root);
 
@@ -2,6 +2,8 @@
 
 // Windows
 #include <windows.h>
+#include <winsock2.h>
+#include <ws2tcpip.h>
 
 // Must come before C++/WinRT
 #include <wil/cppwinrt.h>
@@ -19,10 +21,6 @@
 #include <winrt/Windows.Graphics.Capture.h>
 #include <winrt/Windows.Graphics.DirectX.h>
 #include <winrt/Windows.Graphics.DirectX.Direct3d11.h>
-#include <winrt/Windows.Media.h>
-#include <winrt/Windows.Media.Core.h>
-#include <winrt/Windows.Media.Transcoding.h>
-#include <winrt/Windows.Media.MediaProperties.h>
 #include <winrt/Windows.Storage.h>
 #include <winrt/Windows.Storage.Streams.h>
 #include <winrt/Windows.Storage.Pickers.h>
@@ -36,6 +34,15 @@
 #include <d2d1_3.h>
 #include <wincodec.h>
 
+// Media Foundation
+#include <mfapi.h>
+#include <mfidl.h>
+#include <mferror.h>
+#include <mftransform.h>
+#include <mfreadwrite.h>
+#include <codecapi.h>
+#include <icodecapi.h>
+
 // STL
 #include <vector>
 #include <string>
@@ -50,6 +57,10 @@
 #include <chrono>
 #include <mutex>
 #include <deque>
+#include <cmath>
+#include <sstream>
+#include <fstream>
+#include <random>
 
 // robmikh.common
 #include <robmikh.common/composition.interop.h>